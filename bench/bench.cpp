@@ -0,0 +1,1946 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gdax-orderbook.hpp"
+#include "gdax-orderbook/btree-map.hpp"
+#include "gdax-orderbook/epoch-storage.hpp"
+#include "gdax-orderbook/fanout-server.hpp"
+#include "gdax-orderbook/fill-simulator.hpp"
+#include "gdax-orderbook/hybrid-map.hpp"
+#include "gdax-orderbook/implied-book.hpp"
+#include "gdax-orderbook/left-right-map.hpp"
+#include "gdax-orderbook/multicast.hpp"
+#include "gdax-orderbook/replay-runner.hpp"
+#include "gdax-orderbook/single-writer-skip-list.hpp"
+#include "gdax-orderbook/tick-store.hpp"
+#include "gdax-orderbook/wire-format.hpp"
+
+/*
+ * Offline benchmark of the per-message apply path (JSON parse plus map
+ * update), replayed from recorded feed files containing one websocket frame
+ * per line.  Each corpus is replayed several times, and the median and median
+ * absolute deviation (MAD) of each metric are reported, in the same format
+ * as the committed baseline, against which results can also be compared.
+ * Iteration of the resulting book, as readers do, is timed too.  Or, with
+ * --codec, the gdax::wire binary format and the gdax::store tick store are
+ * compared with the feed's JSON, or, with --backtest, the gdax::FillSimulator
+ * is timed, or, with --implied, the gdax::ImpliedBook.
+ */
+
+// every allocation made while replaying is counted, to report allocs/message
+static std::atomic<size_t> g_allocations(0);
+
+// GCC 12 takes new and delete, once inlined, for malloc() and free()
+// mismatched with the default operators; they are paired here
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+struct Sample
+{
+    double framesPerSecond;
+    double p99ApplyNanoseconds;
+    double allocationsPerFrame;
+    double iterateNanoseconds;
+};
+
+struct CodecSample
+{
+    double jsonBytesPerFrame;
+    double wireBytesPerFrame;
+    double jsonDecodeNanoseconds; // per frame
+    double wireEncodeNanoseconds;
+    double wireDecodeNanoseconds;
+    double storeBytesPerFrame;
+    double storeWriteNanoseconds;
+    double storeDecodeNanoseconds; // per change, not per frame
+};
+
+// keeps the compiler from optimizing the iteration benchmark away
+static volatile double g_sink;
+
+/**
+ * Befriended by BasicGDAXOrderBook, so that it can drive the exact same
+ * private apply path as the websocket message handler, without any network.
+ */
+class GDAXOrderBookBenchmark
+{
+public:
+    template<typename Book>
+    static Sample replay(std::vector<std::string> const& frames,
+                         gdax::BookOptions const& options)
+    {
+        Book book(typename Book::Offline(), options);
+        rapidjson::Document json;
+
+        std::vector<double> latencies;
+        latencies.reserve(frames.size());
+
+        size_t allocationsBefore = g_allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        if (options.parseThreads)
+        {
+            // the writer's latency only, as parsing is done meanwhile
+            typename Book::pipeline_t pipeline(options.parseThreads,
+                [&book, &latencies](typename Book::batch_t & batch)
+                {
+                    Book::ensureThreadAttached();
+                    auto applyStart = std::chrono::steady_clock::now();
+                    book.applyBatch(batch);
+                    latencies.push_back(
+                        std::chrono::duration<double, std::nano>(
+                            std::chrono::steady_clock::now() - applyStart)
+                        .count());
+                });
+            if (options.conflateBacklog)
+            {
+                pipeline.conflate(options.conflateBacklog,
+                    [&book](typename Book::batch_t & into,
+                            typename Book::batch_t const& next)
+                    {
+                        return book.m_conflator.merge(into, next);
+                    });
+            }
+            for (auto const& frame : frames) pipeline.submit(frame);
+            pipeline.drain();
+        }
+        else for (auto const& frame : frames)
+        {
+            auto frameStart = std::chrono::steady_clock::now();
+            json.Parse(frame.c_str());
+            book.processMessage(json);
+            latencies.push_back(
+                std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - frameStart).count());
+        }
+        auto finish = std::chrono::steady_clock::now();
+        // latencies was reserved up front, so it allocated nothing in between
+        size_t allocations = g_allocations.load() - allocationsBefore;
+
+        std::sort(latencies.begin(), latencies.end());
+        Sample sample;
+        sample.framesPerSecond = frames.size() /
+            std::chrono::duration<double>(finish - start).count();
+        sample.p99ApplyNanoseconds = latencies.empty() ? 0 :
+            latencies[static_cast<size_t>(0.99*(latencies.size()-1))];
+        sample.allocationsPerFrame =
+            frames.empty() ? 0 : double(allocations)/frames.size();
+
+        // a full walk of both sides of the final book, best of a few, as
+        // the first warms the caches
+        sample.iterateNanoseconds = 0;
+        for (int pass = 0 ; pass < 5 ; ++pass)
+        {
+            auto iterateStart = std::chrono::steady_clock::now();
+            typename Book::read_lock_t lock;
+            double total = 0;
+            for (auto level = book.bids.begin() ; level != book.bids.end() ;
+                 ++level)
+            {
+                total += level->second;
+            }
+            for (auto level = book.offers.begin() ;
+                 level != book.offers.end() ; ++level)
+            {
+                total += level->second;
+            }
+            double nanoseconds = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - iterateStart).count();
+            if (pass == 0 || nanoseconds < sample.iterateNanoseconds)
+                sample.iterateNanoseconds = nanoseconds;
+            g_sink = total;
+        }
+
+        // before the book, and with it the libcds garbage collector, goes
+        cds::threading::Manager::detachThread();
+        return sample;
+    }
+
+    /**
+     * Times turning each frame into the book's gdax::ChangeBatch from its
+     * JSON, as the book does, against from its gdax::wire encoding, and the
+     * encoding itself, and then writing the batches to a gdax::store tick
+     * store, and decoding its blocks.  Throws if any batch does not survive
+     * either round trip.
+     */
+    static CodecSample codec(std::vector<std::string> const& frames)
+    {
+        using batch_t = GDAXOrderBook::batch_t;
+        using clock = std::chrono::steady_clock;
+        auto perFrame = [&frames](clock::time_point start)
+        {
+            return std::chrono::duration<double, std::nano>(
+                clock::now() - start).count() / frames.size();
+        };
+
+        CodecSample sample;
+        sample.jsonBytesPerFrame = 0;
+        for (auto const& frame : frames)
+            sample.jsonBytesPerFrame += double(frame.size())/frames.size();
+
+        rapidjson::Document json;
+        batch_t batch;
+        auto start = clock::now();
+        for (auto const& frame : frames)
+        {
+            batch.clear();
+            json.Parse(frame.c_str());
+            GDAXOrderBook::parseMessage(json, batch);
+        }
+        sample.jsonDecodeNanoseconds = perFrame(start);
+
+        std::vector<batch_t> batches(frames.size());
+        size_t capacity = 0;
+        for (size_t i = 0 ; i < frames.size() ; ++i)
+        {
+            json.Parse(frames[i].c_str());
+            GDAXOrderBook::parseMessage(json, batches[i]);
+            capacity +=
+                gdax::wire::Encoder::encodedLength(batches[i].changes.size());
+        }
+        std::vector<char> wire(capacity);
+        std::vector<size_t> offsets(frames.size() + 1, 0);
+        start = clock::now();
+        for (size_t i = 0 ; i < frames.size() ; ++i)
+        {
+            offsets[i+1] = offsets[i] + gdax::wire::encode(
+                batches[i], i, 1, wire.data() + offsets[i]);
+        }
+        sample.wireEncodeNanoseconds = perFrame(start);
+        sample.wireBytesPerFrame = double(offsets.back())/frames.size();
+
+        gdax::wire::Decoder decoder;
+        start = clock::now();
+        for (size_t i = 0 ; i < frames.size() ; ++i)
+        {
+            batch.clear();
+            if (decoder.wrap(wire.data() + offsets[i],
+                             offsets[i+1] - offsets[i]))
+            {
+                gdax::wire::decode(decoder, batch);
+            }
+        }
+        sample.wireDecodeNanoseconds = perFrame(start);
+
+        for (size_t i = 0 ; i < frames.size() ; ++i)
+        {
+            batch.clear();
+            if (decoder.wrap(wire.data() + offsets[i],
+                             offsets[i+1] - offsets[i]))
+            {
+                gdax::wire::decode(decoder, batch);
+            }
+            bool same = batch.type == batches[i].type
+                && batch.changes.size() == batches[i].changes.size();
+            for (size_t j = 0 ; same && j < batch.changes.size() ; ++j)
+            {
+                same = batch.changes[j].side == batches[i].changes[j].side
+                    && batch.changes[j].price == batches[i].changes[j].price
+                    && batch.changes[j].size == batches[i].changes[j].size;
+            }
+            if (!same)
+            {
+                throw std::runtime_error("wire round trip changed frame "
+                                         + std::to_string(i));
+            }
+        }
+
+        char const* const path = "bench-tick-store.tmp";
+        start = clock::now();
+        {
+            gdax::store::Writer writer(path);
+            for (size_t i = 0 ; i < frames.size() ; ++i)
+                writer.append(int64_t(i)*1000, i + 1, batches[i]);
+        }
+        sample.storeWriteNanoseconds = perFrame(start);
+
+        gdax::store::Reader reader(path);
+        gdax::store::Columns columns;
+        size_t changes = 0;
+        start = clock::now();
+        for (size_t block = 0 ; block < reader.blocks().size() ; ++block)
+        {
+            reader.read(block, columns);
+            changes += columns.rows();
+        }
+        sample.storeDecodeNanoseconds = std::chrono::duration<double,
+            std::nano>(clock::now() - start).count() / (changes ? changes : 1);
+        {
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            sample.storeBytesPerFrame = double(file.tellg())/frames.size();
+        }
+
+        size_t mismatches = 0, frame = 0;
+        reader.replay<GDAXOrderBook::Price, GDAXOrderBook::Size>(0,
+            [&](int64_t, uint64_t sequence, batch_t const& batch)
+            {
+                while (frame < batches.size() && batches[frame].changes.empty())
+                    ++frame;
+                if (frame == batches.size() || sequence != frame + 1
+                    || batch.type != batches[frame].type
+                    || batch.changes.size() != batches[frame].changes.size())
+                {
+                    ++mismatches;
+                }
+                for (size_t j = 0 ; !mismatches && j < batch.changes.size()
+                     ; ++j)
+                {
+                    auto const& change = batches[frame].changes[j];
+                    mismatches += batch.changes[j].side != change.side
+                        || batch.changes[j].price != change.price
+                        || batch.changes[j].size != change.size;
+                }
+                ++frame;
+            });
+        std::remove(path);
+        if (mismatches != 0)
+            throw std::runtime_error("tick store round trip changed frames");
+        return sample;
+    }
+
+    /**
+     * Times a gdax::FillSimulator over the corpus's batches, in nanoseconds
+     * per change, as a strategy keeps a few dozen orders resting within 40
+     * ticks of the snapshot's touch, replacing them as they fill.
+     */
+    static double backtest(std::vector<std::string> const& frames)
+    {
+        using batch_t = GDAXOrderBook::batch_t;
+        std::vector<batch_t> batches(frames.size());
+        rapidjson::Document json;
+        size_t changes = 0;
+        for (size_t i = 0 ; i < frames.size() ; ++i)
+        {
+            json.Parse(frames[i].c_str());
+            GDAXOrderBook::parseMessage(json, batches[i]);
+            changes += batches[i].changes.size();
+        }
+        GDAXOrderBook::Price bid = 0, offer = 0;
+        for (auto const& change : batches.front().changes)
+        {
+            if (change.side == gdax::Side::Bid)
+                bid = std::max(bid, change.price);
+            else if (offer == 0 || change.price < offer)
+                offer = change.price;
+        }
+
+        size_t fills = 0;
+        gdax::FillSimulator<GDAXOrderBook::Price, GDAXOrderBook::Size>
+            simulator([&fills](gdax::FillSimulator<GDAXOrderBook::Price,
+                GDAXOrderBook::Size>::Fill const&) { ++fills; });
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0 ; i < batches.size() ; ++i)
+        {
+            simulator.apply(int64_t(i), batches[i]);
+            if (i % 16 == 0 && simulator.resting() < 64)
+            {
+                simulator.place(gdax::Side::Bid, bid - i % 40, 1);
+                simulator.place(gdax::Side::Offer, offer + i % 40, 1);
+            }
+        }
+        double const nanoseconds = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count();
+        g_sink = double(fills);
+        return nanoseconds / (changes ? changes : 1);
+    }
+
+    /**
+     * Times a gdax::ImpliedBook of its 10 best levels, crossing the corpus
+     * with itself, in nanoseconds per leg change: both legs load the
+     * snapshot, then take the updates in turn, the first priced as if in
+     * millionths, as an ETH-BTC leg's would be, the second in cents.
+     */
+    static double implied(std::vector<std::string> const& frames)
+    {
+        using batch_t = GDAXOrderBook::batch_t;
+        std::vector<batch_t> batches(frames.size());
+        rapidjson::Document json;
+        size_t changes = 0;
+        for (size_t i = 0 ; i < frames.size() ; ++i)
+        {
+            json.Parse(frames[i].c_str());
+            GDAXOrderBook::parseMessage(json, batches[i]);
+            changes += batches[i].changes.size();
+        }
+
+        gdax::ImpliedBook<GDAXOrderBook> implied(
+            gdax::ImpliedLeg(false, 1e-6), gdax::ImpliedLeg(false, 0.01));
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0 ; i < batches.size() ; ++i)
+        {
+            if (batches[i].type == batch_t::Snapshot)
+                implied.apply(0, batches[i]);
+            implied.apply(i % 2, batches[i]);
+        }
+        double const nanoseconds = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count();
+        g_sink = double(implied.book().readiness()
+            == gdax::Readiness::FullDepth);
+        return nanoseconds / (changes ? changes : 1);
+    }
+};
+
+/**
+ * Writes a deterministic, GDAX-formatted feed: one snapshot with `depth`
+ * levels per side, followed by `updates` l2update frames clustered around
+ * the touch, about a third of whose changes remove their level.
+ */
+void generateCorpus(std::string const& path, size_t depth, size_t updates)
+{
+    std::ofstream out(path);
+    std::mt19937 random(20180614);
+    unsigned const mid = 5000000; // cents
+
+    char price[32], size[32];
+    out << "{\"type\":\"snapshot\",\"product_id\":\"BTC-USD\",\"bids\":[";
+    for (size_t i = 0 ; i < depth ; ++i)
+    {
+        std::snprintf(price, sizeof price, "%.2f", (mid - 1 - i)/100.0);
+        std::snprintf(size, sizeof size, "%.8f", (random()%100000)/1e4);
+        out << (i ? "," : "") << "[\"" << price << "\",\"" << size << "\"]";
+    }
+    out << "],\"asks\":[";
+    for (size_t i = 0 ; i < depth ; ++i)
+    {
+        std::snprintf(price, sizeof price, "%.2f", (mid + 1 + i)/100.0);
+        std::snprintf(size, sizeof size, "%.8f", (random()%100000)/1e4);
+        out << (i ? "," : "") << "[\"" << price << "\",\"" << size << "\"]";
+    }
+    out << "]}\n";
+
+    std::geometric_distribution<unsigned> distanceFromTouch(0.02);
+    for (size_t i = 0 ; i < updates ; ++i)
+    {
+        out << "{\"type\":\"l2update\",\"product_id\":\"BTC-USD\",\"changes\":[";
+        for (unsigned j = 0, n = 1 + random()%3 ; j < n ; ++j)
+        {
+            bool buy = random()%2;
+            unsigned distance = 1 + distanceFromTouch(random)%depth;
+            std::snprintf(price, sizeof price, "%.2f",
+                (buy ? mid - distance : mid + distance)/100.0);
+            if (random()%3 == 0) std::snprintf(size, sizeof size, "0");
+            else std::snprintf(size, sizeof size, "%.8f",
+                                   (random()%100000)/1e4);
+            out << (j ? "," : "") << "[\"" << (buy ? "buy" : "sell")
+                << "\",\"" << price << "\",\"" << size << "\"]";
+        }
+        out << "],\"time\":\"2018-06-14T13:19:23.000000Z\"}\n";
+    }
+}
+
+std::vector<std::string> loadCorpus(std::string const& path)
+{
+    std::vector<std::string> frames;
+    std::ifstream in(path);
+    if (!in) { throw std::runtime_error("cannot read corpus " + path); }
+    for (std::string line ; std::getline(in, line) ; )
+    {
+        if (!line.empty()) frames.push_back(line);
+    }
+    return frames;
+}
+
+struct Statistic { double median, mad; };
+
+Statistic summarize(std::vector<double> values)
+{
+    auto median = [](std::vector<double> & v) {
+        std::sort(v.begin(), v.end());
+        size_t n = v.size();
+        return n%2 ? v[n/2] : (v[n/2-1] + v[n/2])/2;
+    };
+    Statistic s;
+    s.median = median(values);
+    for (auto & v : values) v = std::fabs(v - s.median);
+    s.mad = median(values);
+    return s;
+}
+
+// corpus name -> metric name -> statistic
+using Results = std::map<std::string, std::map<std::string, Statistic>>;
+
+Results readResults(std::string const& path)
+{
+    Results results;
+    std::ifstream in(path);
+    if (!in) { throw std::runtime_error("cannot read baseline " + path); }
+    for (std::string line ; std::getline(in, line) ; )
+    {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string corpus, metric;
+        Statistic s;
+        if (fields >> corpus >> metric >> s.median >> s.mad)
+            results[corpus][metric] = s;
+    }
+    return results;
+}
+
+/**
+ * A metric regresses when it is worse than the baseline median by more than
+ * both the relative tolerance and three times the combined MADs, so that
+ * ordinary run-to-run noise on either side does not fail the gate.
+ * Allocation counts are deterministic and get no noise allowance beyond
+ * rounding.
+ */
+bool compare(Results const& baseline, Results const& current,
+             double tolerance)
+{
+    bool regressed = false;
+    size_t compared = 0;
+    for (auto const& corpus : current)
+    {
+        auto baselineCorpus = baseline.find(corpus.first);
+        if (baselineCorpus == baseline.end())
+        {
+            std::cerr << "warning: no baseline for corpus " << corpus.first
+                << std::endl;
+            continue;
+        }
+        for (auto const& metric : corpus.second)
+        {
+            auto b = baselineCorpus->second.find(metric.first);
+            if (b == baselineCorpus->second.end())
+            {
+                // e.g. --codec metrics against a baseline recorded without
+                std::cerr << "PERFORMANCE REGRESSION: no baseline for "
+                    << corpus.first << " " << metric.first << "; record one"
+                    " with the same options" << std::endl;
+                regressed = true;
+                continue;
+            }
+            ++compared;
+
+            bool higherIsBetter = metric.first == "frames_per_sec";
+            double was = b->second.median, now = metric.second.median;
+            double worseBy = higherIsBetter ? was - now : now - was;
+            double allowance =
+                metric.first == "allocs_per_frame" ? 1e-6 :
+                std::max(tolerance*std::fabs(was),
+                         3*(b->second.mad + metric.second.mad));
+
+            bool bad = worseBy > allowance;
+            (bad ? std::cerr : std::cout)
+                << (bad ? "PERFORMANCE REGRESSION: " : "ok: ")
+                << corpus.first << " " << metric.first << " baseline " << was
+                << " now " << now << " (" << std::showpos
+                << (was ? 100*(now - was)/was : 0) << std::noshowpos
+                << "%, allowed " << allowance << ")" << std::endl;
+            regressed |= bad;
+        }
+    }
+    if (compared == 0)
+    {
+        std::cerr << "PERFORMANCE REGRESSION: nothing in the baseline to"
+            " compare with" << std::endl;
+        regressed = true;
+    }
+    return !regressed;
+}
+
+/**
+ * Checks every kernel variant the CPU supports against the scalar one, on
+ * every quoted string in the corpora plus some edge cases, each placed both
+ * mid-page and flush against a page boundary, and on searches of sorted
+ * B+-tree-node-sized arrays of keys, including the extremes of their range.
+ * Returns false on a mismatch.
+ */
+bool checkKernels(std::vector<std::string> const& corpora)
+{
+    using namespace gdax::kernels;
+
+    std::vector<std::string> inputs = {
+        "0", "0.", ".5", ".", "", "1.2.3", "12a", "-1", "1e5", " 1",
+        "513.98", "513.999", "0.01086000", "148.99500000", "123456789012345",
+        "999999999999999", "1234567890.12345678", "00000000000000.1",
+        "9999999999.99999999", "99999999999.9" };
+    for (auto const& path : corpora)
+    {
+        for (auto const& frame : loadCorpus(path))
+        {
+            for (size_t open = frame.find('"') ; open != std::string::npos ; )
+            {
+                size_t close = frame.find('"', open + 1);
+                if (close == std::string::npos) break;
+                inputs.push_back(frame.substr(open + 1, close - open - 1));
+                open = frame.find('"', close + 1);
+            }
+        }
+    }
+
+    static char page[3*4096];
+    char* const pageEnd = page + (2*4096 - (uintptr_t(page) & 4095));
+    size_t checked = 0, mismatches = 0;
+    for (Isa isa : { Isa::sse42, Isa::avx2, Isa::avx512 })
+    {
+        if (!force(isa))
+        {
+            std::cout << name(isa) << ": not supported by this CPU" << std::endl;
+            continue;
+        }
+        for (auto const& input : inputs)
+        {
+            char* const placements[] = { page + 64, pageEnd - input.size() - 1 };
+            for (char* text : placements)
+            {
+                std::memcpy(text, input.c_str(), input.size() + 1);
+                for (unsigned decimals : { 0u, 2u, 8u })
+                {
+                    uint64_t expected = 0, actual = 0;
+                    bool expectedOk = detail::tables()[int(Isa::scalar)]
+                        .parseFixed(text, decimals, expected);
+                    bool actualOk = table().parseFixed(text, decimals, actual);
+                    ++checked;
+                    if (expectedOk != actualOk
+                        || (expectedOk && expected != actual))
+                    {
+                        ++mismatches;
+                        std::cerr << name(isa) << " parseFixed(\"" << input
+                            << "\", " << decimals << ") = " << actualOk << "/"
+                            << actual << ", scalar = " << expectedOk << "/"
+                            << expected << std::endl;
+                    }
+                }
+            }
+        }
+        std::mt19937 random(20180614);
+        for (unsigned trial = 0 ; trial < 2000 ; ++trial)
+        {
+            uint32_t keys[32];
+            for (uint32_t & key : keys)
+                key = trial % 4 == 0 ? random() % 64 : uint32_t(random());
+            if (trial % 3 == 0) { keys[0] = 0; keys[31] = UINT32_MAX; }
+            std::sort(std::begin(keys), std::end(keys));
+            for (unsigned n = 0 ; n <= 32 ; ++n)
+            {
+                for (unsigned k = 0 ; k < 32 ; ++k)
+                {
+                    for (uint32_t key : { keys[k] - 1, keys[k], keys[k] + 1 })
+                    {
+                        unsigned expected = detail::tables()[int(Isa::scalar)]
+                            .lowerBound(keys, n, key);
+                        unsigned actual = table().lowerBound(keys, n, key);
+                        ++checked;
+                        if (expected != actual)
+                        {
+                            ++mismatches;
+                            std::cerr << name(isa) << " lowerBound(n=" << n
+                                << ", " << key << ") = " << actual
+                                << ", scalar = " << expected << std::endl;
+                        }
+                    }
+                }
+            }
+        }
+        std::cout << name(isa) << ": checked against scalar" << std::endl;
+    }
+    force(detail::detect());
+    std::cout << checked << " checks, " << mismatches << " mismatches"
+        << std::endl;
+    return mismatches == 0;
+}
+
+/**
+ * Checks gdax::BitmapIndex against a std::set of the same prices, first on
+ * one thread, then with a writer setting and clearing prices on another.
+ * Concurrent queries may be stale, but must still answer beyond the price
+ * asked, with a price that was set at some point, and not beyond a price
+ * that stays set throughout.  The writer's prices are one per 4096 ticks,
+ * so that it keeps emptying and refilling words above the lowest level,
+ * which is what makes queries retry.
+ */
+bool checkBitmapIndex()
+{
+    using index_t = gdax::BitmapIndex<uint32_t>;
+    uint32_t const origin = 1u << 30, span = 1u << 24;
+    size_t checked = 0, mismatches = 0;
+    auto check = [&](bool ok, char const* what, uint32_t price)
+    {
+        ++checked;
+        if (ok) return;
+        if (++mismatches <= 10)
+            std::cerr << "bitmap index " << what << "(" << price
+                << ") is wrong" << std::endl;
+    };
+
+    std::mt19937 random(20180615);
+    {
+        index_t index(24);
+        index.set(origin + span/2); // places the span at [origin, +span)
+        std::set<uint32_t> prices = { origin + span/2 };
+        for (unsigned op = 0 ; op < 200000 ; ++op)
+        {
+            uint32_t const price = origin + (op % 2 ? random() % span
+                : span/2 - 2048 + random() % 4096);
+            if (random() % 3) { index.set(price); prices.insert(price); }
+            else { index.clear(price); prices.erase(price); }
+
+            uint32_t const query = origin + random() % span;
+            uint32_t next = 0;
+            auto above = prices.upper_bound(query);
+            bool found = index.nextAbove(query, next);
+            check(found == (above != prices.end())
+                  && (!found || next == *above), "nextAbove", query);
+            auto below = prices.lower_bound(query);
+            found = index.nextBelow(query, next);
+            check(found == (below != prices.begin())
+                  && (!found || next == *std::prev(below)), "nextBelow",
+                  query);
+            uint32_t const high = query + random() % 16384;
+            check(index.countBetween(query, high) == size_t(std::distance(
+                      prices.lower_bound(query), prices.upper_bound(high))),
+                  "countBetween", query);
+        }
+    }
+
+    index_t index(24);
+    std::set<uint32_t> stable, volatile_;
+    for (uint32_t price = origin + 1000 ; price < origin + span
+         ; price += span/64)
+    {
+        stable.insert(price);
+    }
+    for (uint32_t block = 0 ; block < span/4096 ; block += 3)
+        volatile_.insert(origin + block*4096 + random() % 4096);
+    index.set(origin + span/2);
+    stable.insert(origin + span/2);
+    for (uint32_t price : stable) index.set(price);
+    std::vector<uint32_t> const toggled(volatile_.begin(), volatile_.end());
+
+    std::atomic<bool> done(false);
+    std::thread writer([&]
+        {
+            std::mt19937 random(20180616);
+            while (!done.load(std::memory_order_relaxed))
+            {
+                uint32_t const price = toggled[random() % toggled.size()];
+                if (stable.count(price)) continue;
+                if (random() % 2) { index.set(price); }
+                else { index.clear(price); }
+            }
+        });
+    auto known = [&](uint32_t price)
+    {
+        return stable.count(price) || volatile_.count(price);
+    };
+    auto const until = std::chrono::steady_clock::now()
+        + std::chrono::seconds(2);
+    while (std::chrono::steady_clock::now() < until)
+    {
+        for (unsigned i = 0 ; i < 10000 ; ++i)
+        {
+            uint32_t const query = origin + random() % span;
+            uint32_t next = 0;
+            auto above = stable.upper_bound(query);
+            bool found = index.nextAbove(query, next);
+            check(found ? next > query && known(next)
+                          && (above == stable.end() || next <= *above)
+                        : above == stable.end(), "concurrent nextAbove",
+                  query);
+            auto below = stable.lower_bound(query);
+            found = index.nextBelow(query, next);
+            check(found ? next < query && known(next)
+                          && (below == stable.begin()
+                              || next >= *std::prev(below))
+                        : below == stable.begin(), "concurrent nextBelow",
+                  query);
+        }
+    }
+    done = true;
+    writer.join();
+
+    std::cout << checked << " checks, " << mismatches << " mismatches"
+        << std::endl;
+    return mismatches == 0;
+}
+
+/**
+ * Random batches for the checks: a snapshot of `depth` levels per side,
+ * then `updates` updates of one to eight changes clustered at the touch,
+ * about a third of which remove their level, sizes in 1e-4 units.
+ */
+std::vector<GDAXOrderBook::batch_t> randomBatches(std::mt19937 & random,
+                                                  size_t depth, size_t updates)
+{
+    using batch_t = GDAXOrderBook::batch_t;
+    unsigned const mid = 5000000;
+    std::vector<batch_t> batches(updates + 1);
+    batches[0].type = batch_t::Snapshot;
+    for (unsigned i = 0 ; i < depth ; ++i)
+    {
+        batches[0].changes.push_back({ gdax::Side::Bid, mid - 1 - i,
+            (1 + random() % 100000)/1e4 });
+        batches[0].changes.push_back({ gdax::Side::Offer, mid + i,
+            (1 + random() % 100000)/1e4 });
+    }
+    for (size_t i = 1 ; i <= updates ; ++i)
+    {
+        batches[i].type = batch_t::Update;
+        for (unsigned n = 1 + random() % 8 ; n > 0 ; --n)
+        {
+            bool const bid = random() % 2;
+            unsigned const away = random() % (2*depth);
+            batches[i].changes.push_back({
+                bid ? gdax::Side::Bid : gdax::Side::Offer,
+                bid ? mid - 1 - away : mid + away,
+                random() % 3 == 0 ? 0 : (1 + random() % 100000)/1e4 });
+        }
+    }
+    return batches;
+}
+
+// a side of a book, best first, sizes to the wire format's 1e-8
+template<typename Map>
+std::vector<std::pair<unsigned, int64_t>> levelsOf(Map & map)
+{
+    std::vector<std::pair<unsigned, int64_t>> levels;
+    for (auto const& level : map)
+        levels.emplace_back(level.first, std::llround(level.second*1e8));
+    return levels;
+}
+
+// as above, holding a read lock of the book's
+template<typename Map, typename Lock>
+std::vector<std::pair<unsigned, int64_t>> levelsOf(Map & map, Lock)
+{
+    Lock lock;
+    return levelsOf(map);
+}
+
+template<typename Book>
+bool sameBook(Book & book, Book & other)
+{
+    using lock_t = typename Book::read_lock_t;
+    return levelsOf(book.bids, lock_t()) == levelsOf(other.bids, lock_t())
+        && levelsOf(book.offers, lock_t())
+            == levelsOf(other.offers, lock_t());
+}
+
+/**
+ * Checks a gdax::MulticastSubscriber's replica of a book against the book,
+ * as republished by a gdax::MulticastPublisher over loopback: the replica
+ * must match it after a delta datagram goes missing, which the check fakes
+ * by sending one out of sequence, and a replica that subscribes once the
+ * book is quiet must load it from the periodic snapshots alone.
+ */
+bool checkMulticast()
+{
+    using subscriber_t = gdax::MulticastSubscriber<GDAXOrderBook::Price,
+                                                   GDAXOrderBook::Size>;
+    gdax::MulticastChannel const channel("239.255.67.69", 30167, 30168,
+                                         "127.0.0.1");
+    uint32_t const productId = 7;
+    gdax::MulticastPublisher<GDAXOrderBook::Price, GDAXOrderBook::Size>
+        publisher(channel, productId, std::chrono::milliseconds(50));
+    auto source = GDAXOrderBook::threadless();
+    source->addListener([&publisher](GDAXOrderBook::batch_t const& batch)
+        {
+            publisher.publish(batch);
+        });
+
+    auto subscriber = std::make_shared<subscriber_t>(channel, productId);
+    auto replica = GDAXOrderBook::threadless(subscriber);
+    // pumps the replicas until they match the source, or a few seconds pass
+    auto converge = [&source](std::vector<GDAXOrderBook*> const& replicas)
+    {
+        auto const until = std::chrono::steady_clock::now()
+            + std::chrono::seconds(5);
+        for (;;)
+        {
+            bool same = true;
+            for (auto* book : replicas)
+            {
+                book->pump();
+                same = same && sameBook(*book, *source);
+            }
+            if (same) return true;
+            if (std::chrono::steady_clock::now() > until) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+
+    std::mt19937 random(20180617);
+    auto const batches = randomBatches(random, 500, 4000);
+    boost::asio::io_service io;
+    boost::asio::ip::udp::socket faker(io, boost::asio::ip::udp::v4());
+    faker.set_option(boost::asio::ip::multicast::outbound_interface(
+        boost::asio::ip::address_v4::from_string(channel.interface)));
+    bool ok = true;
+    for (size_t i = 0 ; i < batches.size() ; ++i)
+    {
+        source->apply(batches[i]);
+        replica->pump();
+        if (i == batches.size()/2)
+        {
+            if (!converge({ replica.get() }))
+            {
+                std::cerr << "multicast replica does not load" << std::endl;
+                ok = false;
+            }
+            // as if the next delta but one arrived, and the next was lost
+            std::vector<char> buffer(
+                gdax::wire::Encoder::encodedLength(batches[i].changes.size()));
+            buffer.resize(gdax::wire::encode(batches[i],
+                publisher.sequence() + 2, productId, buffer.data()));
+            faker.send_to(boost::asio::buffer(buffer),
+                boost::asio::ip::udp::endpoint(
+                    boost::asio::ip::address::from_string(channel.group),
+                    channel.deltaPort));
+        }
+    }
+    if (!converge({ replica.get() }))
+    {
+        std::cerr << "multicast replica does not match the book" << std::endl;
+        ok = false;
+    }
+    if (subscriber->gaps() == 0)
+    {
+        std::cerr << "multicast replica missed the faked gap" << std::endl;
+        ok = false;
+    }
+
+    auto late = GDAXOrderBook::threadless(
+        std::make_shared<subscriber_t>(channel, productId));
+    if (!converge({ late.get() }))
+    {
+        std::cerr << "late multicast replica of a quiet book does not load"
+            << std::endl;
+        ok = false;
+    }
+    std::cout << batches.size() << " batches, " << subscriber->gaps()
+        << " gaps, " << (ok ? "replicas match" : "MISMATCH") << std::endl;
+    return ok;
+}
+
+/**
+ * A client of a gdax::FanoutServer for checkFanout(), which keeps the book
+ * its stream describes, on a thread of its own, until the stream ends; if
+ * `stalled`, it reads nothing until resume()d.
+ */
+class FanoutClient
+{
+public:
+    FanoutClient(unsigned short port, bool stalled)
+        : m_socket(m_io), m_stalled(stalled)
+    {
+        m_socket.open(boost::asio::ip::tcp::v4());
+        if (stalled)
+        {
+            m_socket.set_option(
+                boost::asio::socket_base::receive_buffer_size(4096));
+        }
+        m_socket.connect(boost::asio::ip::tcp::endpoint(
+            boost::asio::ip::address::from_string("127.0.0.1"), port));
+        m_thread = std::thread([this] { read(); });
+    }
+
+    ~FanoutClient()
+    {
+        resume();
+        boost::system::error_code error;
+        m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
+        m_thread.join();
+    }
+
+    void resume() { m_stalled = false; }
+
+    bool ended() const { return m_ended; }
+    bool inSequence() const { return m_inSequence; }
+
+    std::vector<std::pair<unsigned, int64_t>> bids()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return { m_bids.rbegin(), m_bids.rend() };
+    }
+    std::vector<std::pair<unsigned, int64_t>> offers()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return { m_offers.begin(), m_offers.end() };
+    }
+
+private:
+    boost::asio::io_service m_io;
+    boost::asio::ip::tcp::socket m_socket;
+    std::atomic<bool> m_stalled;
+    std::atomic<bool> m_ended{false};
+    std::atomic<bool> m_inSequence{true};
+    std::mutex m_mutex; // guards the book
+    std::map<unsigned, int64_t> m_bids, m_offers;
+    std::thread m_thread;
+
+    void read()
+    {
+        while (m_stalled)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::vector<char> stream;
+        char buffer[65536];
+        uint64_t sequence = 0;
+        boost::system::error_code error;
+        for (;;)
+        {
+            size_t const length = m_socket.read_some(
+                boost::asio::buffer(buffer), error);
+            if (error) break;
+            stream.insert(stream.end(), buffer, buffer + length);
+            size_t offset = 0;
+            while (size_t const message = messageLength(
+                       stream.data() + offset, stream.size() - offset))
+            {
+                gdax::wire::Decoder decoder;
+                if (!decoder.wrap(stream.data() + offset, message)
+                    || decoder.sequence() <= sequence)
+                {
+                    m_inSequence = false;
+                }
+                sequence = decoder.sequence();
+                GDAXOrderBook::batch_t batch;
+                gdax::wire::decode(decoder, batch);
+                apply(batch);
+                offset += message;
+            }
+            stream.erase(stream.begin(), stream.begin() + offset);
+        }
+        m_ended = true;
+    }
+
+    // the length of the message at `data`, or 0 until `available` holds it
+    static size_t messageLength(char const* data, size_t available)
+    {
+        using namespace gdax::wire;
+        if (available < MessageHeader::encodedLength) return 0;
+        size_t const group = MessageHeader::encodedLength
+            + MessageHeader(const_cast<char*>(data)).blockLength();
+        if (available < group + Encoder::groupHeaderLength) return 0;
+        size_t const length = group + Encoder::groupHeaderLength
+            + size_t(detail::load<uint16_t>(data + group))
+                *detail::load<uint32_t>(data + group + 4);
+        return available < length ? 0 : length;
+    }
+
+    void apply(GDAXOrderBook::batch_t const& batch)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (batch.type == GDAXOrderBook::batch_t::Snapshot)
+        {
+            m_bids.clear();
+            m_offers.clear();
+        }
+        for (auto const& change : batch.changes)
+        {
+            auto & side = change.side == gdax::Side::Bid ? m_bids : m_offers;
+            if (change.size == 0) { side.erase(change.price); }
+            else { side[change.price] = std::llround(change.size*1e8); }
+        }
+    }
+};
+
+/**
+ * Checks gdax::FanoutServer over loopback, under each FanoutOptions::
+ * SlowClient policy: clients connected before the book's snapshot and
+ * after it, and one that reads nothing for a while, each keep the book
+ * their stream describes, which must match the server's source book, but
+ * for a stalled client that the server is to disconnect, whose stream must
+ * end instead.  Enough is published for the stalled client to fall more
+ * than maxBuffered behind.
+ */
+bool checkFanout()
+{
+    using server_t = gdax::FanoutServer<GDAXOrderBook::Price,
+                                        GDAXOrderBook::Size>;
+    bool ok = true;
+    for (auto policy : { gdax::FanoutOptions::Conflate,
+                         gdax::FanoutOptions::Disconnect })
+    {
+        char const* const name =
+            policy == gdax::FanoutOptions::Conflate ? "conflate" : "disconnect";
+        server_t server(7, gdax::FanoutOptions(0, 1 << 20, policy,
+                                               "127.0.0.1"));
+        auto source = GDAXOrderBook::threadless();
+        source->addListener([&server](GDAXOrderBook::batch_t const& batch)
+            {
+                server.publish(batch);
+            });
+
+        std::vector<std::unique_ptr<FanoutClient>> clients;
+        clients.emplace_back(new FanoutClient(server.port(), false));
+        clients.emplace_back(new FanoutClient(server.port(), true));
+        std::mt19937 random(20180618);
+        auto const batches = randomBatches(random, 500, 100000);
+        size_t published = 0; // bytes, as encoded for each client
+        for (size_t i = 0 ; i < batches.size() ; ++i)
+        {
+            source->apply(batches[i]);
+            published += gdax::wire::Encoder::encodedLength(
+                batches[i].changes.size());
+            if (i == batches.size()/2)
+                clients.emplace_back(new FanoutClient(server.port(), false));
+            // at a pace the clients that read keep up with
+            if (i % 1000 == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        clients[1]->resume();
+
+        using lock_t = GDAXOrderBook::read_lock_t;
+        auto const bids = levelsOf(source->bids, lock_t());
+        auto const offers = levelsOf(source->offers, lock_t());
+        auto const until = std::chrono::steady_clock::now()
+            + std::chrono::seconds(10);
+        for (size_t c = 0 ; c < clients.size() ; ++c)
+        {
+            FanoutClient & client = *clients[c];
+            bool const dropped = c == 1
+                && policy == gdax::FanoutOptions::Disconnect;
+            while (std::chrono::steady_clock::now() < until
+                   && (dropped ? !client.ended()
+                       : client.bids() != bids || client.offers() != offers))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            bool const matched = dropped ? client.ended()
+                : client.bids() == bids && client.offers() == offers;
+            if (!matched || !client.inSequence())
+            {
+                std::cerr << "fanout " << name << ": client " << c
+                    << (dropped ? " was not disconnected"
+                        : matched ? " was sent messages out of sequence"
+                        : " does not match the book") << std::endl;
+                ok = false;
+            }
+        }
+        if ((server.disconnected() != 0)
+            != (policy == gdax::FanoutOptions::Disconnect))
+        {
+            std::cerr << "fanout " << name << ": " << server.disconnected()
+                << " clients disconnected" << std::endl;
+            ok = false;
+        }
+        std::cout << name << ": " << batches.size() << " batches, "
+            << published/1024 << " KiB a client, " << clients.size()
+            << " clients, " << server.disconnected() << " disconnected"
+            << std::endl;
+    }
+    return ok;
+}
+
+/**
+ * Checks a book's storage against a std::map of each side: applies rounds of
+ * random batches, each round's snapshot resynchronizing the book at a depth,
+ * and where the touch is, that the one before it did not use, and compares
+ * both sides after every batch, while another thread walks them throughout,
+ * as a reader of the book does, and checks each walk is in order.
+ */
+template<typename Book>
+bool checkStorage(char const* name)
+{
+    using Price = typename Book::Price;
+    using Size = typename Book::Size;
+    using lock_t = typename Book::read_lock_t;
+    size_t checked = 0, mismatches = 0;
+
+    auto book = Book::threadless();
+    std::atomic<bool> done(false);
+    std::atomic<size_t> walks(0), disorders(0);
+    std::thread reader([&]
+        {
+            Book::ensureThreadAttached();
+            while (!done.load(std::memory_order_relaxed))
+            {
+                lock_t lock;
+                bool first = true;
+                Price last = 0;
+                for (auto const& level : book->bids)
+                {
+                    if ((!first && level.first >= last) || !(level.second > 0))
+                        ++disorders;
+                    first = false;
+                    last = level.first;
+                }
+                first = true;
+                for (auto const& level : book->offers)
+                {
+                    if ((!first && level.first <= last) || !(level.second > 0))
+                        ++disorders;
+                    first = false;
+                    last = level.first;
+                }
+                ++walks;
+                // lets a writer waiting for readers to leave, as a
+                // LeftRightMap's does, in on a single core
+                std::this_thread::yield();
+            }
+        });
+
+    std::map<Price, Size, std::greater<Price>> bids;
+    std::map<Price, Size> offers;
+    std::mt19937 random(20180619);
+    // depths within and beyond a hybrid map's window, and a jump of the touch
+    struct Round { size_t depth; unsigned shift; };
+    for (Round const round : { Round{ 200, 0 }, Round{ 1500, 0 },
+                               Round{ 200, 100000 } })
+    {
+        auto batches = randomBatches(random, round.depth, 20000);
+        for (auto & batch : batches)
+        {
+            for (auto & change : batch.changes) change.price += round.shift;
+            if (batch.type == Book::batch_t::Snapshot)
+            {
+                bids.clear();
+                offers.clear();
+            }
+            for (auto const& change : batch.changes)
+            {
+                if (change.side == gdax::Side::Bid)
+                {
+                    if (change.size == 0) bids.erase(change.price);
+                    else bids[change.price] = change.size;
+                }
+                else
+                {
+                    if (change.size == 0) offers.erase(change.price);
+                    else offers[change.price] = change.size;
+                }
+            }
+            book->apply(batch);
+
+            ++checked;
+            if (levelsOf(book->bids, lock_t()) == levelsOf(bids)
+                && levelsOf(book->offers, lock_t()) == levelsOf(offers))
+            {
+                continue;
+            }
+            if (++mismatches <= 10)
+                std::cerr << name << ": book does not match std::map after "
+                    << (batch.type == Book::batch_t::Snapshot
+                        ? "a snapshot" : "an update") << " at depth "
+                    << round.depth << std::endl;
+        }
+    }
+    done = true;
+    reader.join();
+    if (disorders != 0 || walks == 0)
+    {
+        std::cerr << name << ": " << disorders << " levels out of order in "
+            << walks << " concurrent walks" << std::endl;
+    }
+
+    std::cout << name << ": " << checked << " checks, " << mismatches
+        << " mismatches, " << walks << " concurrent walks" << std::endl;
+    return mismatches == 0 && disorders == 0 && walks != 0;
+}
+
+/**
+ * Checks a gdax::ReplayRunner, and reports what it gains: writes tick
+ * stores of random batches, of uneven lengths, for a few products, replays
+ * them on one thread, and then on `threads`, and checks that each job's
+ * result, a digest of the touch after every message, is the one its
+ * batches give applied in turn to a book, and comes back in job order.
+ */
+bool checkReplayRunner(unsigned threads)
+{
+    struct Result
+    {
+        std::string product;
+        size_t messages = 0;
+        uint64_t touches = 0;
+    };
+    using runner_t = gdax::ReplayRunner<GDAXOrderBook, Result>;
+    auto step = [](gdax::ReplayJob const& job, GDAXOrderBook & book,
+                   int64_t, uint64_t, GDAXOrderBook::batch_t const&,
+                   Result & result)
+    {
+        uint64_t bid = 0, offer = 0;
+        {
+            GDAXOrderBook::read_lock_t lock;
+            auto best = book.bids.begin();
+            if (best != book.bids.end()) bid = best->first;
+            auto lowest = book.offers.begin();
+            if (lowest != book.offers.end()) offer = lowest->first;
+        }
+        result.product = job.product;
+        ++result.messages;
+        result.touches = result.touches*1000003 ^ (bid << 32 | offer);
+    };
+
+    std::vector<gdax::ReplayJob> jobs;
+    std::vector<Result> expected;
+    std::mt19937 random(20180620);
+    for (unsigned product = 0 ; product < 8 ; ++product)
+    {
+        gdax::ReplayJob job;
+        job.product = "P" + std::to_string(product) + "-USD";
+        job.day = "2018-06-20";
+        job.path = "bench-replay-" + std::to_string(product) + ".tmp";
+        auto const batches = randomBatches(random, 500,
+                                           50000 + 25000*(product % 4));
+        auto book = GDAXOrderBook::threadless();
+        Result result;
+        {
+            gdax::store::Writer writer(job.path);
+            for (size_t i = 0 ; i < batches.size() ; ++i)
+            {
+                writer.append(int64_t(i)*1000, i + 1, batches[i]);
+                book->apply(batches[i]);
+                step(job, *book, int64_t(i)*1000, i + 1, batches[i],
+                     result);
+            }
+        }
+        jobs.push_back(job);
+        expected.push_back(result);
+    }
+
+    bool ok = true;
+    double elapsed[2] = { 0, 0 };
+    unsigned const counts[2] = { 1, threads };
+    for (int run = 0 ; run < 2 ; ++run)
+    {
+        runner_t runner(gdax::BookOptions(), counts[run]);
+        auto const start = std::chrono::steady_clock::now();
+        std::vector<Result> results;
+        try
+        {
+            results = runner.run(jobs, step);
+        }
+        catch (std::exception const& e)
+        {
+            std::cerr << "replay on " << counts[run] << " threads failed: "
+                << e.what() << std::endl;
+            ok = false;
+            continue;
+        }
+        elapsed[run] = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        for (size_t job = 0 ; job < jobs.size() ; ++job)
+        {
+            if (job < results.size()
+                && results[job].product == expected[job].product
+                && results[job].messages == expected[job].messages
+                && results[job].touches == expected[job].touches)
+            {
+                continue;
+            }
+            std::cerr << "replay on " << counts[run] << " threads: job "
+                << job << " (" << jobs[job].product << ") "
+                << (job < results.size()
+                    && results[job].product != expected[job].product
+                    ? "is out of order" : "has the wrong result")
+                << std::endl;
+            ok = false;
+        }
+    }
+    for (auto const& job : jobs) std::remove(job.path.c_str());
+
+    std::cout << jobs.size() << " jobs: " << std::setprecision(3)
+        << elapsed[0] << " s on 1 thread, " << elapsed[1] << " s on "
+        << threads << ", a speedup of "
+        << (elapsed[1] > 0 ? elapsed[0]/elapsed[1] : 0) << std::endl;
+    return ok;
+}
+
+/**
+ * Checks a book's triggers (see BasicGDAXOrderBook::addTrigger()) against a
+ * brute-force evaluation of each one's condition on a std::map of each side
+ * after every message: adds a few random triggers, of every condition, near
+ * the touch, and removes a few, every so many messages of rounds of random
+ * batches, each round's snapshot resynchronizing the book, and checks each
+ * trigger fires once, as of the first message after which its condition
+ * holds, or not at all.  A shallow book has removals take the best level
+ * often, which leaves the best price to be reset from the book, and the
+ * touch often land on a trigger's price, which must not fire it.
+ */
+template<typename Book>
+bool checkTriggers(char const* name)
+{
+    using Price = typename Book::Price;
+    using Size = typename Book::Size;
+    using trigger_t = typename Book::trigger_t;
+    using batch_t = typename Book::batch_t;
+    size_t const never = size_t(-1);
+    struct Expectation
+    {
+        trigger_t trigger;
+        uint64_t id;
+        size_t cancelled; // the first message that no longer has it
+        size_t expected;  // the first message after which its condition holds
+        size_t fired;
+        unsigned fires;
+    };
+
+    auto book = Book::threadless();
+    std::map<Price, Size, std::greater<Price>> bids;
+    std::map<Price, Size> offers;
+    std::vector<Expectation> triggers;
+    size_t message = 0;
+
+    // whether a condition on the best price or depth holds of a side
+    auto holds = [](trigger_t const& trigger, Price best,
+                    std::vector<std::pair<Price, Size>> const& levels)
+    {
+        if (trigger.condition == trigger_t::BestBelow)
+            return best < trigger.price;
+        if (trigger.condition == trigger_t::BestAbove)
+            return best > trigger.price;
+        Size depth = 0;
+        for (auto const& level : levels)
+        {
+            Price const away = level.first > best ? level.first - best
+                : best - level.first;
+            if (away > trigger.ticks) break;
+            depth += level.second;
+        }
+        return trigger.condition == trigger_t::DepthBelow
+            ? depth < trigger.size : depth > trigger.size;
+    };
+
+    std::mt19937 random(20180621);
+    bool loaded = false;
+    for (unsigned round = 0 ; round < 12 ; ++round)
+    {
+        auto batches = randomBatches(random, 20, 5000);
+        for (auto & batch : batches)
+        {
+            ++message;
+            size_t const taken = triggers.size();
+            if (message % 50 == 1 && loaded)
+            {
+                for (unsigned n = 0 ; n < 10 ; ++n)
+                {
+                    Expectation e;
+                    e.trigger.side = random() % 2 ? gdax::Side::Bid
+                        : gdax::Side::Offer;
+                    e.trigger.condition =
+                        typename trigger_t::Condition(random() % 6);
+                    Price const touch = e.trigger.side == gdax::Side::Bid
+                        ? (bids.empty() ? 5000000 : bids.begin()->first)
+                        : (offers.empty() ? 5000000 : offers.begin()->first);
+                    // size triggers out to levels a snapshot may prune
+                    Price const reach = e.trigger.condition
+                        <= trigger_t::BestAbove ? 10 : 40;
+                    e.trigger.price = touch - reach + random() % (2*reach + 1);
+                    e.trigger.ticks = random() % 16;
+                    e.trigger.size = e.trigger.condition
+                        >= trigger_t::DepthBelow
+                        ? (random() % 1000)*(e.trigger.ticks + 1)/100.0
+                        : (1 + random() % 100000)/1e4;
+                    size_t const index = triggers.size();
+                    e.trigger.fire = [&triggers, &message, index](
+                        trigger_t const&)
+                    {
+                        Expectation & fired = triggers[index];
+                        if (fired.fires++ == 0) fired.fired = message;
+                    };
+                    e.cancelled = e.expected = e.fired = never;
+                    e.fires = 0;
+                    triggers.push_back(e);
+                    triggers.back().id = book->addTrigger(e.trigger);
+                }
+                for (unsigned n = 0 ; n < 2 ; ++n)
+                {
+                    Expectation & e = triggers[random() % triggers.size()];
+                    if (e.cancelled != never) continue;
+                    e.cancelled = message;
+                    book->removeTrigger(e.id);
+                }
+            }
+
+            // a best price trigger is taken before the message is applied,
+            // and fires at once if its condition already holds
+            for (size_t i = taken ; i < triggers.size() ; ++i)
+            {
+                Expectation & e = triggers[i];
+                bool const bid = e.trigger.side == gdax::Side::Bid;
+                if (e.cancelled == never
+                    && e.trigger.condition <= trigger_t::BestAbove
+                    && !(bid ? bids.empty() : offers.empty())
+                    && holds(e.trigger, bid ? bids.begin()->first
+                             : offers.begin()->first, {}))
+                {
+                    e.expected = message;
+                }
+            }
+
+            // a level appears at most once in a message, as no transient
+            // best price within one is to fire a trigger
+            std::set<std::pair<int, Price>> seen;
+            std::vector<gdax::Change<Price, Size>> changes;
+            for (auto const& change : batch.changes)
+            {
+                if (seen.insert(std::make_pair(int(change.side),
+                                               change.price)).second)
+                {
+                    changes.push_back(change);
+                }
+            }
+            batch.changes = changes;
+
+            // the changes to levels, for size triggers, which a snapshot
+            // makes only as it resynchronizes the book
+            std::vector<gdax::Change<Price, Size>> sized;
+            if (batch.type == batch_t::Snapshot)
+            {
+                std::set<std::pair<int, Price>> listed;
+                for (auto const& change : batch.changes)
+                {
+                    listed.insert(std::make_pair(int(change.side),
+                                                 change.price));
+                }
+                if (loaded)
+                {
+                    sized = batch.changes;
+                    for (auto const& level : bids)
+                    {
+                        if (!listed.count(std::make_pair(
+                                int(gdax::Side::Bid), level.first)))
+                        {
+                            sized.push_back({ gdax::Side::Bid, level.first,
+                                              0 });
+                        }
+                    }
+                    for (auto const& level : offers)
+                    {
+                        if (!listed.count(std::make_pair(
+                                int(gdax::Side::Offer), level.first)))
+                        {
+                            sized.push_back({ gdax::Side::Offer,
+                                              level.first, 0 });
+                        }
+                    }
+                }
+                bids.clear();
+                offers.clear();
+            }
+            else { sized = batch.changes; }
+            for (auto const& change : batch.changes)
+            {
+                if (change.side == gdax::Side::Bid)
+                {
+                    if (change.size == 0) bids.erase(change.price);
+                    else bids[change.price] = change.size;
+                }
+                else
+                {
+                    if (change.size == 0) offers.erase(change.price);
+                    else offers[change.price] = change.size;
+                }
+            }
+            loaded = true;
+            book->apply(batch);
+
+            std::vector<std::pair<Price, Size>> const bidLevels(
+                bids.begin(), bids.end());
+            std::vector<std::pair<Price, Size>> const offerLevels(
+                offers.begin(), offers.end());
+            for (auto & e : triggers)
+            {
+                if (e.expected != never || e.cancelled <= message) continue;
+                trigger_t const& trigger = e.trigger;
+                bool const bid = trigger.side == gdax::Side::Bid;
+                bool met = false;
+                if (trigger.condition == trigger_t::SizeBelow
+                    || trigger.condition == trigger_t::SizeAbove)
+                {
+                    for (auto const& change : sized)
+                    {
+                        met = met || (change.side == trigger.side
+                            && change.price == trigger.price
+                            && (trigger.condition == trigger_t::SizeBelow
+                                ? change.size < trigger.size
+                                : change.size > trigger.size));
+                    }
+                }
+                else
+                {
+                    auto const& levels = bid ? bidLevels : offerLevels;
+                    met = !levels.empty()
+                        && holds(trigger, levels.front().first, levels);
+                }
+                if (met) e.expected = message;
+            }
+        }
+    }
+
+    size_t mismatches = 0, fired = 0;
+    for (size_t i = 0 ; i < triggers.size() ; ++i)
+    {
+        Expectation const& e = triggers[i];
+        fired += e.fires != 0;
+        if (e.fires <= 1 && e.fired == e.expected) continue;
+        if (++mismatches <= 10)
+        {
+            std::cerr << name << ": trigger " << i << " (condition "
+                << e.trigger.condition << ", "
+                << (e.trigger.side == gdax::Side::Bid ? "bid" : "offer")
+                << " price " << e.trigger.price << ", size "
+                << e.trigger.size << ", ticks " << e.trigger.ticks
+                << ") fired " << e.fires << " times, first after message "
+                << (e.fired == never ? 0 : e.fired) << ", but should have "
+                << "after " << (e.expected == never ? 0 : e.expected)
+                << std::endl;
+        }
+    }
+    std::cout << name << ": " << triggers.size() << " triggers over "
+        << message << " messages, " << fired << " fired, " << mismatches
+        << " mismatches" << std::endl;
+    return mismatches == 0;
+}
+
+void usage(char const* argv0)
+{
+    std::cerr << "usage: " << argv0 << " [--repeat N] [--compare BASELINE]"
+        " [--tolerance FRACTION] [--isa ISA]\n"
+        "           [--depth-levels N] [--depth-percent X] [--track-beyond]\n"
+        "           [--storage skiplist|epoch|hybrid|btree|leftright"
+        "|singlewriter]\n           [--bitmap-index] [--parse-threads N]"
+        " [--conflate-backlog N] CORPUS...\n"
+        "       " << argv0 << " [--repeat N] [--compare BASELINE] --codec"
+        " CORPUS...\n"
+        "       " << argv0 << " [--repeat N] [--compare BASELINE] --backtest"
+        " CORPUS...\n"
+        "       " << argv0 << " [--repeat N] [--compare BASELINE] --implied"
+        " CORPUS...\n"
+        "       " << argv0 << " --check-kernels CORPUS...\n"
+        "       " << argv0 << " --check-bitmap-index\n"
+        "       " << argv0 << " --check-multicast\n"
+        "       " << argv0 << " --check-fanout\n"
+        "       " << argv0 << " --check-storage skiplist|epoch|hybrid|btree"
+        "|leftright|singlewriter\n"
+        "       " << argv0 << " --check-replay [THREADS]\n"
+        "       " << argv0 << " --check-triggers\n"
+        "       " << argv0 << " --generate CORPUS [DEPTH [UPDATES]]"
+        << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t repeat = 7;
+    double tolerance = 0.05;
+    std::string baselinePath;
+    std::vector<std::string> corpora;
+    gdax::BookOptions options;
+    gdax::DepthWindow & depthWindow = options.depthWindow;
+    std::string storage = "skiplist";
+    bool codec = false;
+    bool backtest = false;
+    bool implied = false;
+
+    for (int i = 1 ; i < argc ; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--generate" && i+1 < argc)
+        {
+            size_t depth = i+2 < argc ? std::stoul(argv[i+2]) : 5000;
+            size_t updates = i+3 < argc ? std::stoul(argv[i+3]) : 200000;
+            generateCorpus(argv[i+1], depth, updates);
+            return 0;
+        }
+        else if (arg == "--check-bitmap-index")
+        {
+            return checkBitmapIndex() ? 0 : 1;
+        }
+        else if (arg == "--check-multicast")
+        {
+            return checkMulticast() ? 0 : 1;
+        }
+        else if (arg == "--check-fanout")
+        {
+            return checkFanout() ? 0 : 1;
+        }
+        else if (arg == "--check-storage" && i+1 < argc)
+        {
+            std::string const name = argv[i+1];
+            bool ok = false;
+            if (name == "skiplist")
+                ok = checkStorage<GDAXOrderBook>("skiplist");
+            else if (name == "epoch")
+                ok = checkStorage<BasicGDAXOrderBook<gdax::EpochStorage>>(
+                    "epoch");
+            else if (name == "hybrid")
+                ok = checkStorage<BasicGDAXOrderBook<gdax::HybridStorage<>>>(
+                    "hybrid");
+            else if (name == "btree")
+                ok = checkStorage<BasicGDAXOrderBook<gdax::BTreeStorage>>(
+                    "btree");
+            else if (name == "leftright")
+                ok = checkStorage<BasicGDAXOrderBook<gdax::LeftRightStorage>>(
+                    "leftright");
+            else if (name == "singlewriter")
+                ok = checkStorage<
+                    BasicGDAXOrderBook<gdax::SingleWriterStorage>>(
+                        "singlewriter");
+            else { usage(argv[0]); return 2; }
+            return ok ? 0 : 1;
+        }
+        else if (arg == "--check-replay")
+        {
+            unsigned const threads = i+1 < argc ? std::stoul(argv[i+1])
+                : std::max(2u, std::thread::hardware_concurrency());
+            return checkReplayRunner(threads) ? 0 : 1;
+        }
+        else if (arg == "--check-triggers")
+        {
+            bool ok = checkTriggers<GDAXOrderBook>("skiplist");
+            ok &= checkTriggers<BasicGDAXOrderBook<gdax::EpochStorage>>(
+                "epoch");
+            ok &= checkTriggers<BasicGDAXOrderBook<gdax::HybridStorage<>>>(
+                "hybrid");
+            ok &= checkTriggers<BasicGDAXOrderBook<gdax::BTreeStorage>>(
+                "btree");
+            ok &= checkTriggers<BasicGDAXOrderBook<gdax::LeftRightStorage>>(
+                "leftright");
+            ok &= checkTriggers<
+                BasicGDAXOrderBook<gdax::SingleWriterStorage>>("singlewriter");
+            return ok ? 0 : 1;
+        }
+        else if (arg == "--check-kernels")
+        {
+            return checkKernels(
+                std::vector<std::string>(argv + i + 1, argv + argc)) ? 0 : 1;
+        }
+        else if (arg == "--isa" && i+1 < argc)
+        {
+            std::string isa = argv[++i];
+            bool forced = false;
+            for (auto candidate : { gdax::kernels::Isa::scalar,
+                                    gdax::kernels::Isa::sse42,
+                                    gdax::kernels::Isa::avx2,
+                                    gdax::kernels::Isa::avx512 })
+            {
+                if (isa == gdax::kernels::name(candidate))
+                    forced = gdax::kernels::force(candidate);
+            }
+            if (!forced)
+            {
+                std::cerr << "unknown or unsupported ISA " << isa << std::endl;
+                return 2;
+            }
+        }
+        else if (arg == "--depth-levels" && i+1 < argc)
+            depthWindow.maxLevels = std::stoul(argv[++i]);
+        else if (arg == "--depth-percent" && i+1 < argc)
+            depthWindow.maxPercentFromMid = std::stod(argv[++i]);
+        else if (arg == "--track-beyond") depthWindow.trackBeyond = true;
+        else if (arg == "--bitmap-index") options.bitmapIndex = true;
+        else if (arg == "--codec") codec = true;
+        else if (arg == "--backtest") backtest = true;
+        else if (arg == "--implied") implied = true;
+        else if (arg == "--parse-threads" && i+1 < argc)
+            options.parseThreads = std::stoul(argv[++i]);
+        else if (arg == "--conflate-backlog" && i+1 < argc)
+            options.conflateBacklog = std::stoul(argv[++i]);
+        else if (arg == "--storage" && i+1 < argc
+                 && (std::string(argv[i+1]) == "skiplist"
+                     || std::string(argv[i+1]) == "epoch"
+                     || std::string(argv[i+1]) == "hybrid"
+                     || std::string(argv[i+1]) == "btree"
+                     || std::string(argv[i+1]) == "leftright"
+                     || std::string(argv[i+1]) == "singlewriter"))
+            storage = argv[++i];
+        else if (arg == "--repeat" && i+1 < argc) repeat = std::stoul(argv[++i]);
+        else if (arg == "--compare" && i+1 < argc) baselinePath = argv[++i];
+        else if (arg == "--tolerance" && i+1 < argc) tolerance = std::stod(argv[++i]);
+        else if (arg[0] == '-') { usage(argv[0]); return 2; }
+        else corpora.push_back(arg);
+    }
+    if (corpora.empty() || repeat == 0) { usage(argv[0]); return 2; }
+
+    Results results;
+    if (implied)
+    {
+        std::cout << "# corpus metric median mad (implied)" << std::endl;
+        for (auto const& path : corpora)
+        {
+            auto frames = loadCorpus(path);
+            std::string name = path.substr(path.find_last_of('/') + 1);
+
+            std::vector<double> cross;
+            for (size_t i = 0 ; i < repeat ; ++i)
+                cross.push_back(GDAXOrderBookBenchmark::implied(frames));
+            results[name]["implied_change_ns"] = summarize(cross);
+
+            for (auto const& metric : results[name])
+            {
+                std::cout << name << " " << metric.first << " "
+                    << std::setprecision(10) << metric.second.median << " "
+                    << metric.second.mad << std::endl;
+            }
+        }
+    }
+    else if (backtest)
+    {
+        std::cout << "# corpus metric median mad (backtest)" << std::endl;
+        for (auto const& path : corpora)
+        {
+            auto frames = loadCorpus(path);
+            std::string name = path.substr(path.find_last_of('/') + 1);
+
+            std::vector<double> simulate;
+            for (size_t i = 0 ; i < repeat ; ++i)
+                simulate.push_back(GDAXOrderBookBenchmark::backtest(frames));
+            results[name]["backtest_change_ns"] = summarize(simulate);
+
+            for (auto const& metric : results[name])
+            {
+                std::cout << name << " " << metric.first << " "
+                    << std::setprecision(10) << metric.second.median << " "
+                    << metric.second.mad << std::endl;
+            }
+        }
+    }
+    else if (codec)
+    {
+        std::cout << "# corpus metric median mad (codec, "
+            << gdax::kernels::name(gdax::kernels::table().isa) << " kernels)"
+            << std::endl;
+        for (auto const& path : corpora)
+        {
+            auto frames = loadCorpus(path);
+            std::string name = path.substr(path.find_last_of('/') + 1);
+
+            std::vector<double> jsonBytes, wireBytes, jsonDecode, wireEncode,
+                                wireDecode, storeBytes, storeWrite,
+                                storeDecode;
+            for (size_t i = 0 ; i < repeat ; ++i)
+            {
+                CodecSample sample = GDAXOrderBookBenchmark::codec(frames);
+                jsonBytes.push_back(sample.jsonBytesPerFrame);
+                wireBytes.push_back(sample.wireBytesPerFrame);
+                jsonDecode.push_back(sample.jsonDecodeNanoseconds);
+                wireEncode.push_back(sample.wireEncodeNanoseconds);
+                wireDecode.push_back(sample.wireDecodeNanoseconds);
+                storeBytes.push_back(sample.storeBytesPerFrame);
+                storeWrite.push_back(sample.storeWriteNanoseconds);
+                storeDecode.push_back(sample.storeDecodeNanoseconds);
+            }
+            results[name]["json_bytes_per_frame"] = summarize(jsonBytes);
+            results[name]["wire_bytes_per_frame"] = summarize(wireBytes);
+            results[name]["json_decode_ns"] = summarize(jsonDecode);
+            results[name]["wire_encode_ns"] = summarize(wireEncode);
+            results[name]["wire_decode_ns"] = summarize(wireDecode);
+            results[name]["store_bytes_per_frame"] = summarize(storeBytes);
+            results[name]["store_write_ns"] = summarize(storeWrite);
+            results[name]["store_decode_change_ns"] = summarize(storeDecode);
+
+            for (auto const& metric : results[name])
+            {
+                std::cout << name << " " << metric.first << " "
+                    << std::setprecision(10) << metric.second.median << " "
+                    << metric.second.mad << std::endl;
+            }
+        }
+    }
+    else
+    {
+        std::cout << "# corpus metric median mad ("
+            << gdax::kernels::name(gdax::kernels::table().isa) << " kernels, "
+            << storage << " storage"
+            << (options.bitmapIndex ? ", bitmap index" : "")
+            << (options.parseThreads
+                ? ", " + std::to_string(options.parseThreads)
+                    + " parse threads" : "")
+            << (options.parseThreads && options.conflateBacklog
+                ? ", conflating" : "") << ")"
+            << std::endl;
+        for (auto const& path : corpora)
+        {
+            auto frames = loadCorpus(path);
+            std::string name = path.substr(path.find_last_of('/') + 1);
+
+            std::vector<double> throughput, latency, allocations, iteration;
+            for (size_t i = 0 ; i < repeat ; ++i)
+            {
+                Sample sample = storage == "hybrid"
+                    ? GDAXOrderBookBenchmark::replay<
+                        BasicGDAXOrderBook<gdax::HybridStorage<>>>(
+                            frames, options)
+                    : storage == "epoch"
+                    ? GDAXOrderBookBenchmark::replay<
+                        BasicGDAXOrderBook<gdax::EpochStorage>>(
+                            frames, options)
+                    : storage == "btree"
+                    ? GDAXOrderBookBenchmark::replay<
+                        BasicGDAXOrderBook<gdax::BTreeStorage>>(
+                            frames, options)
+                    : storage == "leftright"
+                    ? GDAXOrderBookBenchmark::replay<
+                        BasicGDAXOrderBook<gdax::LeftRightStorage>>(
+                            frames, options)
+                    : storage == "singlewriter"
+                    ? GDAXOrderBookBenchmark::replay<
+                        BasicGDAXOrderBook<gdax::SingleWriterStorage>>(
+                            frames, options)
+                    : GDAXOrderBookBenchmark::replay<GDAXOrderBook>(
+                            frames, options);
+                throughput.push_back(sample.framesPerSecond);
+                latency.push_back(sample.p99ApplyNanoseconds);
+                allocations.push_back(sample.allocationsPerFrame);
+                iteration.push_back(sample.iterateNanoseconds);
+            }
+            results[name]["frames_per_sec"] = summarize(throughput);
+            results[name]["p99_apply_ns"] = summarize(latency);
+            results[name]["allocs_per_frame"] = summarize(allocations);
+            results[name]["iterate_ns"] = summarize(iteration);
+
+            for (auto const& metric : results[name])
+            {
+                std::cout << name << " " << metric.first << " "
+                    << std::setprecision(10) << metric.second.median << " "
+                    << metric.second.mad << std::endl;
+            }
+        }
+    }
+
+    if (baselinePath.empty()) return 0;
+    Results baseline;
+    try
+    {
+        baseline = readResults(baselinePath);
+    }
+    catch (std::runtime_error const& e)
+    {
+        std::cerr << e.what() << "; run 'make baseline' first" << std::endl;
+        return 1;
+    }
+    if (!compare(baseline, results, tolerance))
+    {
+        std::cerr << "PERFORMANCE REGRESSION against " << baselinePath
+            << "; see above" << std::endl;
+        return 1;
+    }
+    return 0;
+}
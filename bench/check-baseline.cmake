@@ -0,0 +1,7 @@
+# fails the bench-regression target early, and says why, when no baseline
+# has been recorded; usage: cmake -DBASELINE=<path> -P check-baseline.cmake
+if(NOT EXISTS "${BASELINE}")
+    message(FATAL_ERROR "no ${BASELINE}; run 'make -C bench baseline' (or "
+        "'bench --repeat 7 CORPUS... > bench/baseline.txt') on the reference "
+        "machine and commit it")
+endif()
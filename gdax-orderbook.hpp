@@ -1,10 +1,22 @@
 #ifndef GDAX_ORDERBOOK_HPP
 #define GDAX_ORDERBOOK_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstring>
+#include <functional>
 #include <future>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <cds/container/skip_list_map_hp.h>
 #include <cds/gc/hp.h>
@@ -16,6 +28,164 @@
 #include <websocketpp/concurrency/none.hpp>
 #include <websocketpp/config/asio_client.hpp>
 
+#include "gdax-orderbook/bitmap-index.hpp"
+#include "gdax-orderbook/change-batch.hpp"
+#include "gdax-orderbook/conflation.hpp"
+#include "gdax-orderbook/depth-window.hpp"
+#include "gdax-orderbook/feed.hpp"
+#include "gdax-orderbook/kernels.hpp"
+#include "gdax-orderbook/parse-pipeline.hpp"
+#include "gdax-orderbook/price-triggers.hpp"
+
+namespace gdax {
+
+/**
+ * The default storage of BasicGDAXOrderBook: a cds::container::SkipListMap
+ * per side.  A storage defines the map types of the two sides, which must
+ * offer the SkipListMap operations the book uses (insert(), update(),
+ * erase(), begin() and end()), and be safe to read while the book's single
+ * writer thread modifies them.  See also gdax::HybridStorage.
+ *
+ * A storage may also define a `collector` type, of which books share an
+ * instance for the lifetime of their maps, e.g. a libcds garbage collector
+ * other than cds::gc::HP, and a `read_lock` type, which readers hold around
+ * each traversal of the maps (see gdax::EpochStorage).
+ */
+struct SkipListStorage
+{
+    template<typename Price, typename Size>
+    using offers_map = cds::container::SkipListMap<cds::gc::HP, Price, Size>;
+    template<typename Price, typename Size>
+    using bids_map =
+        cds::container::SkipListMap<
+            cds::gc::HP,
+            Price,
+            Size,
+            // reverse map ordering so best (highest) bid is at begin()
+            typename cds::container::skip_list::make_traits<
+                cds::opt::less<std::greater<Price>>>::type>;
+};
+
+namespace detail {
+
+template<typename T> struct Void { typedef void type; };
+
+/**
+ * The one instance of T shared by every holder of the returned pointer,
+ * created by the first, and destroyed with the last.
+ */
+template<typename T>
+std::shared_ptr<T> sharedInstance()
+{
+    static std::mutex mutex;
+    static std::weak_ptr<T> instance;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<T> shared = instance.lock();
+    if (!shared)
+    {
+        shared = std::make_shared<T>();
+        instance = shared;
+    }
+    return shared;
+}
+
+// libcds requires paired Initialize/Terminate calls, and a garbage collector
+// for our map structures, which is a process-wide singleton that destroying
+// any instance destroys; so every book shares one of these
+struct CDSRuntime
+{
+    struct Initializer {
+        Initializer() { cds::Initialize(); }
+        ~Initializer() { cds::Terminate(); }
+    } m_initializer;
+
+    cds::gc::HP m_garbageCollector;
+
+    CDSRuntime()
+        : m_garbageCollector(67*2)
+            // per SkipListMap doc, 67 hazard pointers per instance
+    {}
+};
+
+// Storage::collector, or else nothing
+template<typename Storage, typename = void>
+struct CollectorOf { struct type {}; };
+template<typename Storage>
+struct CollectorOf<Storage, typename Void<typename Storage::collector>::type>
+{
+    using type = typename Storage::collector;
+};
+
+// Storage::read_lock, or else nothing
+template<typename Storage, typename = void>
+struct ReadLockOf { struct type { type() {} }; };
+template<typename Storage>
+struct ReadLockOf<Storage, typename Void<typename Storage::read_lock>::type>
+{
+    using type = typename Storage::read_lock;
+};
+
+} // namespace detail
+
+/**
+ * How much of its initial snapshot a BasicGDAXOrderBook has loaded: none of
+ * it, the best bid and offer, the best BookOptions::readyDepth levels of
+ * each side, or all of it.
+ */
+enum class Readiness { None, TopOfBook, TopLevels, FullDepth };
+
+/**
+ * Optional features of BasicGDAXOrderBook, all off by default: a bounded
+ * depth window (see gdax::DepthWindow), and, with `bitmapIndex`, a
+ * gdax::BitmapIndex per side, over 2^bitmapIndexLog2Span ticks, of every
+ * level the feed reports, including any beyond the depth window.
+ *
+ * With `parseThreads` > 0, feed messages are parsed by that many worker
+ * threads, and applied in arrival order by another (see
+ * gdax::ParsePipeline), rather than both on the WebSocket thread.  With
+ * `conflateBacklog` > 0 as well, once more than that many messages wait to
+ * be applied, the updates among them are merged, keeping only the latest
+ * size of each level, and applied at once (see gdax::Conflator).
+ *
+ * Prices are kept in ticks of 10^-`priceDecimals` of the quote currency,
+ * cents by default; a product quoted more finely, e.g. ETH-BTC, to 0.00001
+ * BTC, needs as many decimals as it is quoted to, or finer prices are
+ * truncated.  At most 18 are accepted, and a price too large for a Price
+ * in as many is an error, which fails a book's thread, or is thrown by the
+ * call that applies it to a threadless book.
+ *
+ * The constructor returns once the snapshot is loaded as far as `waitFor`;
+ * short of FullDepth, the rest of it continues loading afterwards.  With a
+ * non-zero `timeout`, a book not fully loaded within it gives up, closing
+ * its feed and failing its waiters, as it does if the feed ends before.
+ */
+struct BookOptions
+{
+    DepthWindow depthWindow;
+    bool bitmapIndex;
+    unsigned bitmapIndexLog2Span;
+    unsigned parseThreads;
+    unsigned conflateBacklog;
+    Readiness waitFor;
+    unsigned readyDepth;
+    std::chrono::milliseconds timeout;
+    unsigned priceDecimals;
+
+    BookOptions(DepthWindow const& depthWindow = DepthWindow())
+        : depthWindow(depthWindow),
+          bitmapIndex(false),
+          bitmapIndexLog2Span(24),
+          parseThreads(0),
+          conflateBacklog(0),
+          waitFor(Readiness::FullDepth),
+          readyDepth(10),
+          timeout(0),
+          priceDecimals(2)
+    {}
+};
+
+} // namespace gdax
+
 /**
  * A copy of the GDAX order book for the currency pair product given during
  * construction, exposed as two maps, one for bids and one for offers, each
@@ -27,18 +197,19 @@
  *
  * To ensure high performance, implemented using concurrent data structures
  * from libcds.  The price->quantity maps are instances of
- * cds::container::SkipListMap, whose doc says it is lock-free.
+ * cds::container::SkipListMap, whose doc says it is lock-free, unless
+ * another `Storage` is chosen.  GDAXOrderBook is the book with the default
+ * storage.
  */
-class GDAXOrderBook {
+template<typename Storage = gdax::SkipListStorage>
+class BasicGDAXOrderBook {
 private:
-    // libcds requires paired Initialize/Terminate calls
-    struct CDSInitializer {
-        CDSInitializer() { cds::Initialize(); }
-        ~CDSInitializer() { cds::Terminate(); }
-    } m_cdsInitializer;
+    // libcds, shared with any other books, so that many can coexist
+    std::shared_ptr<gdax::detail::CDSRuntime> m_cdsRuntime;
 
-    // a libcds garbage collector is required for our map structures
-    cds::gc::HP m_cdsGarbageCollector;
+    // and any other garbage collector that the storage's maps need
+    using collector_t = typename gdax::detail::CollectorOf<Storage>::type;
+    std::shared_ptr<collector_t> m_storageCollector;
 
 public:
     /**
@@ -54,36 +225,385 @@ public:
             cds::threading::Manager::attachThread();
     }
 
-    GDAXOrderBook(std::string const& product = "BTC-USD")
-        : m_cdsGarbageCollector(67*2),
-            // per SkipListMap doc, 67 hazard pointers per instance
+    /**
+     * Optionally, a bounded depth window keeps only the levels nearest the
+     * touch in the maps, bitmap indexes answer price queries without walking
+     * them, and a pool of threads parses the feed; see gdax::BookOptions.
+     *
+     * Throws std::runtime_error if the book fails before it is as ready as
+     * BookOptions::waitFor requires, and std::invalid_argument if the
+     * options are out of range.
+     */
+    BasicGDAXOrderBook(
+        std::string const& product = "BTC-USD",
+        gdax::BookOptions const& options = gdax::BookOptions())
+        : m_cdsRuntime(gdax::detail::sharedInstance<
+                gdax::detail::CDSRuntime>()),
+          m_storageCollector(gdax::detail::sharedInstance<collector_t>()),
+          m_depthWindow(options.depthWindow),
+          m_bidsWindow(options.depthWindow),
+          m_offersWindow(options.depthWindow),
+          m_bidsIndex(makeIndex(options)),
+          m_offersIndex(makeIndex(options)),
+          m_priceDecimals(checkPriceDecimals(options.priceDecimals)),
+          m_readyDepth(options.readyDepth),
+          m_readiness(gdax::Readiness::None),
+          m_timeout(options.timeout),
+          m_pipeline(makePipeline(options)),
+          m_product(product),
           m_threadTerminator(
             std::async(
                 std::launch::async,
-                &GDAXOrderBook::handleUpdates,
-                this,
-                product))
+                &BasicGDAXOrderBook::handleUpdates,
+                this))
     {
         ensureThreadAttached();
-        m_bookInitialized.get_future().wait();
+        if (!waitUntil(options.waitFor))
+        {
+            throw std::runtime_error(
+                "GDAX order book for " + product + " failed: " + failure());
+        }
+    }
+
+    /**
+     * Starts a book without waiting for any of it to load, whatever
+     * BookOptions::waitFor says, so that many books can load at once, e.g.
+     * `auto book = GDAXOrderBook::start("ETH-USD", options);` followed later
+     * by `book->whenReady(gdax::Readiness::FullDepth).get()`.
+     */
+    static std::unique_ptr<BasicGDAXOrderBook> start(
+        std::string const& product = "BTC-USD",
+        gdax::BookOptions options = gdax::BookOptions())
+    {
+        options.waitFor = gdax::Readiness::None;
+        return std::unique_ptr<BasicGDAXOrderBook>(
+            new BasicGDAXOrderBook(product, options));
+    }
+
+    /**
+     * Starts a book that owns no thread, so that many can share a few, or
+     * fit a caller's own event loop: the WebSocket connection is begun, but
+     * only pump() does its I/O, and applies what it brings, on the calling
+     * thread, whose turn it is to write to the book.  It returns without
+     * waiting, and so ignores BookOptions::waitFor, and parseThreads, as the
+     * book parses on the pumping thread; waitUntil(), which would wait for
+     * the pumping thread itself, must not be called from it.
+     */
+    static std::unique_ptr<BasicGDAXOrderBook> threadless(
+        std::string const& product,
+        gdax::BookOptions const& options = gdax::BookOptions())
+    {
+        std::unique_ptr<BasicGDAXOrderBook> book(
+            new BasicGDAXOrderBook(Offline(), options));
+        book->m_product = product;
+        if (!book->openWebSocket())
+            book->fail("feed ended before the book was loaded");
+        return book;
+    }
+
+    /**
+     * Starts a book with no feed at all, nor thread, to which the caller
+     * passes each message of the GDAX feed as it comes, with applyFrame(),
+     * or the changes it carries, from any source, with apply() and its like.
+     */
+    static std::unique_ptr<BasicGDAXOrderBook> threadless(
+        gdax::BookOptions const& options = gdax::BookOptions())
+    {
+        return std::unique_ptr<BasicGDAXOrderBook>(
+            new BasicGDAXOrderBook(Offline(), options));
     }
 
-    using Price = unsigned int; // cents
+    using Price = unsigned int; // ticks, cents by default
     using Size = double;
-    using offers_map_t = cds::container::SkipListMap<cds::gc::HP, Price, Size>;
-    using bids_map_t =
-        cds::container::SkipListMap<
-            cds::gc::HP,
-            Price,
-            Size,
-            // reverse map ordering so best (highest) bid is at begin()
-            typename cds::container::skip_list::make_traits<
-                cds::opt::less<std::greater<Price>>>::type>;
+    using offers_map_t = typename Storage::template offers_map<Price, Size>;
+    // ordered so that the best (highest) bid is at begin()
+    using bids_map_t = typename Storage::template bids_map<Price, Size>;
     // *map_t::get(Price) returns an std::pair<Price, Size>*
     bids_map_t bids;
     offers_map_t offers;
 
-    ~GDAXOrderBook() { m_client.stop(); }
+    /**
+     * Readers should hold one of these while traversing the maps, e.g.
+     * `{ GDAXOrderBook::read_lock_t lock; for (auto& level : book.bids) ...}`.
+     * It does nothing unless the storage requires it.
+     */
+    using read_lock_t = typename gdax::detail::ReadLockOf<Storage>::type;
+
+    /**
+     * The changes of a feed message, as the book applies them, and as
+     * listeners receive them; see addListener().
+     */
+    using batch_t = gdax::ChangeBatch<Price, Size>;
+
+    /**
+     * Constructs a book fed by `feed`, on a thread of the book's, instead of
+     * by the GDAX WebSocket feed, e.g. by a gdax::MulticastSubscriber, but
+     * otherwise as above; BookOptions::parseThreads and timeout apply only
+     * to the WebSocket feed.
+     */
+    BasicGDAXOrderBook(
+        std::shared_ptr<gdax::Feed<batch_t>> feed,
+        gdax::BookOptions const& options = gdax::BookOptions())
+        : BasicGDAXOrderBook(Offline(), options)
+    {
+        m_feed = std::move(feed);
+        m_threadTerminator = std::async(
+            std::launch::async, &BasicGDAXOrderBook::handleFeed, this);
+        if (!waitUntil(options.waitFor))
+            throw std::runtime_error("order book failed: " + failure());
+    }
+
+    /** As above, but threadless, fed by pump() as it polls `feed`. */
+    static std::unique_ptr<BasicGDAXOrderBook> threadless(
+        std::shared_ptr<gdax::Feed<batch_t>> feed,
+        gdax::BookOptions const& options = gdax::BookOptions())
+    {
+        std::unique_ptr<BasicGDAXOrderBook> book(
+            new BasicGDAXOrderBook(Offline(), options));
+        book->m_feed = std::move(feed);
+        return book;
+    }
+
+    /**
+     * For a threadless book, does whatever I/O of its feed is ready, without
+     * blocking, and applies the messages it completes, on the calling thread,
+     * returning the number of events handled, 0 if none was ready.  Calls
+     * for the same book must not overlap, but a thread may pump any number
+     * of books in turn, e.g. `while (running) for (auto& book : books)
+     * book->pump();`.  Does nothing for a book fed by applyFrame().
+     */
+    size_t pump()
+    {
+        ensureThreadAttached();
+        if (m_feed)
+        {
+            return m_feed->poll(
+                [this](batch_t const& batch) { applyBatch(batch); });
+        }
+        if (m_product.empty()) return 0;
+        size_t handled = 0;
+        try {
+            handled = m_client.poll();
+        } catch (websocketpp::exception const & e) {
+            std::cerr << "pump() failed: " << e.what() << std::endl;
+            m_client.stop();
+        }
+        if (m_client.stopped() && readiness() != gdax::Readiness::FullDepth)
+            fail("feed ended before the book was loaded");
+        return handled;
+    }
+
+    using change_t = gdax::Change<Price, Size>;
+    using levels_t = std::vector<std::pair<Price, Size>>;
+
+    /**
+     * For a threadless book, applies a batch of binary changes, a snapshot or
+     * an update, as if the feed had sent them, e.g. as decoded from shared
+     * memory, a tick store, or another transport, with no JSON in between.
+     * Prices are in ticks of the book's Price (see BookOptions), and a size
+     * of 0 removes a level.  Listeners receive the batch as it is.  Calls
+     * must not overlap, as with pump().
+     */
+    void apply(batch_t const& batch)
+    {
+        ensureThreadAttached();
+        applyBatch(batch);
+    }
+
+    /**
+     * As apply(), for a snapshot given as one side's levels and the other's,
+     * in any order; a later one resynchronizes the book.
+     */
+    void applySnapshot(levels_t bidLevels, levels_t offerLevels)
+    {
+        ensureThreadAttached();
+        loadSnapshot(bidLevels, offerLevels);
+    }
+
+    /** As apply(), for an update of `count` changes at `changes`. */
+    void applyChanges(change_t const* changes, size_t count)
+    {
+        ensureThreadAttached();
+        updateLevels(changes, count);
+        if (m_listening.load(std::memory_order_acquire))
+        {
+            m_changes.clear();
+            m_changes.type = batch_t::Update;
+            m_changes.changes.assign(changes, changes + count);
+            notifyListeners(m_changes);
+        }
+    }
+
+    /**
+     * For a threadless book, applies one message of the GDAX WebSocket feed,
+     * a snapshot or an update, as JSON, received by the caller by whatever
+     * means; other messages are ignored.  Calls must not overlap, as with
+     * pump().
+     */
+    void applyFrame(std::string const& frame)
+    {
+        ensureThreadAttached();
+        m_json.Parse(frame.c_str());
+        processMessage(m_json);
+    }
+
+    /**
+     * Has `listener` called with the changes of each message once they are
+     * applied to the maps, a snapshot's included, on the thread applying
+     * them, which it should not hold up; a gdax::ConflatedStream can take
+     * them from there to a slow consumer.  Conflated messages (see
+     * BookOptions::conflateBacklog) arrive merged.
+     *
+     * Safe to call from any thread, at any time: the listener is taken in
+     * before the next message is applied, and its first batch is always a
+     * snapshot, of the book as it stands if it is loaded by then, so that
+     * it may keep a copy of the book from the start.
+     */
+    void addListener(std::function<void(batch_t const&)> listener)
+    {
+        std::lock_guard<std::mutex> lock(m_listenersMutex);
+        m_newListeners.push_back(std::move(listener));
+        m_listenersChanged.store(true, std::memory_order_release);
+        m_listening.store(true, std::memory_order_release);
+    }
+
+    /**
+     * Has `trigger.fire(trigger)` called once its condition holds, e.g. the
+     * best bid falling below a price (see gdax::PriceTrigger), on the thread
+     * applying the feed, once the message that satisfies it is applied, and
+     * then forgets it; it should not hold that thread up.  Returns an id for
+     * removeTrigger().  Safe to call from any thread, including a trigger's.
+     *
+     * Triggers are indexed per side by price, and taken into the index from
+     * the next message applied, so that applying a change costs only a
+     * check that the side has triggers, unless it does, and then a lookup
+     * of those at the change's price, and, should the change move the best
+     * price, of those its move crosses.  Thousands cost about as little as
+     * one.  A best price trigger already satisfied when taken fires at once.
+     * Depth triggers, e.g. on the ask side's size within 5 ticks of the best
+     * ask, are evaluated once a message that moves the best price, or
+     * changes a level within their window of it, is applied, by summing the
+     * levels in the window, once per width.
+     */
+    using trigger_t = gdax::PriceTrigger<Price, Size>;
+    uint64_t addTrigger(trigger_t trigger)
+    {
+        std::lock_guard<std::mutex> lock(m_triggersMutex);
+        uint64_t const id = ++m_lastTrigger;
+        m_newTriggers.emplace_back(id, std::move(trigger));
+        m_triggersChanged.store(true, std::memory_order_release);
+        return id;
+    }
+
+    /** Forgets a trigger, if it has not fired yet, as of the next message. */
+    void removeTrigger(uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(m_triggersMutex);
+        m_removedTriggers.push_back(id);
+        m_triggersChanged.store(true, std::memory_order_release);
+    }
+
+    /**
+     * With a bounded depth window constructed with `trackBeyond`, the number
+     * and total size of the levels of each side that are outside the window,
+     * and so not in the maps.  Safe to call from any thread.
+     */
+    struct BeyondWindow { size_t levels; Size size; };
+    BeyondWindow bidsBeyondWindow() const
+    {
+        return { m_bidsWindow.beyondLevels(), m_bidsWindow.beyondSize() };
+    }
+    BeyondWindow offersBeyondWindow() const
+    {
+        return { m_offersWindow.beyondLevels(), m_offersWindow.beyondSize() };
+    }
+
+    /**
+     * With BookOptions::bitmapIndex, the occupancy index of each side's
+     * prices, e.g. bidsIndex()->highest(price) finds the best bid, and
+     * offersIndex()->countBetween(a, b) the number of offer levels from a to
+     * b; null otherwise.  Safe to query from any thread.
+     */
+    using index_t = gdax::BitmapIndex<Price>;
+    index_t const* bidsIndex() const { return m_bidsIndex.get(); }
+    index_t const* offersIndex() const { return m_offersIndex.get(); }
+
+    /**
+     * How much of the initial snapshot is loaded, and so safe to read as
+     * current; see gdax::BookOptions::waitFor.  Safe to call from any thread.
+     */
+    gdax::Readiness readiness() const
+    {
+        return m_readiness.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Blocks until readiness() is at least `readiness`, and returns true, or
+     * until the book fails before that (see BookOptions::timeout), and
+     * returns false.
+     */
+    bool waitUntil(gdax::Readiness readiness)
+    {
+        std::unique_lock<std::mutex> lock(m_readinessMutex);
+        m_readinessChanged.wait(lock, [this, readiness]
+            {
+                return m_readiness.load(std::memory_order_relaxed)
+                    >= readiness || !m_failure.empty();
+            });
+        return m_readiness.load(std::memory_order_relaxed) >= readiness;
+    }
+
+    /**
+     * Has `callback(true)` called once readiness() is at least `readiness`,
+     * or `callback(false)` if the book fails before that.  Called at once,
+     * on the calling thread, if either is already the case, and otherwise on
+     * the book's own thread, which it should not hold up.
+     */
+    void onReady(gdax::Readiness readiness,
+                 std::function<void(bool ready)> callback)
+    {
+        bool ready;
+        {
+            std::lock_guard<std::mutex> lock(m_readinessMutex);
+            ready = m_readiness.load(std::memory_order_relaxed) >= readiness;
+            if (!ready && m_failure.empty())
+            {
+                m_readyCallbacks.emplace_back(readiness, std::move(callback));
+                return;
+            }
+        }
+        callback(ready);
+    }
+
+    /** As onReady(), but the result is delivered through a future. */
+    std::future<bool> whenReady(gdax::Readiness readiness)
+    {
+        auto promise = std::make_shared<std::promise<bool>>();
+        onReady(readiness, [promise](bool ready)
+            {
+                promise->set_value(ready);
+            });
+        return promise->get_future();
+    }
+
+    /** Why the book failed, or an empty string if it has not. */
+    std::string failure() const
+    {
+        std::lock_guard<std::mutex> lock(m_readinessMutex);
+        return m_failure;
+    }
+
+    ~BasicGDAXOrderBook()
+    {
+        {
+            // an Offline book never initialized asio, which stop() needs,
+            // and a book's thread may not have yet, so is told not to run
+            std::lock_guard<std::mutex> lock(m_stopMutex);
+            m_stopRequested = true;
+            if (m_asioInitialized) m_client.stop();
+        }
+        if (m_feed) m_feed->stop();
+    }
 
 private:
     struct websocketppConfig
@@ -94,22 +614,190 @@ private:
     };
     using websocketclient_t = websocketpp::client<websocketppConfig>;
     websocketclient_t m_client;
+    std::mutex m_stopMutex; // guards the two below
+    bool m_asioInitialized = false; // by openWebSocket()
+    bool m_stopRequested = false;   // by the destructor
+
+    gdax::DepthWindow const m_depthWindow;
+    // writer-side state of the depth window, unused if it is unbounded
+    gdax::WindowedSide<Price, Size, std::greater<Price>> m_bidsWindow;
+    gdax::WindowedSide<Price, Size, std::less<Price>> m_offersWindow;
+    bool m_hasLimits = false;
+    Price m_bidsLimit = 0, m_offersLimit = 0;
+
+    std::unique_ptr<index_t> m_bidsIndex, m_offersIndex; // null if disabled
+
+    unsigned const m_priceDecimals; // of the feed's prices, in ticks
+
+    // how far the initial snapshot is loaded, to signal waiters
+    size_t const m_readyDepth;
+    std::atomic<gdax::Readiness> m_readiness;
+    std::chrono::milliseconds const m_timeout;
+    mutable std::mutex m_readinessMutex; // guards all of the below
+    std::condition_variable m_readinessChanged;
+    std::vector<std::pair<gdax::Readiness, std::function<void(bool)>>>
+        m_readyCallbacks;
+    std::string m_failure; // empty unless the book failed
+
+    std::atomic<bool> m_listening{false}; // whether there are listeners
+    std::mutex m_listenersMutex; // guards the two below
+    std::vector<std::function<void(batch_t const&)>> m_listeners;
+    std::vector<std::function<void(batch_t const&)>> m_newListeners;
+    std::atomic<bool> m_listenersChanged{false}; // whether to take them
+    batch_t m_changes; // the writer's, for listeners
+
+    gdax::Conflator<Price, Size> m_conflator; // the pipeline writer's
+
+    std::mutex m_triggersMutex; // guards the three below
+    uint64_t m_lastTrigger = 0;
+    std::vector<std::pair<uint64_t, trigger_t>> m_newTriggers;
+    std::vector<uint64_t> m_removedTriggers;
+    std::atomic<bool> m_triggersChanged{false}; // whether to take them
+    // the writer's
+    gdax::TriggerIndex<Price, Size, std::greater<Price>> m_bidsTriggers;
+    gdax::TriggerIndex<Price, Size, std::less<Price>> m_offersTriggers;
+    std::vector<trigger_t> m_firedTriggers; // to fire once published
+
+    // a parse worker's state, each worker copying the book's settings
+    struct FrameParser
+    {
+        unsigned priceDecimals;
+        BasicGDAXOrderBook* book; // failed by what cannot be parsed
+        rapidjson::Document json;
+
+        explicit FrameParser(unsigned priceDecimals = 2,
+                             BasicGDAXOrderBook* book = nullptr)
+            : priceDecimals(priceDecimals), book(book)
+        {}
+        FrameParser(FrameParser const& other)
+            : priceDecimals(other.priceDecimals), book(other.book)
+        {}
+
+        void operator()(std::string const& frame, batch_t & batch)
+        {
+            json.Parse(frame.c_str());
+            try {
+                parseMessage(json, batch, priceDecimals);
+            } catch (std::exception const & e) {
+                // as on the WebSocket thread, rather than end the worker's
+                batch.clear();
+                if (book) book->fail(e.what());
+            }
+        }
+    };
+    using pipeline_t = gdax::ParsePipeline<batch_t, FrameParser>;
+
+    // with BookOptions::parseThreads, parses frames and applies them, so
+    // outlives the WebSocket thread, which submits them
+    std::unique_ptr<pipeline_t> m_pipeline;
 
-    std::promise<void> m_bookInitialized; // to signal constructor to finish
+    std::shared_ptr<gdax::Feed<batch_t>> m_feed; // null for the WebSocket
+
+    std::string m_product; // empty unless fed by the WebSocket
+    rapidjson::Document m_json; // the writer's, without m_pipeline
 
     std::future<void> m_threadTerminator; // for graceful thread destruction
 
+    // drives the private apply path directly from recorded feed, offline
+    friend class GDAXOrderBookBenchmark;
+
+    // constructs a book with no feed, for GDAXOrderBookBenchmark, and
+    // threadless()
+    struct Offline {};
+    BasicGDAXOrderBook(Offline, gdax::BookOptions const& options)
+        : m_cdsRuntime(gdax::detail::sharedInstance<
+                gdax::detail::CDSRuntime>()),
+          m_storageCollector(gdax::detail::sharedInstance<collector_t>()),
+          m_depthWindow(options.depthWindow),
+          m_bidsWindow(options.depthWindow),
+          m_offersWindow(options.depthWindow),
+          m_bidsIndex(makeIndex(options)),
+          m_offersIndex(makeIndex(options)),
+          m_priceDecimals(checkPriceDecimals(options.priceDecimals)),
+          m_readyDepth(options.readyDepth),
+          m_readiness(gdax::Readiness::None),
+          m_timeout(options.timeout)
+    {
+        ensureThreadAttached();
+    }
+
+    static unsigned checkPriceDecimals(unsigned priceDecimals)
+    {
+        if (priceDecimals > maxPriceDecimals)
+        {
+            throw std::invalid_argument("BookOptions::priceDecimals "
+                + std::to_string(priceDecimals) + " is more than "
+                + std::to_string(maxPriceDecimals));
+        }
+        return priceDecimals;
+    }
+
+    static index_t* makeIndex(gdax::BookOptions const& options)
+    {
+        return options.bitmapIndex
+            ? new index_t(options.bitmapIndexLog2Span) : nullptr;
+    }
+
+    pipeline_t* makePipeline(gdax::BookOptions const& options)
+    {
+        if (options.parseThreads == 0) return nullptr;
+        pipeline_t* pipeline = new pipeline_t(options.parseThreads,
+            [this](batch_t & batch)
+            {
+                ensureThreadAttached(); // the pipeline's writer thread
+                applyBatch(batch);
+            }, 1024, FrameParser(options.priceDecimals, this));
+        if (options.conflateBacklog)
+        {
+            pipeline->conflate(options.conflateBacklog,
+                [this](batch_t & into, batch_t const& next)
+                {
+                    return m_conflator.merge(into, next);
+                });
+        }
+        return pipeline;
+    }
+
     /**
-     * Initiates WebSocket connection, subscribes to order book updates for the
-     * given product, installs a message handler which will receive updates
-     * and process them into the maps, and starts the asio event loop.
+     * Initiates WebSocket connection, subscribes to order book updates for
+     * m_product, and runs the asio event loop, until the book's destruction
+     * stops it.
      */
-    void handleUpdates(std::string const& product)
+    void handleUpdates()
     {
         ensureThreadAttached();
+        if (openWebSocket() && !stopRequested())
+        {
+            try {
+                m_client.run();
+            } catch (websocketpp::exception const & e) {
+                std::cerr << "handleUpdates() failed: " << e.what()
+                    << std::endl;
+            } catch (std::exception const & e) {
+                // e.g. a price parsePrice() cannot represent
+                fail(e.what());
+            }
+        }
+        if (readiness() != gdax::Readiness::FullDepth)
+            fail("feed ended before the book was loaded");
+    }
 
-        rapidjson::Document json;
+    // whether the book is being destroyed; if not, it stops the client
+    // once asio is initialized, and so stops run() even before it starts
+    bool stopRequested()
+    {
+        std::lock_guard<std::mutex> lock(m_stopMutex);
+        return m_stopRequested;
+    }
 
+    /**
+     * Initiates WebSocket connection, and installs a message handler which
+     * will subscribe to m_product's updates, receive them and process them
+     * into the maps, once the asio event loop runs.  Returns false if that
+     * fails.
+     */
+    bool openWebSocket()
+    {
         try {
             m_client.clear_access_channels(websocketpp::log::alevel::all);
             m_client.set_access_channels(
@@ -124,6 +812,10 @@ private:
                 websocketpp::log::elevel::fatal);
 
             m_client.init_asio();
+            {
+                std::lock_guard<std::mutex> lock(m_stopMutex);
+                m_asioInitialized = true;
+            }
 
             m_client.set_tls_init_handler(
                 [](websocketpp::connection_hdl)
@@ -147,14 +839,14 @@ private:
                 });
 
             m_client.set_open_handler(
-                [this, &product](websocketpp::connection_hdl handle)
+                [this](websocketpp::connection_hdl handle)
                 {
                     // subscribe to updates to product's order book
                     websocketpp::lib::error_code errorCode;
                     this->m_client.send(handle,
                         "{"
                             "\"type\": \"subscribe\","
-                            "\"product_ids\": [" "\""+product+"\"" "],"
+                            "\"product_ids\": [" "\""+m_product+"\"" "],"
                             "\"channels\": [" "\"level2\"" "]"
                         "}", websocketpp::frame::opcode::text, errorCode);
                     if (errorCode) {
@@ -164,19 +856,17 @@ private:
                 });
 
             m_client.set_message_handler(
-                [this, &json] (websocketpp::connection_hdl,
-                               websocketppConfig::message_type::ptr msg)
+                [this] (
+                    websocketpp::connection_hdl,
+                    typename websocketppConfig::message_type::ptr msg)
                 {
-                    json.Parse(msg->get_payload().c_str());
-                    const char *const type = json["type"].GetString();
-                    if ( strcmp(type, "l2update") == 0 )
-                    {
-                        processUpdates(json, bids, offers);
-                    }
-                    else if ( strcmp(type, "snapshot") == 0 )
+                    if (m_pipeline)
                     {
-                        processSnapshot(json, bids, offers, m_bookInitialized);
+                        m_pipeline->submit(msg->get_payload());
+                        return;
                     }
+                    m_json.Parse(msg->get_payload().c_str());
+                    processMessage(m_json);
                 });
 
             websocketpp::lib::error_code errorCode;
@@ -189,46 +879,347 @@ private:
 
             m_client.connect(connection);
 
-            m_client.run();
+            if (m_timeout.count() != 0)
+            {
+                m_client.set_timer(m_timeout.count(),
+                    [this](websocketpp::lib::error_code const& errorCode)
+                    {
+                        if (errorCode || readiness()
+                                == gdax::Readiness::FullDepth) return;
+                        fail("timed out loading the book");
+                        m_client.stop();
+                    });
+            }
         } catch (websocketpp::exception const & e) {
-            std::cerr << "handleUpdates() failed: " << e.what() << std::endl;
+            std::cerr << "openWebSocket() failed: " << e.what() << std::endl;
+            return false;
         }
+        return true;
     }
 
     /**
-     * Simply delegates snapshot processing to a helper function (different
-     * template instantiations of the same function, one for each type of map
-     * (bid, offer)), and signals when the snapshot has been processed.
+     * Runs a feed other than the WebSocket, applying its batches, until the
+     * book's destruction stops it.
      */
-    static void processSnapshot(
-        rapidjson::Document & json,
-        bids_map_t & bids,
-        offers_map_t & offers,
-        std::promise<void> & finished)
+    void handleFeed()
     {
-        processSnapshotHalf(json, "bids", bids);
-        processSnapshotHalf(json, "asks", offers);
-        finished.set_value();
+        ensureThreadAttached();
+        m_feed->run([this](batch_t const& batch) { applyBatch(batch); });
+        if (readiness() != gdax::Readiness::FullDepth)
+            fail("feed ended before the book was loaded");
     }
 
     /**
-     * Helper to permit code re-use on either type of map (bids or offers).
-     * Traverses already-parsed json document and inserts initial-price
-     * snapshots for entire half (bids or offers) of the order book.
+     * Dispatches an already-parsed feed message to the snapshot or update
+     * processor according to its "type", ignoring any other message types.
+     * This, plus the parse that precedes it, is the whole per-message apply
+     * path, and is what the offline benchmark (bench/bench.cpp) measures.
      */
-    template<typename map_t>
-    static void processSnapshotHalf(
+    void processMessage(rapidjson::Document & json)
+    {
+        const char *const type = json["type"].GetString();
+        if ( strcmp(type, "l2update") == 0 )
+        {
+            processUpdates(json);
+        }
+        else if ( strcmp(type, "snapshot") == 0 )
+        {
+            processSnapshot(json);
+        }
+    }
+
+    /**
+     * Parses both halves of a snapshot message, and loads them into the book.
+     */
+    void processSnapshot(rapidjson::Document & json)
+    {
+        levels_t bidLevels, offerLevels;
+        parseSnapshotHalf(json, "bids", bidLevels, m_priceDecimals);
+        parseSnapshotHalf(json, "asks", offerLevels, m_priceDecimals);
+        loadSnapshot(bidLevels, offerLevels);
+    }
+
+    /**
+     * Helper to permit code re-use on either half (bids or offers) of a
+     * snapshot.  Traverses already-parsed json document and appends the
+     * half's price levels to `levels`, with prices of `priceDecimals`.
+     */
+    static void parseSnapshotHalf(
         rapidjson::Document const& json,
         const char *const bidsOrOffers,
-        map_t & map)
+        levels_t & levels,
+        unsigned priceDecimals)
+    {
+        levels.reserve(levels.size() + json[bidsOrOffers].Size());
+        for (rapidjson::SizeType j = 0 ; j < json[bidsOrOffers].Size() ; ++j)
+        {
+            levels.emplace_back(
+                parsePrice(json[bidsOrOffers][j][0].GetString(),
+                           priceDecimals),
+                parseSize(json[bidsOrOffers][j][1].GetString()));
+        }
+    }
+
+    /**
+     * Loads a snapshot into the book, and indexes it, if there are indexes.
+     *
+     * Levels are inserted from the touch outward, a bid then an offer, so
+     * that readiness() reaches TopOfBook once the first of each is in, and
+     * TopLevels once the best BookOptions::readyDepth of each are, long
+     * before a deep book is entirely loaded and FullDepth reached.  With a
+     * bounded depth window, though, the levels are loaded into the window's
+     * side state, which then fills the window, all at once.
+     *
+     * A later snapshot, on resynchronization, replaces the book's levels:
+     * those it lacks are removed first, and those it lists are updated, so
+     * that readers see levels it keeps throughout, except with a bounded
+     * depth window, which is emptied and refilled.
+     */
+    void loadSnapshot(levels_t & bidLevels, levels_t & offerLevels)
+    {
+        // the feed sends each half best first, but nothing relies on it
+        sortFromTouch(bidLevels, std::greater<Price>());
+        sortFromTouch(offerLevels, std::less<Price>());
+        takeTriggers();
+        takeListeners(false); // the snapshot is theirs first
+        bool const resync = readiness() != gdax::Readiness::None;
+        if (resync)
+        {
+            pruneSide(bids, bidLevels, std::greater<Price>(), m_bidsIndex,
+                      m_bidsTriggers);
+            pruneSide(offers, offerLevels, std::less<Price>(), m_offersIndex,
+                      m_offersTriggers);
+        }
+
+        if (m_bidsIndex)
+            for (auto const& level : bidLevels) m_bidsIndex->set(level.first);
+        if (m_offersIndex)
+            for (auto const& level : offerLevels)
+                m_offersIndex->set(level.first);
+
+        if (m_depthWindow.bounded())
+        {
+            m_bidsWindow.load(bidLevels.begin(), bidLevels.end());
+            m_offersWindow.load(offerLevels.begin(), offerLevels.end());
+            enforceDepthWindow();
+            m_bidsWindow.trim();
+            m_offersWindow.trim();
+            m_bidsTriggers.invalidate();
+            m_offersTriggers.invalidate();
+            signalReadiness(gdax::Readiness::FullDepth);
+            notifySnapshot(bidLevels, offerLevels);
+            return;
+        }
+
+        size_t const depth = std::max(bidLevels.size(), offerLevels.size());
+        size_t const topLevels = std::max<size_t>(m_readyDepth, 1);
+        for (size_t i = 0 ; i < depth ; ++i)
+        {
+            if (resync)
+            {
+                if (i < bidLevels.size())
+                    updateMap(bidLevels[i].first, bidLevels[i].second, bids,
+                              m_bidsWindow, m_bidsLimit, m_bidsIndex,
+                              m_bidsTriggers);
+                if (i < offerLevels.size())
+                    updateMap(offerLevels[i].first, offerLevels[i].second,
+                              offers, m_offersWindow, m_offersLimit,
+                              m_offersIndex, m_offersTriggers);
+            }
+            else
+            {
+                if (i < bidLevels.size())
+                    bids.insert(bidLevels[i].first, bidLevels[i].second);
+                if (i < offerLevels.size())
+                    offers.insert(offerLevels[i].first, offerLevels[i].second);
+            }
+
+            if (i == 0) signalReadiness(gdax::Readiness::TopOfBook);
+            if (i + 1 == topLevels) signalReadiness(gdax::Readiness::TopLevels);
+        }
+        m_bidsTriggers.invalidate();
+        m_offersTriggers.invalidate();
+        signalReadiness(gdax::Readiness::FullDepth);
+        notifySnapshot(bidLevels, offerLevels);
+    }
+
+    void notifySnapshot(levels_t const& bidLevels, levels_t const& offerLevels)
+    {
+        if (!m_listening.load(std::memory_order_acquire)) return;
+        m_changes.clear();
+        m_changes.type = batch_t::Snapshot;
+        for (auto const& level : bidLevels)
+            m_changes.changes.push_back(
+                { gdax::Side::Bid, level.first, level.second });
+        for (auto const& level : offerLevels)
+            m_changes.changes.push_back(
+                { gdax::Side::Offer, level.first, level.second });
+        notifyListeners(m_changes);
+    }
+
+    /**
+     * Before a later snapshot is loaded, removes the levels of one side that
+     * it lacks from the side's index, if any, and map, or, with a bounded
+     * depth window, which loadSnapshot() refills, all of the map's levels.
+     * Size triggers on a level it lacks see the level removed.  `levels`
+     * must be sorted from the touch, by `better`.
+     */
+    template<typename map_t, typename Compare, typename triggers_t>
+    void pruneSide(map_t & map, levels_t const& levels, Compare better,
+                   std::unique_ptr<index_t> const& index,
+                   triggers_t & triggers)
+    {
+        auto listed = [&levels, better](Price price)
+        {
+            auto level = std::lower_bound(levels.begin(), levels.end(), price,
+                [better](std::pair<Price, Size> const& level, Price price)
+                {
+                    return better(level.first, price);
+                });
+            return level != levels.end() && level->first == price;
+        };
+
+        std::vector<Price> stale;
+        {
+            read_lock_t lock; // erased after, as some storages require
+            for (auto const& level : map)
+            {
+                if (m_depthWindow.bounded() || !listed(level.first))
+                    stale.push_back(level.first);
+            }
+        }
+        for (Price price : stale)
+        {
+            map.erase(price);
+            if (!triggers.empty() && !listed(price))
+                triggers.change(price, 0, m_firedTriggers);
+        }
+        publish(map, 0);
+
+        if (!index) return;
+        stale.clear();
+        Price price;
+        for (bool found = index->lowest(price) ; found ;
+             found = index->nextAbove(price, price))
+        {
+            if (!listed(price)) stale.push_back(price);
+        }
+        for (Price price : stale) index->clear(price);
+    }
+
+    template<typename Compare>
+    static void sortFromTouch(levels_t & levels, Compare better)
+    {
+        auto byPrice = [better](std::pair<Price, Size> const& a,
+                                std::pair<Price, Size> const& b)
+        {
+            return better(a.first, b.first);
+        };
+        if (!std::is_sorted(levels.begin(), levels.end(), byPrice))
+            std::sort(levels.begin(), levels.end(), byPrice);
+    }
+
+    /**
+     * Makes what is loaded so far visible, and raises readiness() to
+     * `readiness`, waking those waiting for it.  Readiness never falls, so a
+     * later snapshot, on resubscription, signals nothing new.
+     */
+    void signalReadiness(gdax::Readiness readiness)
+    {
+        // triggers are for the whole snapshot, not the part of one that a
+        // resynchronization has yet to finish
+        if (readiness == gdax::Readiness::FullDepth) { publishChanges(); }
+        else { publishLevels(); }
+        std::vector<std::function<void(bool)>> ready;
+        {
+            std::lock_guard<std::mutex> lock(m_readinessMutex);
+            if (readiness <= m_readiness.load(std::memory_order_relaxed))
+                return;
+            m_readiness.store(readiness, std::memory_order_release);
+            takeCallbacks(readiness, ready);
+        }
+        m_readinessChanged.notify_all();
+        for (auto & callback : ready) callback(true);
+    }
+
+    /**
+     * Records the first reason the book failed, and wakes those waiting for
+     * readiness it has not reached, with the news.
+     */
+    void fail(std::string const& reason)
+    {
+        std::vector<std::function<void(bool)>> failed;
+        {
+            std::lock_guard<std::mutex> lock(m_readinessMutex);
+            if (!m_failure.empty()) return;
+            m_failure = reason;
+            takeCallbacks(gdax::Readiness::FullDepth, failed);
+        }
+        m_readinessChanged.notify_all();
+        for (auto & callback : failed) callback(false);
+    }
+
+    // moves those of m_readyCallbacks waiting for up to `readiness` to
+    // `taken`; m_readinessMutex must be held
+    void takeCallbacks(gdax::Readiness readiness,
+                       std::vector<std::function<void(bool)>> & taken)
     {
-        for (auto j = 0 ; j < json[bidsOrOffers].Size() ; ++j)
+        auto waiting = std::stable_partition(
+            m_readyCallbacks.begin(), m_readyCallbacks.end(),
+            [readiness](std::pair<gdax::Readiness,
+                                  std::function<void(bool)>> const& callback)
+            {
+                return callback.first > readiness;
+            });
+        for (auto callback = waiting ; callback != m_readyCallbacks.end() ;
+             ++callback)
         {
-            Price price = std::stod(json[bidsOrOffers][j][0].GetString())*100;
-            Size   size = std::stod(json[bidsOrOffers][j][1].GetString());
+            taken.push_back(std::move(callback->second));
+        }
+        m_readyCallbacks.erase(waiting, m_readyCallbacks.end());
+    }
+
+    // ticks are parsed in 64 bits, with at least one integer digit
+    static constexpr unsigned maxPriceDecimals = 18;
 
-            map.insert(price, size);
+    /**
+     * Converts a price string from the feed to ticks of 10^-`decimals`, at
+     * most maxPriceDecimals, cents by default, exactly, truncating any
+     * fractions of a tick, using the fixed-point parse kernel selected for
+     * this CPU, or strtod() for any string that kernel declines.  Throws
+     * std::out_of_range if the price has more ticks than a Price holds.
+     */
+    static Price parsePrice(const char *const price, unsigned decimals = 2)
+    {
+        uint64_t ticks;
+        if (!gdax::kernels::table().parseFixed(price, decimals, ticks))
+        {
+            double const value = std::stod(price)
+                *gdax::kernels::detail::powerOf10(decimals);
+            // past a Price, or negative, as the kernel rejects
+            ticks = value >= 0 && value < 4294967296.0*4294967296.0
+                ? static_cast<uint64_t>(value)
+                : std::numeric_limits<uint64_t>::max();
         }
+        if (ticks > std::numeric_limits<Price>::max())
+        {
+            throw std::out_of_range("price " + std::string(price)
+                + " is too large for the book's ticks of "
+                + std::to_string(decimals) + " decimals");
+        }
+        return static_cast<Price>(ticks);
+    }
+
+    /**
+     * Converts a size string from the feed, which has at most 8 decimals,
+     * using the same kernel as parsePrice().
+     */
+    static Size parseSize(const char *const size)
+    {
+        uint64_t units;
+        if (gdax::kernels::table().parseFixed(size, 8, units))
+            return units/1e8;
+        return std::stod(size);
     }
 
     /**
@@ -236,50 +1227,381 @@ private:
      * document, updates price->quantity maps based on the order book changes
      * that have occurred.
      */
-    static void processUpdates(
-        rapidjson::Document & json,
-        bids_map_t & bids,
-        offers_map_t & offers)
+    void processUpdates(rapidjson::Document & json)
     {
-        for (auto i = 0 ; i < json["changes"].Size() ; ++i)
+        takeTriggers();
+        takeListeners(true);
+        bool const listening = m_listening.load(std::memory_order_acquire);
+        if (listening)
         {
-            const char* buyOrSell = json["changes"][i][0].GetString(),
-                      * price     = json["changes"][i][1].GetString(),
-                      * size      = json["changes"][i][2].GetString();
+            m_changes.clear();
+            m_changes.type = batch_t::Update;
+        }
+        for (rapidjson::SizeType i = 0 ; i < json["changes"].Size() ; ++i)
+        {
+            const char* buyOrSell = json["changes"][i][0].GetString();
+            Price const price = parsePrice(json["changes"][i][1].GetString(),
+                                           m_priceDecimals);
+            Size  const size  = parseSize(json["changes"][i][2].GetString());
 
             if ( strcmp(buyOrSell, "buy") == 0 )
             {
-                updateMap(price, size, bids);
+                updateMap(price, size, bids, m_bidsWindow, m_bidsLimit,
+                          m_bidsIndex, m_bidsTriggers);
+                if (listening)
+                    m_changes.changes.push_back(
+                        { gdax::Side::Bid, price, size });
             }
             else
             {
-                updateMap(price, size, offers);
+                updateMap(price, size, offers, m_offersWindow, m_offersLimit,
+                          m_offersIndex, m_offersTriggers);
+                if (listening)
+                    m_changes.changes.push_back(
+                        { gdax::Side::Offer, price, size });
             }
         }
+        publishChanges();
+        if (listening) notifyListeners(m_changes);
+    }
+
+    void notifyListeners(batch_t const& batch)
+    {
+        std::lock_guard<std::mutex> lock(m_listenersMutex);
+        for (auto const& listener : m_listeners) listener(batch);
     }
 
     /**
-     * Helper to permit code re-use on either type of map (bids or offers).
-     * Simply updates a single map entry with the specified price/size.
+     * Takes the listeners added since the last message in, before it is
+     * applied, first handing them the book as it stands as a snapshot, if
+     * `current` and it is loaded; otherwise the next snapshot loaded is
+     * their first batch.
      */
+    void takeListeners(bool current)
+    {
+        if (!m_listenersChanged.load(std::memory_order_acquire)) return;
+        std::lock_guard<std::mutex> lock(m_listenersMutex);
+        m_listenersChanged.store(false, std::memory_order_relaxed);
+        if (m_newListeners.empty()) return;
+        if (current && readiness() == gdax::Readiness::FullDepth)
+        {
+            batch_t snapshot;
+            snapshot.type = batch_t::Snapshot;
+            if (m_depthWindow.bounded())
+            {
+                addLevels(m_bidsWindow.levels(), gdax::Side::Bid, snapshot);
+                addLevels(m_offersWindow.levels(), gdax::Side::Offer,
+                          snapshot);
+            }
+            else
+            {
+                read_lock_t readLock;
+                addLevels(bids, gdax::Side::Bid, snapshot);
+                addLevels(offers, gdax::Side::Offer, snapshot);
+            }
+            for (auto const& listener : m_newListeners) listener(snapshot);
+        }
+        for (auto & listener : m_newListeners)
+            m_listeners.push_back(std::move(listener));
+        m_newListeners.clear();
+    }
+
+    template<typename Levels>
+    static void addLevels(Levels & levels, gdax::Side side,
+                          batch_t & batch)
+    {
+        for (auto const& level : levels)
+            batch.changes.push_back({ side, level.first, level.second });
+    }
+
+    /**
+     * Reduces an already-parsed feed message to a batch of binary changes,
+     * without touching the book, so that any thread may do it; see
+     * gdax::ParsePipeline.  Messages other than snapshots and updates leave
+     * the batch empty, of type None.  Prices are parsed to ticks of
+     * 10^-`priceDecimals`, as by a book with BookOptions::priceDecimals.
+     */
+    static void parseMessage(rapidjson::Document const& json, batch_t & batch,
+                             unsigned priceDecimals = 2)
+    {
+        const char *const type = json["type"].GetString();
+        if ( strcmp(type, "l2update") == 0 )
+        {
+            batch.type = batch_t::Update;
+            auto const& changes = json["changes"];
+            for (rapidjson::SizeType i = 0 ; i < changes.Size() ; ++i)
+            {
+                batch.changes.push_back({
+                    strcmp(changes[i][0].GetString(), "buy") == 0
+                        ? gdax::Side::Bid : gdax::Side::Offer,
+                    parsePrice(changes[i][1].GetString(), priceDecimals),
+                    parseSize(changes[i][2].GetString()) });
+            }
+        }
+        else if ( strcmp(type, "snapshot") == 0 )
+        {
+            batch.type = batch_t::Snapshot;
+            for (auto const* half : { "bids", "asks" })
+            {
+                gdax::Side side = strcmp(half, "bids") == 0
+                    ? gdax::Side::Bid : gdax::Side::Offer;
+                for (rapidjson::SizeType j = 0 ; j < json[half].Size() ; ++j)
+                {
+                    batch.changes.push_back({ side,
+                        parsePrice(json[half][j][0].GetString(),
+                                   priceDecimals),
+                        parseSize(json[half][j][1].GetString()) });
+                }
+            }
+        }
+    }
+
+    /**
+     * Applies a batch made by parseMessage(), exactly as processMessage()
+     * applies the message it was made from.
+     */
+    void applyBatch(batch_t const& batch)
+    {
+        if (batch.type == batch_t::Update)
+        {
+            updateLevels(batch.changes.data(), batch.changes.size());
+            if (m_listening.load(std::memory_order_acquire))
+                notifyListeners(batch);
+        }
+        else if (batch.type == batch_t::Snapshot)
+        {
+            levels_t bidLevels, offerLevels;
+            for (auto const& change : batch.changes)
+            {
+                (change.side == gdax::Side::Bid ? bidLevels : offerLevels)
+                    .emplace_back(change.price, change.size);
+            }
+            loadSnapshot(bidLevels, offerLevels);
+        }
+    }
+
+    // applies and publishes an update's changes, without notifying
+    void updateLevels(change_t const* changes, size_t count)
+    {
+        takeTriggers();
+        takeListeners(true);
+        for (change_t const* change = changes ; change != changes + count ;
+             ++change)
+        {
+            if (change->side == gdax::Side::Bid)
+            {
+                updateMap(change->price, change->size, bids, m_bidsWindow,
+                          m_bidsLimit, m_bidsIndex, m_bidsTriggers);
+            }
+            else
+            {
+                updateMap(change->price, change->size, offers,
+                          m_offersWindow, m_offersLimit, m_offersIndex,
+                          m_offersTriggers);
+            }
+        }
+        publishChanges();
+    }
+
+    /**
+     * Makes the changes of the message just processed visible to readers,
+     * for storages whose maps batch them, which have a publish() method for
+     * the purpose (e.g. gdax::LeftRightStorage); others show each change as
+     * it is made.
+     */
+    void publishChanges()
+    {
+        publishLevels();
+        if (!m_firedTriggers.empty() || m_bidsTriggers.stale()
+            || m_offersTriggers.stale() || m_bidsTriggers.depthStale()
+            || m_offersTriggers.depthStale())
+        {
+            fireTriggers();
+        }
+    }
+    // as above, but without firing the triggers the changes satisfy
+    void publishLevels()
+    {
+        publish(bids, 0);
+        publish(offers, 0);
+    }
     template<typename map_t>
-    static void updateMap(
-        const char *const price,
-        const char *const size,
-        map_t & map)
+    static auto publish(map_t & map, int) -> decltype(map.publish(), void())
     {
-        if (std::stod(size) == 0) { map.erase(std::stod(price)); }
+        map.publish();
+    }
+    template<typename map_t>
+    static void publish(map_t &, long) {}
+
+    /**
+     * Takes the triggers added and removed since the last message into the
+     * indexes, before it is applied.
+     */
+    void takeTriggers()
+    {
+        if (!m_triggersChanged.load(std::memory_order_acquire)) return;
+        std::vector<std::pair<uint64_t, trigger_t>> added;
+        std::vector<uint64_t> removed;
+        {
+            std::lock_guard<std::mutex> lock(m_triggersMutex);
+            m_triggersChanged.store(false, std::memory_order_relaxed);
+            added.swap(m_newTriggers);
+            removed.swap(m_removedTriggers);
+        }
+        for (auto & trigger : added)
+        {
+            // one removed as soon as added must not fire on being taken
+            if (std::find(removed.begin(), removed.end(), trigger.first)
+                != removed.end())
+            {
+                continue;
+            }
+            if (trigger.second.side == gdax::Side::Bid)
+                indexTrigger(trigger, bids, m_bidsTriggers);
+            else
+                indexTrigger(trigger, offers, m_offersTriggers);
+        }
+        for (uint64_t id : removed)
+        {
+            if (!m_bidsTriggers.remove(id)) m_offersTriggers.remove(id);
+        }
+    }
+
+    template<typename map_t, typename triggers_t>
+    void indexTrigger(std::pair<uint64_t, trigger_t> & trigger, map_t & map,
+                      triggers_t & triggers)
+    {
+        std::pair<bool, Price> const best = triggers.followsBest()
+            ? std::make_pair(false, Price(0)) : bestOf(map);
+        triggers.add(trigger.first, std::move(trigger.second), best.first,
+                     best.second, m_firedTriggers);
+    }
+
+    // once the message is published, and readable, has the indexes follow
+    // the best prices it left them, and fires what they fired
+    void fireTriggers()
+    {
+        if (m_bidsTriggers.stale())
+        {
+            std::pair<bool, Price> const best = bestOf(bids);
+            m_bidsTriggers.reset(best.first, best.second, m_firedTriggers);
+        }
+        if (m_offersTriggers.stale())
+        {
+            std::pair<bool, Price> const best = bestOf(offers);
+            m_offersTriggers.reset(best.first, best.second, m_firedTriggers);
+        }
+        if (m_bidsTriggers.depthStale())
+        {
+            m_bidsTriggers.fireDepth([this](Price limit)
+                {
+                    return sizeTo(bids, limit, std::greater<Price>());
+                }, m_firedTriggers);
+        }
+        if (m_offersTriggers.depthStale())
+        {
+            m_offersTriggers.fireDepth([this](Price limit)
+                {
+                    return sizeTo(offers, limit, std::less<Price>());
+                }, m_firedTriggers);
+        }
+        if (m_firedTriggers.empty()) return;
+
+        std::vector<trigger_t> fired;
+        fired.swap(m_firedTriggers);
+        for (auto const& trigger : fired)
+            if (trigger.fire) trigger.fire(trigger);
+    }
+
+    // the total size of a side's levels from its best price to `limit`
+    template<typename map_t, typename Better>
+    static Size sizeTo(map_t & map, Price limit, Better better)
+    {
+        read_lock_t lock;
+        Size total = 0;
+        for (auto level = map.begin() ;
+             level != map.end() && !better(limit, (*level).first) ; ++level)
+        {
+            total += (*level).second;
+        }
+        return total;
+    }
+
+    // the best price of a side, if it has any levels
+    template<typename map_t>
+    static std::pair<bool, Price> bestOf(map_t & map)
+    {
+        read_lock_t lock;
+        auto level = map.begin();
+        if (level == map.end()) return std::make_pair(false, Price(0));
+        return std::make_pair(true, (*level).first);
+    }
+
+    /**
+     * Helper to permit code re-use on either type of map (bids or offers).
+     * Simply updates a single map entry with the specified price/size, or,
+     * with a bounded depth window, has the window's side state do so if the
+     * level is within the window, and then moves the window as necessary.
+     * Keeps the side's index, if any, in step, and checks its triggers.
+     */
+    template<typename map_t, typename side_t, typename triggers_t>
+    void updateMap(
+        Price const newPrice,
+        Size const newSize,
+        map_t & map,
+        side_t & side,
+        Price const& limit,
+        std::unique_ptr<index_t> const& index,
+        triggers_t & triggers)
+    {
+        if (index)
+        {
+            if (newSize == 0) { index->clear(newPrice); }
+            else { index->set(newPrice); }
+        }
+        if (m_depthWindow.bounded())
+        {
+            side.apply(map, newPrice, newSize, m_hasLimits, limit);
+            enforceDepthWindow();
+        }
+        else if (newSize == 0) { map.erase(newPrice); }
         else
         {
             map.update(
-                std::stod(price)*100,
-                [size](bool & bNew,
-                       std::pair<const Price, Size> & pair)
+                newPrice,
+                [newSize](bool & bNew,
+                          std::pair<const Price, Size> & pair)
                 {
-                    pair.second = std::stod(size);
+                    pair.second = newSize;
                 });
         }
+        if (!triggers.empty())
+            triggers.change(newPrice, newSize, m_firedTriggers);
+    }
+
+    /**
+     * Recomputes the worst price admitted on each side by the percentage
+     * bound of the depth window, if any, from the current mid, and has both
+     * sides evict or admit levels accordingly.
+     */
+    void enforceDepthWindow()
+    {
+        Price bestBid, bestOffer;
+        m_hasLimits = m_depthWindow.maxPercentFromMid != 0
+            && m_bidsWindow.best(bestBid)
+            && m_offersWindow.best(bestOffer);
+        if (m_hasLimits)
+        {
+            double mid = (double(bestBid) + bestOffer)/2;
+            double fraction = m_depthWindow.maxPercentFromMid/100;
+            m_bidsLimit = static_cast<Price>(std::ceil(mid*(1 - fraction)));
+            m_offersLimit = static_cast<Price>(std::floor(mid*(1 + fraction)));
+        }
+        m_bidsWindow.enforce(bids, m_hasLimits, m_bidsLimit);
+        m_offersWindow.enforce(offers, m_hasLimits, m_offersLimit);
     }
 };
 
+using GDAXOrderBook = BasicGDAXOrderBook<>;
+
 #endif // GDAX_ORDERBOOK_HPP
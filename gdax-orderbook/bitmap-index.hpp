@@ -0,0 +1,257 @@
+#ifndef GDAX_ORDERBOOK_BITMAP_INDEX_HPP
+#define GDAX_ORDERBOOK_BITMAP_INDEX_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <vector>
+
+namespace gdax {
+
+/**
+ * A 64-ary hierarchical occupancy bitmap over a span of 2^log2Span ticks,
+ * answering "which is the lowest/highest occupied price", "which is the
+ * next occupied price above/below this one" and "how many occupied prices
+ * lie between these two" with one count-trailing/leading-zeros per level of
+ * the hierarchy (four levels for the default span of 2^24 ticks), instead
+ * of by following pointers through the ordered map holding the levels.
+ *
+ * It stores no sizes, so it can accompany any storage of them; the book
+ * maintains one per side when constructed with BookOptions::bitmapIndex.
+ *
+ * The span is placed around the first price set, as the prices a book will
+ * see are not known beforehand.  Prices outside it are not indexed, only
+ * counted by outside(), so the span should cover every price that matters.
+ *
+ * One thread may modify the index at a time, while any number query it.
+ * A query concurrent with modification sees each word of the bitmap either
+ * before or after the modification; it never fails, but can be stale.
+ */
+template<typename Price>
+class BitmapIndex
+{
+public:
+    explicit BitmapIndex(unsigned log2Span = 24)
+        : m_log2Span(log2Span < 12 ? 12 : log2Span),
+          m_origin(0),
+          m_placed(false),
+          m_outside(0)
+    {
+        for (size_t bits = size_t(1) << m_log2Span ; ; bits = (bits + 63)/64)
+        {
+            size_t words = (bits + 63)/64;
+            m_levels.emplace_back(new std::atomic<uint64_t>[words]);
+            m_words.push_back(words);
+            for (size_t w = 0 ; w < words ; ++w) m_levels.back()[w] = 0;
+            if (words == 1) break;
+        }
+    }
+
+    /** Marks `price` as occupied. */
+    void set(Price price)
+    {
+        if (!m_placed.load(std::memory_order_relaxed))
+        {
+            uint64_t half = uint64_t(1) << (m_log2Span - 1);
+            m_origin.store(price > half ? price - half : 0,
+                           std::memory_order_relaxed);
+            m_placed.store(true, std::memory_order_release);
+        }
+        uint64_t bit;
+        if (!toBit(price, bit))
+        {
+            m_outsidePrices.insert(price);
+            m_outside.store(m_outsidePrices.size(), std::memory_order_relaxed);
+            return;
+        }
+        for (size_t level = 0 ; level < m_levels.size() ; ++level, bit /= 64)
+        {
+            std::atomic<uint64_t> & word = m_levels[level][bit/64];
+            uint64_t before = word.load(std::memory_order_relaxed);
+            uint64_t after = before | (uint64_t(1) << (bit%64));
+            if (after == before) return;
+            word.store(after, std::memory_order_release);
+            if (before != 0) return; // parents already know of this word
+        }
+    }
+
+    /** Marks `price` as unoccupied. */
+    void clear(Price price)
+    {
+        uint64_t bit;
+        if (!toBit(price, bit))
+        {
+            m_outsidePrices.erase(price);
+            m_outside.store(m_outsidePrices.size(), std::memory_order_relaxed);
+            return;
+        }
+        for (size_t level = 0 ; level < m_levels.size() ; ++level, bit /= 64)
+        {
+            std::atomic<uint64_t> & word = m_levels[level][bit/64];
+            uint64_t before = word.load(std::memory_order_relaxed);
+            uint64_t after = before & ~(uint64_t(1) << (bit%64));
+            if (after == before) return;
+            word.store(after, std::memory_order_release);
+            if (after != 0) return; // the word is still occupied
+        }
+    }
+
+    bool contains(Price price) const
+    {
+        uint64_t bit;
+        return toBit(price, bit) && (m_levels[0][bit/64].load(
+            std::memory_order_acquire) >> (bit%64)) & 1;
+    }
+
+    /** The lowest occupied price, e.g. the best offer, if any. */
+    bool lowest(Price & price) const { return above(0, true, price); }
+
+    /** The highest occupied price, e.g. the best bid, if any. */
+    bool highest(Price & price) const
+    {
+        return below((uint64_t(1) << m_log2Span) - 1, true, price);
+    }
+
+    /** The lowest occupied price greater than `price`, if any. */
+    bool nextAbove(Price price, Price & next) const
+    {
+        if (!m_placed.load(std::memory_order_acquire)) return false;
+        uint64_t origin = m_origin.load(std::memory_order_relaxed);
+        if (price < origin) return above(0, true, next);
+        uint64_t bit = uint64_t(price) - origin;
+        if (bit + 1 >= (uint64_t(1) << m_log2Span)) return false;
+        return above(bit + 1, true, next);
+    }
+
+    /** The highest occupied price less than `price`, if any. */
+    bool nextBelow(Price price, Price & next) const
+    {
+        if (!m_placed.load(std::memory_order_acquire)) return false;
+        uint64_t origin = m_origin.load(std::memory_order_relaxed);
+        uint64_t last = (uint64_t(1) << m_log2Span) - 1;
+        if (price <= origin) return false;
+        uint64_t bit = uint64_t(price) - origin;
+        return below(bit - 1 < last ? bit - 1 : last, true, next);
+    }
+
+    /** The number of occupied prices from `low` to `high` inclusive. */
+    size_t countBetween(Price low, Price high) const
+    {
+        if (!m_placed.load(std::memory_order_acquire) || high < low) return 0;
+        uint64_t origin = m_origin.load(std::memory_order_relaxed);
+        uint64_t last = (uint64_t(1) << m_log2Span) - 1;
+        if (high < origin || uint64_t(low) > origin + last) return 0;
+        uint64_t first = low < origin ? 0 : uint64_t(low) - origin;
+        uint64_t final = uint64_t(high) - origin > last
+            ? last : uint64_t(high) - origin;
+
+        size_t count = 0;
+        for (uint64_t word = first/64 ; word <= final/64 ; ++word)
+        {
+            uint64_t bits = m_levels[0][word].load(std::memory_order_acquire);
+            if (word == first/64) bits &= ~uint64_t(0) << (first%64);
+            if (word == final/64 && final%64 != 63)
+                bits &= (uint64_t(1) << (final%64 + 1)) - 1;
+            count += __builtin_popcountll(bits);
+        }
+        return count;
+    }
+
+    /** The number of occupied prices that fell outside the span. */
+    size_t outside() const { return m_outside.load(std::memory_order_relaxed); }
+
+private:
+    unsigned const m_log2Span;
+    std::atomic<uint64_t> m_origin; // price of bit 0
+    std::atomic<bool> m_placed;     // whether m_origin is set yet
+    std::atomic<size_t> m_outside;
+    std::set<Price> m_outsidePrices; // writer's only
+    // m_levels[0] has a bit per tick; each word of each level has a bit in
+    // the level above, set while that word is non-zero
+    std::vector<std::unique_ptr<std::atomic<uint64_t>[]>> m_levels;
+    std::vector<size_t> m_words;
+
+    bool toBit(Price price, uint64_t & bit) const
+    {
+        if (!m_placed.load(std::memory_order_acquire)) return false;
+        uint64_t origin = m_origin.load(std::memory_order_relaxed);
+        if (price < origin) return false;
+        bit = uint64_t(price) - origin;
+        return bit < (uint64_t(1) << m_log2Span);
+    }
+
+    /**
+     * Finds the lowest occupied bit at or above `bit`: climbs while the
+     * rest of the current word is empty, then descends taking the lowest
+     * bit of each word.  A descent that meets a word emptied meanwhile by
+     * the writer starts over from the first bit the word covered, which is
+     * beyond the one searched from.
+     */
+    bool above(uint64_t bit, bool retry, Price & price) const
+    {
+        if (!m_placed.load(std::memory_order_acquire)) return false;
+        size_t level = 0;
+        uint64_t word;
+        for (;;)
+        {
+            if (bit/64 >= m_words[level]) return false;
+            word = m_levels[level][bit/64].load(std::memory_order_acquire)
+                & (~uint64_t(0) << (bit%64));
+            if (word) break;
+            if (level + 1 == m_levels.size()) return false;
+            bit = bit/64 + 1;
+            ++level;
+            if (bit % 64 == 0 && bit/64 >= m_words[level]) return false;
+        }
+        bit = (bit & ~uint64_t(63)) | __builtin_ctzll(word);
+        for ( ; level > 0 ; --level)
+        {
+            word = m_levels[level-1][bit].load(std::memory_order_acquire);
+            if (word == 0)
+                return retry && above(bit << (6*level), retry, price);
+            bit = bit*64 + __builtin_ctzll(word);
+        }
+        price = static_cast<Price>(m_origin.load(std::memory_order_relaxed)
+                                   + bit);
+        return true;
+    }
+
+    // the mirror image of above()
+    bool below(uint64_t bit, bool retry, Price & price) const
+    {
+        if (!m_placed.load(std::memory_order_acquire)) return false;
+        size_t level = 0;
+        uint64_t word;
+        for (;;)
+        {
+            uint64_t mask = bit%64 == 63
+                ? ~uint64_t(0) : (uint64_t(1) << (bit%64 + 1)) - 1;
+            word = m_levels[level][bit/64].load(std::memory_order_acquire)
+                & mask;
+            if (word) break;
+            if (level + 1 == m_levels.size() || bit < 64) return false;
+            bit = bit/64 - 1;
+            ++level;
+        }
+        bit = (bit & ~uint64_t(63)) | (63 - __builtin_clzll(word));
+        for ( ; level > 0 ; --level)
+        {
+            word = m_levels[level-1][bit].load(std::memory_order_acquire);
+            if (word == 0)
+            {
+                return retry && bit > 0
+                    && below((bit << (6*level)) - 1, retry, price);
+            }
+            bit = bit*64 + 63 - __builtin_clzll(word);
+        }
+        price = static_cast<Price>(m_origin.load(std::memory_order_relaxed)
+                                   + bit);
+        return true;
+    }
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_BITMAP_INDEX_HPP
@@ -0,0 +1,664 @@
+#ifndef GDAX_ORDERBOOK_BTREE_MAP_HPP
+#define GDAX_ORDERBOOK_BTREE_MAP_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "gdax-orderbook/kernels.hpp"
+
+namespace gdax {
+
+/**
+ * An ordered price->quantity map for one side of a book, as a B+-tree of
+ * wide nodes, each holding up to 32 keys in a contiguous array searched
+ * with the CPU's widest vector compare (see kernels::Table::lowerBound),
+ * whose leaves are linked, best first, so that iteration reads the levels
+ * nearly sequentially rather than chasing a pointer per level.
+ *
+ * It offers the subset of the SkipListMap interface the book uses
+ * (insert(), update(), erase(), contains(), begin() and end()), so it can
+ * stand in for it as `bids`/`offers`; see gdax::BTreeStorage.
+ *
+ * Only one thread may modify the map at a time, which the book guarantees,
+ * but any number may read it concurrently, by optimistic lock coupling:
+ * every node has a version, odd while the writer modifies it, that readers
+ * note before reading the node and check after, restarting if it changed.
+ * Readers never write shared memory, so they neither block the writer nor
+ * contend with each other.  Nodes are never freed while the map exists,
+ * only recycled as nodes of the same kind, so a reader that read a stale
+ * pointer still reads a node, whose changed version sends it back.  Leaves
+ * are removed once empty rather than merged with their neighbours.
+ *
+ * As with SkipListMap, iteration concurrent with modification is not a
+ * snapshot, but each level it yields was in the map as it reached it.
+ *
+ * `Compare` must be std::less (offers) or std::greater (bids), and `Key`
+ * a 32-bit unsigned integer number of ticks.
+ */
+template<typename Key, typename Value, typename Compare>
+class BTreeMap
+{
+    static_assert(std::is_unsigned<Key>::value && sizeof(Key) == 4,
+                  "Key must be 32-bit unsigned ticks");
+    static_assert(std::is_same<Compare, std::less<Key>>::value
+                  || std::is_same<Compare, std::greater<Key>>::value,
+                  "Compare must be std::less or std::greater");
+
+    static constexpr bool descending =
+        std::is_same<Compare, std::greater<Key>>::value;
+
+    // keys are stored as ranks, ascending on both sides, best first
+    using Rank = uint32_t;
+    static Rank rank(Key key) { return descending ? ~Rank(key) : Rank(key); }
+    static Key keyOf(Rank r) { return Key(descending ? ~r : r); }
+
+    static constexpr unsigned capacity = 32; // keys per node
+    static constexpr unsigned maxDepth = 8;  // 32^8 leaves is plenty
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+
+    BTreeMap() : m_size(0)
+    {
+        Leaf* root = newLeaf();
+        unlock(root);
+        m_root.store(root, std::memory_order_release);
+    }
+
+    BTreeMap(BTreeMap const&) = delete;
+    BTreeMap& operator=(BTreeMap const&) = delete;
+
+    ~BTreeMap()
+    {
+        for (Node* node : m_nodes)
+        {
+            if (node->leaf) delete static_cast<Leaf*>(node);
+            else delete static_cast<Inner*>(node);
+        }
+    }
+
+private:
+    struct Node
+    {
+        std::atomic<uint64_t> version; // odd while being modified
+        std::atomic<unsigned> count;   // of keys
+        bool const leaf;
+        Rank keys[capacity];
+
+        explicit Node(bool leaf) : version(0), count(0), leaf(leaf) {}
+    };
+
+    struct Leaf : Node
+    {
+        Value values[capacity];
+        std::atomic<Leaf*> next;
+        Leaf* prev; // the writer's only
+
+        Leaf() : Node(true), next(nullptr), prev(nullptr) {}
+    };
+
+    // child i holds the ranks above keys[i-1], up to and including keys[i]
+    struct Inner : Node
+    {
+        std::atomic<Node*> children[capacity + 1];
+
+        Inner() : Node(false)
+        {
+            for (auto & child : children) child.store(nullptr);
+        }
+    };
+
+public:
+    /**
+     * Forward iterator over the levels, best first, yielding copies of the
+     * levels as they were when the iterator reached them.
+     */
+    class iterator
+    {
+    public:
+        iterator()
+            : m_map(nullptr), m_leaf(nullptr), m_version(0), m_index(0),
+              m_rank(0)
+        {}
+
+        iterator(iterator const& other) { *this = other; }
+        iterator& operator=(iterator const& other)
+        {
+            m_map = other.m_map;
+            m_leaf = other.m_leaf;
+            m_version = other.m_version;
+            m_index = other.m_index;
+            m_rank = other.m_rank;
+            if (m_map) new (&m_level) value_type(*other);
+            return *this;
+        }
+
+        value_type const& operator*() const
+        {
+            return *reinterpret_cast<value_type const*>(&m_level);
+        }
+        value_type const* operator->() const { return &**this; }
+
+        iterator& operator++()
+        {
+            if (!settle(m_leaf, m_version, m_index + 1))
+            {
+                if (m_rank == Rank(-1)) { m_map = nullptr; }
+                else { seek(m_rank + 1); }
+            }
+            return *this;
+        }
+
+        bool operator==(iterator const& other) const
+        {
+            return m_map == other.m_map
+                && (m_map == nullptr || m_rank == other.m_rank);
+        }
+        bool operator!=(iterator const& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        friend class BTreeMap;
+
+        BTreeMap const* m_map; // nullptr at end()
+        Leaf* m_leaf;
+        uint64_t m_version;    // of m_leaf, when the level was read from it
+        unsigned m_index;      // of the level in m_leaf
+        Rank m_rank;           // of the level
+        typename std::aligned_storage<sizeof(value_type),
+                                      alignof(value_type)>::type m_level;
+
+        iterator(BTreeMap const* map, Rank from) : m_map(map) { seek(from); }
+
+        // moves to the first level at or after rank `from`
+        void seek(Rank from)
+        {
+            for (;;)
+            {
+                uint64_t version;
+                Leaf* leaf = m_map->findLeaf(from, version);
+                unsigned n = std::min(leaf->count.load(
+                    std::memory_order_relaxed), capacity);
+                if (settle(leaf, version, search(leaf->keys, n, from)))
+                    return;
+            }
+        }
+
+        /**
+         * Moves to the level at `index` in `leaf`, or to the first of the
+         * following leaves if there is no such level, returning false if
+         * any leaf involved changed from the version noted for it.
+         */
+        bool settle(Leaf* leaf, uint64_t version, unsigned index)
+        {
+            for (;;)
+            {
+                unsigned n = std::min(leaf->count.load(
+                    std::memory_order_relaxed), capacity);
+                if (index < n)
+                {
+                    Rank r = leaf->keys[index];
+                    Value value = leaf->values[index];
+                    if (!valid(leaf, version)) return false;
+                    m_leaf = leaf;
+                    m_version = version;
+                    m_index = index;
+                    m_rank = r;
+                    new (&m_level) value_type(keyOf(r), value);
+                    return true;
+                }
+                Leaf* next = leaf->next.load(std::memory_order_acquire);
+                if (next == nullptr)
+                {
+                    if (!valid(leaf, version)) return false;
+                    m_map = nullptr;
+                    return true;
+                }
+                uint64_t nextVersion = stable(next);
+                if (!valid(leaf, version)) return false;
+                leaf = next;
+                version = nextVersion;
+                index = 0;
+            }
+        }
+    };
+    using const_iterator = iterator;
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(); }
+
+    bool empty() const { return size() == 0; }
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+    bool contains(Key const& key) const
+    {
+        Rank const r = rank(key);
+        for (;;)
+        {
+            uint64_t version;
+            Leaf* leaf = findLeaf(r, version);
+            unsigned n = std::min(leaf->count.load(std::memory_order_relaxed),
+                                  capacity);
+            unsigned i = search(leaf->keys, n, r);
+            bool found = i < n && leaf->keys[i] == r;
+            if (valid(leaf, version)) return found;
+        }
+    }
+
+    bool insert(Key const& key, Value const& value)
+    {
+        return update(key,
+            [&value](bool & bNew, value_type & pair)
+            {
+                if (bNew) pair.second = value;
+            }).second;
+    }
+
+    /**
+     * Calls func(bool & bNew, value_type & level) on the level at `key`,
+     * inserting it first, with bNew set, if it is absent and `allowInsert`.
+     * Returns whether the level exists now, and whether it was inserted.
+     */
+    template<typename Func>
+    std::pair<bool, bool> update(Key const& key, Func func,
+                                 bool allowInsert = true)
+    {
+        Rank const r = rank(key);
+        Path path;
+        Leaf* leaf = descend(r, path);
+        unsigned const n = leaf->count.load(std::memory_order_relaxed);
+        unsigned const i = search(leaf->keys, n, r);
+        bool bNew = !(i < n && leaf->keys[i] == r);
+        if (bNew && !allowInsert) return std::make_pair(false, false);
+
+        value_type level(key, bNew ? Value() : leaf->values[i]);
+        func(bNew, level);
+        if (!bNew)
+        {
+            lock(leaf);
+            leaf->values[i] = level.second;
+            unlock(leaf);
+            return std::make_pair(true, false);
+        }
+        if (n < capacity)
+        {
+            lock(leaf);
+            std::copy_backward(leaf->keys + i, leaf->keys + n,
+                               leaf->keys + n + 1);
+            std::copy_backward(leaf->values + i, leaf->values + n,
+                               leaf->values + n + 1);
+            leaf->keys[i] = r;
+            leaf->values[i] = level.second;
+            leaf->count.store(n + 1, std::memory_order_relaxed);
+            unlock(leaf);
+        }
+        else { insertSplitting(leaf, i, r, level.second, path); }
+        m_size.fetch_add(1, std::memory_order_relaxed);
+        return std::make_pair(true, true);
+    }
+
+    bool erase(Key const& key)
+    {
+        Rank const r = rank(key);
+        Path path;
+        Leaf* leaf = descend(r, path);
+        unsigned const n = leaf->count.load(std::memory_order_relaxed);
+        unsigned const i = search(leaf->keys, n, r);
+        if (!(i < n && leaf->keys[i] == r)) return false;
+
+        if (n > 1 || (leaf->prev == nullptr && leaf->next.load() == nullptr))
+        {
+            lock(leaf);
+            std::copy(leaf->keys + i + 1, leaf->keys + n, leaf->keys + i);
+            std::copy(leaf->values + i + 1, leaf->values + n,
+                      leaf->values + i);
+            leaf->count.store(n - 1, std::memory_order_relaxed);
+            unlock(leaf);
+        }
+        else { removeLeaf(leaf, path); }
+        m_size.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    std::atomic<Node*> m_root;
+    std::atomic<size_t> m_size;
+    std::vector<Node*> m_nodes; // all of them, for destruction
+    std::vector<Leaf*> m_freeLeaves;
+    std::vector<Inner*> m_freeInners;
+
+    // the inner nodes above a leaf, root first, and which child was taken
+    struct Path
+    {
+        Inner* nodes[maxDepth];
+        unsigned children[maxDepth];
+        unsigned depth = 0;
+    };
+
+    static unsigned search(Rank const* keys, unsigned n, Rank r)
+    {
+        return kernels::table().lowerBound(keys, n, r);
+    }
+
+    // writer side: a node is "locked" while its version is odd
+    static void lock(Node* node)
+    {
+        node->version.store(node->version.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    static void unlock(Node* node)
+    {
+        node->version.store(node->version.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_release);
+    }
+
+    // reader side: the version of a node not being modified, and whether a
+    // node is still at that version after reading it
+    static uint64_t stable(Node const* node)
+    {
+        for (;;)
+        {
+            uint64_t version = node->version.load(std::memory_order_acquire);
+            if (!(version & 1)) return version;
+        }
+    }
+    static bool valid(Node const* node, uint64_t version)
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return node->version.load(std::memory_order_relaxed) == version;
+    }
+
+    /**
+     * Descends from the root to the leaf that holds, or would hold, rank
+     * `r`, noting each node's version before following its pointer to the
+     * next, and checking it after noting the next one's, so that the leaf
+     * returned, with its version, was where the search led at that time.
+     */
+    Leaf* findLeaf(Rank r, uint64_t & version) const
+    {
+        for (;;)
+        {
+            Node* node = m_root.load(std::memory_order_acquire);
+            uint64_t v = stable(node);
+            if (node != m_root.load(std::memory_order_acquire)) continue;
+            while (!node->leaf)
+            {
+                Inner* inner = static_cast<Inner*>(node);
+                unsigned n = std::min(inner->count.load(
+                    std::memory_order_relaxed), capacity);
+                Node* child = inner->children[search(inner->keys, n, r)]
+                    .load(std::memory_order_acquire);
+                if (child == nullptr) break;
+                uint64_t childVersion = stable(child);
+                if (!valid(node, v)) break;
+                node = child;
+                v = childVersion;
+            }
+            if (node->leaf)
+            {
+                version = v;
+                return static_cast<Leaf*>(node);
+            }
+        }
+    }
+
+    // the writer's descent, which needs no validation
+    Leaf* descend(Rank r, Path & path) const
+    {
+        Node* node = m_root.load(std::memory_order_relaxed);
+        path.depth = 0;
+        while (!node->leaf)
+        {
+            Inner* inner = static_cast<Inner*>(node);
+            unsigned child = search(inner->keys,
+                inner->count.load(std::memory_order_relaxed), r);
+            path.nodes[path.depth] = inner;
+            path.children[path.depth++] = child;
+            node = inner->children[child].load(std::memory_order_relaxed);
+        }
+        return static_cast<Leaf*>(node);
+    }
+
+    // new nodes start locked, as a recycled one may still be being read
+    Leaf* newLeaf()
+    {
+        Leaf* leaf;
+        if (m_freeLeaves.empty())
+        {
+            leaf = new Leaf();
+            m_nodes.push_back(leaf);
+        }
+        else
+        {
+            leaf = m_freeLeaves.back();
+            m_freeLeaves.pop_back();
+        }
+        lock(leaf);
+        leaf->count.store(0, std::memory_order_relaxed);
+        leaf->next.store(nullptr, std::memory_order_relaxed);
+        leaf->prev = nullptr;
+        return leaf;
+    }
+    Inner* newInner()
+    {
+        Inner* inner;
+        if (m_freeInners.empty())
+        {
+            inner = new Inner();
+            m_nodes.push_back(inner);
+        }
+        else
+        {
+            inner = m_freeInners.back();
+            m_freeInners.pop_back();
+        }
+        lock(inner);
+        inner->count.store(0, std::memory_order_relaxed);
+        return inner;
+    }
+
+    /**
+     * Inserts rank `r` at index `i` of the full `leaf`, splitting it, and
+     * as many of its ancestors as are full, in two.  Every node involved
+     * is locked until all of them are consistent again.
+     */
+    void insertSplitting(Leaf* leaf, unsigned i, Rank r, Value value,
+                         Path const& path)
+    {
+        // the ancestors from `top` down split; the one above them, if any,
+        // just gains a key
+        unsigned top = path.depth;
+        while (top > 0 && path.nodes[top-1]->count.load(
+                   std::memory_order_relaxed) == capacity)
+        {
+            --top;
+        }
+        std::vector<Node*> locked(1, leaf);
+        for (unsigned d = top > 0 ? top - 1 : 0 ; d < path.depth ; ++d)
+            locked.push_back(path.nodes[d]);
+        for (Node* node : locked) lock(node);
+
+        Rank keys[capacity + 1];
+        Value values[capacity + 1];
+        std::copy(leaf->keys, leaf->keys + i, keys);
+        std::copy(leaf->values, leaf->values + i, values);
+        keys[i] = r;
+        values[i] = value;
+        std::copy(leaf->keys + i, leaf->keys + capacity, keys + i + 1);
+        std::copy(leaf->values + i, leaf->values + capacity, values + i + 1);
+
+        // appending beyond the last leaf, as a snapshot does, leaves it full
+        Leaf* next = leaf->next.load(std::memory_order_relaxed);
+        unsigned const left = i == capacity && next == nullptr
+            ? capacity : (capacity + 1)/2;
+        Leaf* right = newLeaf();
+        locked.push_back(right);
+        std::copy(keys, keys + left, leaf->keys);
+        std::copy(values, values + left, leaf->values);
+        std::copy(keys + left, keys + capacity + 1, right->keys);
+        std::copy(values + left, values + capacity + 1, right->values);
+        leaf->count.store(left, std::memory_order_relaxed);
+        right->count.store(capacity + 1 - left, std::memory_order_relaxed);
+        right->next.store(next, std::memory_order_relaxed);
+        right->prev = leaf;
+        if (next) next->prev = right;
+        leaf->next.store(right, std::memory_order_release);
+
+        // push the separator and new right node up the path
+        Rank separator = keys[left - 1];
+        Node* added = right;
+        unsigned d = path.depth;
+        for ( ; d > top ; --d)
+        {
+            Inner* inner = path.nodes[d-1];
+            unsigned const c = path.children[d-1];
+            Rank innerKeys[capacity + 1];
+            Node* children[capacity + 2];
+            for (unsigned k = 0 ; k <= capacity ; ++k)
+                children[k + (k > c)] =
+                    inner->children[k].load(std::memory_order_relaxed);
+            std::copy(inner->keys, inner->keys + c, innerKeys);
+            innerKeys[c] = separator;
+            std::copy(inner->keys + c, inner->keys + capacity,
+                      innerKeys + c + 1);
+            children[c + 1] = added;
+
+            unsigned const half = (capacity + 1)/2;
+            Inner* sibling = newInner();
+            locked.push_back(sibling);
+            std::copy(innerKeys, innerKeys + half, inner->keys);
+            std::copy(innerKeys + half + 1, innerKeys + capacity + 1,
+                      sibling->keys);
+            for (unsigned k = 0 ; k <= capacity + 1 ; ++k)
+            {
+                if (k <= half)
+                    inner->children[k].store(children[k],
+                                             std::memory_order_relaxed);
+                else
+                    sibling->children[k - half - 1].store(children[k],
+                        std::memory_order_relaxed);
+            }
+            inner->count.store(half, std::memory_order_relaxed);
+            sibling->count.store(capacity - half, std::memory_order_relaxed);
+            separator = innerKeys[half];
+            added = sibling;
+        }
+
+        if (d > 0)
+        {
+            Inner* inner = path.nodes[d-1];
+            unsigned const c = path.children[d-1];
+            unsigned const n = inner->count.load(std::memory_order_relaxed);
+            for (unsigned k = n + 1 ; k > c + 1 ; --k)
+            {
+                inner->children[k].store(inner->children[k-1].load(
+                    std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+            std::copy_backward(inner->keys + c, inner->keys + n,
+                               inner->keys + n + 1);
+            inner->keys[c] = separator;
+            inner->children[c + 1].store(added, std::memory_order_release);
+            inner->count.store(n + 1, std::memory_order_relaxed);
+        }
+        else
+        {
+            // the root split: grow a new one above it
+            Inner* root = newInner();
+            locked.push_back(root);
+            root->keys[0] = separator;
+            root->children[0].store(m_root.load(std::memory_order_relaxed),
+                                    std::memory_order_relaxed);
+            root->children[1].store(added, std::memory_order_relaxed);
+            root->count.store(1, std::memory_order_relaxed);
+            m_root.store(root, std::memory_order_release);
+        }
+
+        for (Node* node : locked) unlock(node);
+    }
+
+    /**
+     * Removes `leaf`, whose last level is being erased, and any ancestors
+     * left without children, recycling them, then shortens the tree while
+     * its root has a single child.
+     */
+    void removeLeaf(Leaf* leaf, Path const& path)
+    {
+        // the ancestors from `top` down go too; the one above them just
+        // loses a child; there is one, as the leaf is not the only one
+        unsigned top = path.depth;
+        while (top > 0 && path.nodes[top-1]->count.load(
+                   std::memory_order_relaxed) == 0)
+        {
+            --top;
+        }
+        std::vector<Node*> locked(1, leaf);
+        if (leaf->prev) locked.push_back(leaf->prev);
+        for (unsigned d = top - 1 ; d < path.depth ; ++d)
+            locked.push_back(path.nodes[d]);
+        for (Node* node : locked) lock(node);
+
+        Leaf* next = leaf->next.load(std::memory_order_relaxed);
+        if (leaf->prev) leaf->prev->next.store(next, std::memory_order_release);
+        if (next) next->prev = leaf->prev;
+        leaf->count.store(0, std::memory_order_relaxed);
+
+        Inner* inner = path.nodes[top-1];
+        unsigned const c = path.children[top-1];
+        unsigned const n = inner->count.load(std::memory_order_relaxed);
+        unsigned const key = c < n ? c : c - 1;
+        std::copy(inner->keys + key + 1, inner->keys + n, inner->keys + key);
+        for (unsigned k = c ; k < n ; ++k)
+        {
+            inner->children[k].store(inner->children[k+1].load(
+                std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        inner->count.store(n - 1, std::memory_order_relaxed);
+
+        for (Node* node : locked) unlock(node);
+        m_freeLeaves.push_back(leaf);
+        for (unsigned d = top ; d < path.depth ; ++d)
+            m_freeInners.push_back(path.nodes[d]);
+
+        Node* root = m_root.load(std::memory_order_relaxed);
+        while (!root->leaf
+               && root->count.load(std::memory_order_relaxed) == 0)
+        {
+            Inner* old = static_cast<Inner*>(root);
+            lock(old);
+            root = old->children[0].load(std::memory_order_relaxed);
+            m_root.store(root, std::memory_order_release);
+            unlock(old);
+            m_freeInners.push_back(old);
+        }
+    }
+};
+
+template<typename Key, typename Value, typename Compare>
+constexpr unsigned BTreeMap<Key, Value, Compare>::capacity;
+
+/**
+ * Storage for BasicGDAXOrderBook that uses a BTreeMap for each side.
+ */
+struct BTreeStorage
+{
+    template<typename Price, typename Size>
+    using bids_map = BTreeMap<Price, Size, std::greater<Price>>;
+    template<typename Price, typename Size>
+    using offers_map = BTreeMap<Price, Size, std::less<Price>>;
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_BTREE_MAP_HPP
@@ -0,0 +1,44 @@
+#ifndef GDAX_ORDERBOOK_CHANGE_BATCH_HPP
+#define GDAX_ORDERBOOK_CHANGE_BATCH_HPP
+
+#include <vector>
+
+namespace gdax {
+
+enum class Side { Bid, Offer };
+
+/** One level of one side of a book set to a size, 0 removing it. */
+template<typename Price, typename Size>
+struct Change
+{
+    Side side;
+    Price price;
+    Size size;
+};
+
+/**
+ * A feed message reduced to what the book applies: its type, and the level
+ * changes it carries, already converted to binary prices and sizes.  For a
+ * snapshot, the changes are every level of the book, bids first.
+ *
+ * Batches are meant to be reused, e.g. by gdax::ParsePipeline, so that the
+ * vector of changes keeps its capacity from one message to the next.
+ */
+template<typename Price, typename Size>
+struct ChangeBatch
+{
+    enum Type { None, Snapshot, Update };
+
+    Type type = None; // None for messages the book ignores
+    std::vector<Change<Price, Size>> changes;
+
+    void clear()
+    {
+        type = None;
+        changes.clear();
+    }
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_CHANGE_BATCH_HPP
@@ -0,0 +1,184 @@
+#ifndef GDAX_ORDERBOOK_CONFLATION_HPP
+#define GDAX_ORDERBOOK_CONFLATION_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "gdax-orderbook/change-batch.hpp"
+
+namespace gdax {
+
+/**
+ * Merges ChangeBatches, keeping only the latest size of each (side, price)
+ * level, so that applying the merged batch leaves a book as applying each
+ * in turn would have, in a single pass, however often a level changed.
+ *
+ * merge() appends to a batch of updates, or to a snapshot, in which the
+ * later changes are then folded, but never merges a snapshot into anything.
+ * The Conflator remembers where each level is in the last batch merged
+ * into, so merging several batches into one costs a hash lookup per change;
+ * if that batch is changed other than by merge() or clear(), reset() must
+ * be called before merging into it again.
+ */
+template<typename Price, typename Size>
+class Conflator
+{
+public:
+    using batch_t = ChangeBatch<Price, Size>;
+
+    /**
+     * Folds the changes of `next` into `into`, unless `next` is not an
+     * update, in which case it returns false and leaves both alone.
+     */
+    bool merge(batch_t & into, batch_t const& next)
+    {
+        if (next.type != batch_t::Update) return false;
+        if (into.type == batch_t::None) into.type = batch_t::Update;
+        if (&into != m_into || into.changes.size() < m_indexed)
+        {
+            reset();
+            m_into = &into;
+        }
+        for ( ; m_indexed < into.changes.size() ; ++m_indexed)
+            m_levels[key(into.changes[m_indexed])] = m_indexed;
+
+        for (auto const& change : next.changes)
+        {
+            auto level = m_levels.find(key(change));
+            if (level != m_levels.end())
+            {
+                into.changes[level->second].size = change.size;
+            }
+            else
+            {
+                m_levels.emplace(key(change), into.changes.size());
+                into.changes.push_back(change);
+            }
+        }
+        m_indexed = into.changes.size();
+        return true;
+    }
+
+    /** Forgets the batch last merged into. */
+    void reset()
+    {
+        m_into = nullptr;
+        m_indexed = 0;
+        m_levels.clear();
+    }
+
+    /**
+     * Makes a merged snapshot self-contained again, by dropping the levels
+     * later changes removed, which a snapshot does not otherwise list.
+     */
+    static void settle(batch_t & batch)
+    {
+        if (batch.type != batch_t::Snapshot) return;
+        size_t kept = 0;
+        for (auto const& change : batch.changes)
+        {
+            if (change.size != 0) batch.changes[kept++] = change;
+        }
+        batch.changes.resize(kept);
+    }
+
+private:
+    struct Key
+    {
+        Side side;
+        Price price;
+        bool operator==(Key const& other) const
+        {
+            return side == other.side && price == other.price;
+        }
+    };
+    struct Hash
+    {
+        size_t operator()(Key const& key) const
+        {
+            return std::hash<Price>()(key.price)*2
+                + (key.side == Side::Bid ? 1 : 0);
+        }
+    };
+
+    static Key key(Change<Price, Size> const& change)
+    {
+        return Key{ change.side, change.price };
+    }
+
+    std::unordered_map<Key, size_t, Hash> m_levels; // index in *m_into
+    batch_t const* m_into = nullptr;
+    size_t m_indexed = 0; // changes of *m_into in m_levels
+};
+
+/**
+ * A conflated stream of a book's changes, for a consumer that cannot, or
+ * need not, see every message: push() adds each batch the book applies
+ * (see BasicGDAXOrderBook::addListener()), merged with any the consumer has
+ * not taken yet, and take() hands over everything pending, as one batch, at
+ * most once per `minInterval`.  A slow consumer thus sees fewer, larger
+ * batches rather than falling further behind, and a fast one is held to a
+ * maximum rate.  A snapshot replaces whatever is pending.
+ *
+ * push() and take() may be called from different threads.
+ */
+template<typename Price, typename Size>
+class ConflatedStream
+{
+public:
+    using batch_t = ChangeBatch<Price, Size>;
+
+    explicit ConflatedStream(
+        std::chrono::steady_clock::duration minInterval
+            = std::chrono::steady_clock::duration::zero())
+        : m_minInterval(minInterval),
+          m_lastTaken(std::chrono::steady_clock::now() - minInterval)
+    {}
+
+    void push(batch_t const& batch)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (batch.type == batch_t::None) return;
+        if (!m_conflator.merge(m_pending, batch))
+        {
+            m_pending = batch;
+            m_conflator.reset();
+        }
+    }
+
+    /**
+     * Moves the pending changes into `batch`, and returns true, unless none
+     * are pending, or the last were taken less than `minInterval` ago.
+     */
+    bool take(batch_t & batch)
+    {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pending.type == batch_t::None
+            || now - m_lastTaken < m_minInterval)
+        {
+            return false;
+        }
+        batch.clear();
+        std::swap(batch, m_pending);
+        m_conflator.reset();
+        Conflator<Price, Size>::settle(batch);
+        m_lastTaken = now;
+        return true;
+    }
+
+private:
+    std::chrono::steady_clock::duration const m_minInterval;
+    std::mutex m_mutex; // guards all of the below
+    std::chrono::steady_clock::time_point m_lastTaken;
+    Conflator<Price, Size> m_conflator;
+    batch_t m_pending;
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_CONFLATION_HPP
@@ -0,0 +1,266 @@
+#ifndef GDAX_ORDERBOOK_DEPTH_WINDOW_HPP
+#define GDAX_ORDERBOOK_DEPTH_WINDOW_HPP
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+
+namespace gdax {
+
+/**
+ * Bounds the levels of each side of the book that are kept in its
+ * price->quantity map to those nearest the touch: at most `maxLevels`
+ * levels, and/or only those within `maxPercentFromMid` percent of the mid
+ * price.  Zero means no bound.  Levels outside the window cost readers
+ * nothing, as they never enter the maps.
+ *
+ * With `trackBeyond`, the writer still keeps levels outside the window, in
+ * a private plain map, so that the total size and count of levels beyond
+ * the window are available, and so that levels re-enter the window as it
+ * moves or as levels inside it are removed.  Without it, levels outside the
+ * window are discarded, so a window of `maxLevels` may hold fewer levels
+ * until the feed next updates the ones it lost.
+ */
+struct DepthWindow
+{
+    size_t maxLevels;
+    double maxPercentFromMid;
+    bool trackBeyond;
+
+    DepthWindow(size_t maxLevels = 0,
+                double maxPercentFromMid = 0,
+                bool trackBeyond = false)
+        : maxLevels(maxLevels),
+          maxPercentFromMid(maxPercentFromMid),
+          trackBeyond(trackBeyond)
+    {}
+
+    bool bounded() const { return maxLevels != 0 || maxPercentFromMid != 0; }
+};
+
+/**
+ * Writer-side state of one side of a book with a bounded DepthWindow.
+ *
+ * All known levels of the side are kept in a plain map, ordered best first
+ * by `Compare`, of which the window is always a prefix: the first
+ * `m_inWindow` levels, up to `m_boundary`, are mirrored into the side's
+ * concurrent map, and those from `m_boundary` on are beyond the window.
+ * Changes move that boundary a level at a time, so each costs O(log n) in
+ * the plain map plus whatever the concurrent map is actually changed by.
+ */
+template<typename Price, typename Size, typename Compare>
+class WindowedSide
+{
+public:
+    explicit WindowedSide(DepthWindow const& window)
+        : m_window(window),
+          m_boundary(m_levels.end()),
+          m_inWindow(0),
+          m_beyondLevels(0),
+          m_beyondUnits(0)
+    {}
+
+    /**
+     * Applies the new size of the level at `price`, zero meaning that the
+     * level was removed, to this side and, if it is within the window, to
+     * `map`.  `limit` is the worst price the window currently admits, if
+     * `hasLimit`.  Call enforce() once the other side is updated too.
+     */
+    template<typename map_t>
+    void apply(map_t & map, Price price, Size size, bool hasLimit, Price limit)
+    {
+        auto level = m_levels.find(price);
+        if (level != m_levels.end())
+        {
+            bool inWindow = isInWindow(price);
+            if (size == 0)
+            {
+                if (inWindow)
+                {
+                    map.erase(price);
+                    --m_inWindow;
+                }
+                else
+                {
+                    addBeyond(-1, -level->second);
+                    if (level == m_boundary) ++m_boundary;
+                }
+                m_levels.erase(level);
+            }
+            else
+            {
+                if (inWindow) { set(map, price, size); }
+                else { addBeyond(0, size - level->second); }
+                level->second = size;
+            }
+            return;
+        }
+        if (size == 0) return;
+
+        if (entersWindow(price, hasLimit, limit))
+        {
+            m_levels.insert(level, std::make_pair(price, size));
+            set(map, price, size);
+            ++m_inWindow;
+        }
+        else if (m_window.trackBeyond)
+        {
+            level = m_levels.insert(level, std::make_pair(price, size));
+            if (m_boundary == m_levels.end()
+                || Compare()(price, m_boundary->first))
+            {
+                m_boundary = level;
+            }
+            addBeyond(+1, size);
+        }
+    }
+
+    /**
+     * Moves the boundary until the window holds exactly the levels it
+     * admits, evicting levels from, or admitting them into, `map`.
+     */
+    template<typename map_t>
+    void enforce(map_t & map, bool hasLimit, Price limit)
+    {
+        while (m_inWindow > 0
+               && ((m_window.maxLevels && m_inWindow > m_window.maxLevels)
+                   || (hasLimit
+                       && Compare()(limit, std::prev(m_boundary)->first))))
+        {
+            auto last = std::prev(m_boundary);
+            map.erase(last->first);
+            --m_inWindow;
+            if (m_window.trackBeyond)
+            {
+                addBeyond(+1, last->second);
+                m_boundary = last;
+            }
+            else
+            {
+                m_levels.erase(last);
+            }
+        }
+        while (m_boundary != m_levels.end()
+               && (!m_window.maxLevels || m_inWindow < m_window.maxLevels)
+               && !(hasLimit && Compare()(limit, m_boundary->first)))
+        {
+            set(map, m_boundary->first, m_boundary->second);
+            addBeyond(-1, -m_boundary->second);
+            ++m_inWindow;
+            ++m_boundary;
+        }
+    }
+
+    /**
+     * Replaces all levels, e.g. from a snapshot, all initially beyond the
+     * window.  Follow with enforce() to fill the window from them; `map`
+     * must be empty.
+     */
+    template<typename Iterator>
+    void load(Iterator first, Iterator last)
+    {
+        m_levels.clear();
+        m_beyondLevels.store(0, std::memory_order_relaxed);
+        m_beyondUnits.store(0, std::memory_order_relaxed);
+        for ( ; first != last ; ++first)
+        {
+            m_levels[first->first] = first->second;
+            addBeyond(+1, first->second);
+        }
+        m_boundary = m_levels.begin();
+        m_inWindow = 0;
+    }
+
+    /**
+     * Discards the levels beyond the window, if they are not tracked; for
+     * use after load() and enforce().
+     */
+    void trim()
+    {
+        if (m_window.trackBeyond) return;
+        m_levels.erase(m_boundary, m_levels.end());
+        m_boundary = m_levels.end();
+        m_beyondLevels.store(0, std::memory_order_relaxed);
+        m_beyondUnits.store(0, std::memory_order_relaxed);
+    }
+
+    // the levels tracked, from the touch, beyond the window's included
+    std::map<Price, Size, Compare> const& levels() const { return m_levels; }
+
+    bool best(Price & price) const
+    {
+        if (m_levels.empty()) return false;
+        price = m_levels.begin()->first;
+        return true;
+    }
+
+    // beyond-window aggregates, safe to read from any thread
+    size_t beyondLevels() const
+    {
+        return m_beyondLevels.load(std::memory_order_relaxed);
+    }
+    Size beyondSize() const
+    {
+        return m_beyondUnits.load(std::memory_order_relaxed)/unitsPerSize;
+    }
+
+private:
+    // sizes are summed exactly, in the feed's 1e-8 units, to avoid drift
+    static constexpr double unitsPerSize = 1e8;
+
+    DepthWindow const m_window;
+    std::map<Price, Size, Compare> m_levels;
+    typename std::map<Price, Size, Compare>::iterator m_boundary;
+    size_t m_inWindow;
+    std::atomic<size_t> m_beyondLevels;
+    std::atomic<int64_t> m_beyondUnits;
+
+    bool isInWindow(Price price) const
+    {
+        return m_boundary == m_levels.end()
+            || Compare()(price, m_boundary->first);
+    }
+
+    bool entersWindow(Price price, bool hasLimit, Price limit) const
+    {
+        if (!isInWindow(price)) return false;
+        if (hasLimit && Compare()(limit, price)) return false;
+        if (m_window.maxLevels && m_inWindow >= m_window.maxLevels)
+        {
+            // admit it only if it displaces the worst level in the window
+            return Compare()(price, std::prev(m_boundary)->first);
+        }
+        return true;
+    }
+
+    template<typename map_t>
+    static void set(map_t & map, Price price, Size size)
+    {
+        map.update(
+            price,
+            [size](bool & bNew, std::pair<const Price, Size> & pair)
+            {
+                pair.second = size;
+            });
+    }
+
+    void addBeyond(long levels, Size size)
+    {
+        if (!m_window.trackBeyond) return;
+        // a single writer, so plain load-then-store is enough
+        m_beyondLevels.store(m_beyondLevels.load(std::memory_order_relaxed)
+            + levels, std::memory_order_relaxed);
+        m_beyondUnits.store(m_beyondUnits.load(std::memory_order_relaxed)
+            + std::llround(size*unitsPerSize), std::memory_order_relaxed);
+    }
+};
+
+template<typename Price, typename Size, typename Compare>
+constexpr double WindowedSide<Price, Size, Compare>::unitsPerSize;
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_DEPTH_WINDOW_HPP
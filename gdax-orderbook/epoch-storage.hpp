@@ -0,0 +1,51 @@
+#ifndef GDAX_ORDERBOOK_EPOCH_STORAGE_HPP
+#define GDAX_ORDERBOOK_EPOCH_STORAGE_HPP
+
+#include <functional>
+
+#include <cds/container/skip_list_map_rcu.h>
+#include <cds/urcu/general_buffered.h>
+
+namespace gdax {
+
+/**
+ * Storage for BasicGDAXOrderBook that keeps the default skip lists, but
+ * reclaims their removed nodes by epochs, using libcds' user-space RCU,
+ * instead of by hazard pointers.
+ *
+ * With hazard pointers, every step of an iterator publishes the node it
+ * is about to visit and checks that it is still linked.  With RCU, a reader
+ * instead enters a read-side critical section once per traversal, by
+ * holding a `read_lock_t` (see BasicGDAXOrderBook), and then dereferences
+ * freely, as removed nodes are only freed once every reader that might see
+ * them has left its section.  In exchange, readers must not hold the lock
+ * for long, as the writer's erase() eventually waits for them to leave
+ * (general_buffered batches removals to make that rare), and iterating
+ * without the lock is not safe.
+ *
+ * The RCU singleton, the storage's `collector`, is shared by every book
+ * using this storage, as libcds' cds::gc::HP is by every book.
+ */
+struct EpochStorage
+{
+    using rcu = cds::urcu::gc<cds::urcu::general_buffered<>>;
+
+    template<typename Price, typename Size>
+    using offers_map = cds::container::SkipListMap<rcu, Price, Size>;
+    template<typename Price, typename Size>
+    using bids_map =
+        cds::container::SkipListMap<
+            rcu,
+            Price,
+            Size,
+            // reverse map ordering so best (highest) bid is at begin()
+            typename cds::container::skip_list::make_traits<
+                cds::opt::less<std::greater<Price>>>::type>;
+
+    using collector = rcu;
+    using read_lock = rcu::scoped_lock;
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_EPOCH_STORAGE_HPP
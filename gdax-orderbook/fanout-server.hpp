@@ -0,0 +1,329 @@
+#ifndef GDAX_ORDERBOOK_FANOUT_SERVER_HPP
+#define GDAX_ORDERBOOK_FANOUT_SERVER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "gdax-orderbook/change-batch.hpp"
+#include "gdax-orderbook/conflation.hpp"
+#include "gdax-orderbook/wire-format.hpp"
+
+namespace gdax {
+
+/**
+ * How a FanoutServer listens, and treats clients that fall behind.
+ *
+ * A client whose unsent messages exceed `maxBuffered` bytes is slow, and is
+ * then, by `slowClient`, either disconnected, or sent conflated deltas: the
+ * changes it has not been sent are merged until it catches up, then sent as
+ * one delta, numbered with the sequence of the last of them, so that a
+ * client sees it was conflated by the jump in sequence.
+ */
+struct FanoutOptions
+{
+    enum SlowClient { Conflate, Disconnect };
+
+    std::string address;
+    unsigned short port; // 0 for any free port; see FanoutServer::port()
+    size_t maxBuffered;
+    SlowClient slowClient;
+
+    FanoutOptions(unsigned short port = 30069,
+                  size_t maxBuffered = 1 << 20,
+                  SlowClient slowClient = Conflate,
+                  std::string const& address = "0.0.0.0")
+        : address(address), port(port), maxBuffered(maxBuffered),
+          slowClient(slowClient)
+    {}
+};
+
+/**
+ * Serves one product's book to consumers over TCP, for those that cannot
+ * use multicast (see gdax::MulticastPublisher): each client is sent, on
+ * connecting, a Snapshot message of the binary wire format (see gdax::wire)
+ * with every level of the book, and then each change to it as a Delta
+ * message, in sequence.  Messages follow each other on the stream, each as
+ * long as its header and group say.
+ *
+ * Fed like the publisher, e.g. `book.addListener([&](GDAXOrderBook::batch_t
+ * const& batch) { server.publish(batch); });`, whose first batch is the
+ * book's snapshot, publish() only queues a copy
+ * of the batch for the server's one thread, which keeps its own copy of the
+ * book, from which the snapshots are made, consistent with the deltas that
+ * follow them, and writes to every client, buffering per client what the
+ * client is not yet ready to receive; see gdax::FanoutOptions.  The thread
+ * waits on the sockets through boost::asio, and so on epoll, on Linux.
+ *
+ * Until a snapshot is published, the server has no book to serve: deltas
+ * are dropped, and clients that connect are sent nothing until it is.
+ */
+template<typename Price, typename Size>
+class FanoutServer
+{
+public:
+    using batch_t = ChangeBatch<Price, Size>;
+
+    FanoutServer(uint32_t productId,
+                 FanoutOptions const& options = FanoutOptions())
+        : m_productId(productId),
+          m_options(options),
+          m_acceptor(m_io, boost::asio::ip::tcp::endpoint(
+              boost::asio::ip::address::from_string(options.address),
+              options.port))
+    {
+        accept();
+        m_thread = std::thread([this] { m_io.run(); });
+    }
+
+    FanoutServer(FanoutServer const&) = delete;
+    FanoutServer& operator=(FanoutServer const&) = delete;
+
+    /** Closes every connection, discarding anything not yet sent. */
+    ~FanoutServer()
+    {
+        m_io.stop();
+        m_thread.join();
+    }
+
+    /** Queues a batch to be sent to every client, from one thread. */
+    void publish(batch_t const& batch)
+    {
+        if (batch.type == batch_t::None) return;
+        bool wasEmpty;
+        {
+            std::lock_guard<std::mutex> lock(m_inboxMutex);
+            wasEmpty = m_inbox.empty();
+            m_inbox.push_back(batch);
+        }
+        if (wasEmpty) m_io.post([this] { sendPublished(); });
+    }
+
+    /** The port listened on. */
+    unsigned short port() const
+    {
+        return m_acceptor.local_endpoint().port();
+    }
+
+    /** The number of clients connected; safe to call from any thread. */
+    size_t clients() const { return m_clients.load(); }
+
+    /** The number of clients disconnected for being slow. */
+    uint64_t disconnected() const { return m_disconnected.load(); }
+
+private:
+    struct Client
+    {
+        explicit Client(boost::asio::io_service & io) : socket(io) {}
+
+        boost::asio::ip::tcp::socket socket;
+        std::vector<char> writing; // being written
+        std::vector<char> queued;  // to write next
+        bool conflating = false;   // merging into `pending` while slow
+        batch_t pending;
+        Conflator<Price, Size> conflator;
+        char readBuffer[64];       // what the client sends is ignored
+        bool closed = false;
+    };
+    using client_ptr = std::shared_ptr<Client>;
+
+    uint32_t const m_productId;
+    FanoutOptions const m_options;
+
+    boost::asio::io_service m_io;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    std::thread m_thread;
+
+    std::mutex m_inboxMutex; // guards m_inbox
+    std::vector<batch_t> m_inbox;
+
+    // the server thread's
+    std::vector<batch_t> m_published;
+    std::vector<client_ptr> m_connected;
+    std::map<Price, Size> m_bids, m_offers;
+    bool m_loaded = false; // whether a snapshot has been published
+    uint64_t m_sequence = 0;
+    std::vector<char> m_message;
+
+    std::atomic<size_t> m_clients{0};
+    std::atomic<uint64_t> m_disconnected{0};
+
+    void accept()
+    {
+        client_ptr client = std::make_shared<Client>(m_io);
+        m_acceptor.async_accept(client->socket,
+            [this, client](boost::system::error_code const& error)
+            {
+                if (error == boost::asio::error::operation_aborted) return;
+                if (!error) connect(client);
+                accept();
+            });
+    }
+
+    void connect(client_ptr const& client)
+    {
+        boost::system::error_code error;
+        client->socket.set_option(boost::asio::ip::tcp::no_delay(true),
+                                  error);
+        m_connected.push_back(client);
+        m_clients.store(m_connected.size());
+        if (m_loaded)
+        {
+            encodeSnapshot();
+            client->queued.insert(client->queued.end(), m_message.begin(),
+                                  m_message.end());
+            flush(client);
+        }
+        read(client);
+    }
+
+    // notices the client's disconnecting
+    void read(client_ptr const& client)
+    {
+        client->socket.async_read_some(
+            boost::asio::buffer(client->readBuffer),
+            [this, client](boost::system::error_code const& error, size_t)
+            {
+                if (error) { close(client); }
+                else { read(client); }
+            });
+    }
+
+    void close(client_ptr const& client)
+    {
+        if (client->closed) return;
+        client->closed = true;
+        boost::system::error_code error;
+        client->socket.close(error);
+        m_connected.erase(std::find(m_connected.begin(), m_connected.end(),
+                                    client));
+        m_clients.store(m_connected.size());
+    }
+
+    void sendPublished()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_inboxMutex);
+            std::swap(m_published, m_inbox);
+        }
+        for (auto const& batch : m_published) send(batch);
+        m_published.clear();
+    }
+
+    void send(batch_t const& batch)
+    {
+        // deltas to no known book would give clients a partial one
+        if (!m_loaded && batch.type != batch_t::Snapshot) return;
+        if (batch.type == batch_t::Snapshot)
+        {
+            m_bids.clear();
+            m_offers.clear();
+            m_loaded = true;
+        }
+        for (auto const& change : batch.changes)
+        {
+            auto & side = change.side == Side::Bid ? m_bids : m_offers;
+            if (change.size == 0) { side.erase(change.price); }
+            else { side[change.price] = change.size; }
+        }
+        ++m_sequence;
+        encode(batch);
+
+        // closing clients changes m_connected
+        std::vector<client_ptr> clients(m_connected);
+        for (auto const& client : clients)
+        {
+            if (!client->conflating
+                && client->queued.size() + m_message.size()
+                    > m_options.maxBuffered)
+            {
+                if (m_options.slowClient == FanoutOptions::Disconnect)
+                {
+                    ++m_disconnected;
+                    close(client);
+                    continue;
+                }
+                client->conflating = true;
+            }
+            if (client->conflating)
+            {
+                if (!client->conflator.merge(client->pending, batch))
+                {
+                    client->pending = batch;
+                    client->conflator.reset();
+                }
+            }
+            else
+            {
+                client->queued.insert(client->queued.end(),
+                                      m_message.begin(), m_message.end());
+            }
+            flush(client);
+        }
+    }
+
+    // writes whatever the client has waiting, unless already writing
+    void flush(client_ptr const& client)
+    {
+        if (client->closed || !client->writing.empty()) return;
+        if (client->queued.empty() && client->conflating)
+        {
+            // not into m_message, which send() may still be sending
+            Conflator<Price, Size>::settle(client->pending);
+            encode(client->pending, client->queued);
+            client->pending.clear();
+            client->conflator.reset();
+            client->conflating = false;
+        }
+        if (client->queued.empty()) return;
+        std::swap(client->writing, client->queued);
+        boost::asio::async_write(client->socket,
+            boost::asio::buffer(client->writing),
+            [this, client](boost::system::error_code const& error, size_t)
+            {
+                if (error) { close(client); return; }
+                client->writing.clear();
+                flush(client);
+            });
+    }
+
+    // encodes `batch` into `message`, by default m_message, numbered with
+    // the latest sequence
+    void encode(batch_t const& batch)
+    {
+        encode(batch, m_message);
+    }
+    void encode(batch_t const& batch, std::vector<char> & message)
+    {
+        message.resize(wire::Encoder::encodedLength(batch.changes.size()));
+        message.resize(
+            wire::encode(batch, m_sequence, m_productId, message.data()));
+    }
+
+    void encodeSnapshot()
+    {
+        batch_t snapshot;
+        snapshot.type = batch_t::Snapshot;
+        snapshot.changes.reserve(m_bids.size() + m_offers.size());
+        for (auto const& level : m_bids)
+            snapshot.changes.push_back(
+                { Side::Bid, level.first, level.second });
+        for (auto const& level : m_offers)
+            snapshot.changes.push_back(
+                { Side::Offer, level.first, level.second });
+        encode(snapshot);
+    }
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_FANOUT_SERVER_HPP
@@ -0,0 +1,33 @@
+#ifndef GDAX_ORDERBOOK_FEED_HPP
+#define GDAX_ORDERBOOK_FEED_HPP
+
+#include <cstddef>
+#include <functional>
+
+namespace gdax {
+
+/**
+ * A source of a book's changes other than the GDAX WebSocket feed, e.g. a
+ * gdax::MulticastSubscriber; see BasicGDAXOrderBook's constructor taking
+ * one.  The book calls run() on a thread of its own, which should pass each
+ * batch of changes, in order, to `apply`, starting with a snapshot, until
+ * stop() is called, from another thread, and then return.  A later
+ * snapshot resynchronizes the book, replacing all of its levels.
+ *
+ * A threadless book (see BasicGDAXOrderBook::threadless()) instead calls
+ * poll() from its pump(), which should do the same for whatever is ready,
+ * without blocking, and return the number of events it handled.
+ */
+template<typename Batch>
+class Feed
+{
+public:
+    virtual ~Feed() {}
+    virtual void run(std::function<void(Batch const&)> apply) = 0;
+    virtual size_t poll(std::function<void(Batch const&)> apply) = 0;
+    virtual void stop() = 0;
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_FEED_HPP
@@ -0,0 +1,337 @@
+#ifndef GDAX_ORDERBOOK_FILL_SIMULATOR_HPP
+#define GDAX_ORDERBOOK_FILL_SIMULATOR_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "gdax-orderbook/change-batch.hpp"
+
+namespace gdax {
+
+/**
+ * How a FillSimulator attributes a decrease in the size of a level, where
+ * one of its orders rests, to the orders queued ahead of it or behind it,
+ * which the feed's levels do not tell apart:
+ *
+ * - RiskAverse: to those behind, as far as there are any, so that the
+ *   queue ahead shrinks only when the level shrinks below it;
+ * - Proportional: to both, in proportion to the size of each;
+ * - Optimistic: to those ahead, so that the queue ahead shrinks by the
+ *   whole of each decrease, and, once it is gone, the order fills by what
+ *   decreases beyond it, as if every decrease were a trade.
+ */
+enum class QueueModel { RiskAverse, Proportional, Optimistic };
+
+/**
+ * Simulates the fills of virtual limit orders against a recorded book, for
+ * backtesting, e.g. replaying a gdax::store tick store with
+ * `reader.replay<Price, Size>(0, [&](int64_t time, uint64_t, batch_t const&
+ * batch) { simulator.apply(time, batch); strategy(simulator); })`.
+ *
+ * The simulator keeps its own copy of the book, as the batches change it.
+ * An order placed at a price the other side has reached fills at once,
+ * taking the liquidity of that side's levels up to its price; the rest of
+ * it rests at its price, behind the size the level then has, its estimated
+ * queue ahead, which the level's decreases shrink, as the QueueModel says,
+ * and which orders joining the level later do not add to.  A resting order
+ * fills in full once the other side quotes a level at or through its price,
+ * and, with the Optimistic model, in part as its own level shrinks beyond
+ * its queue ahead.
+ *
+ * Orders are virtual: their fills take nothing from the levels they fill
+ * against, and each order's queue is estimated as if it were the only one
+ * at its price.  Each change costs a lookup in the copy of its side, and
+ * one in the orders of that side, if it has any.
+ */
+template<typename Price, typename Size>
+class FillSimulator
+{
+public:
+    using batch_t = ChangeBatch<Price, Size>;
+
+    struct Fill
+    {
+        uint64_t order;
+        Side side;
+        Price price;
+        Size size;
+        Size remaining; // of the order, after this fill
+        bool taker;     // whether it filled on placing, taking liquidity
+        int64_t time;   // of the batch that filled it, or last applied
+    };
+
+    /** An order resting on the book. */
+    struct Order
+    {
+        uint64_t id;
+        Size remaining;
+        Size ahead; // estimated size queued ahead of it
+    };
+
+    explicit FillSimulator(std::function<void(Fill const&)> onFill,
+                           QueueModel model = QueueModel::Proportional)
+        : m_onFill(std::move(onFill)), m_model(model)
+    {}
+
+    /**
+     * Places an order to buy (Side::Bid) or sell `size` at `price`, filling
+     * what it can at once, and returns its id, by which to cancel() what is
+     * left of it.
+     */
+    uint64_t place(Side side, Price price, Size size)
+    {
+        uint64_t const id = ++m_lastId;
+        Order order = { id, size, 0 };
+        if (side == Side::Bid)
+        {
+            take(Side::Bid, order, m_offers.begin(), m_offers.end(),
+                 [price](Price offer) { return offer <= price; });
+            rest(Side::Bid, price, order, m_bids, m_bidOrders);
+        }
+        else
+        {
+            take(Side::Offer, order, m_bids.begin(), m_bids.end(),
+                 [price](Price bid) { return bid >= price; });
+            rest(Side::Offer, price, order, m_offers, m_offerOrders);
+        }
+        return id;
+    }
+
+    /** Cancels what is left of an order, returning false if nothing is. */
+    bool cancel(uint64_t id)
+    {
+        auto resting = m_resting.find(id);
+        if (resting == m_resting.end()) return false;
+        if (resting->second.first == Side::Bid)
+            remove(m_bidOrders, resting->second.second, id);
+        else
+            remove(m_offerOrders, resting->second.second, id);
+        m_resting.erase(resting);
+        return true;
+    }
+
+    /** The order `id`, if it is still resting, or null. */
+    Order const* order(uint64_t id) const
+    {
+        auto resting = m_resting.find(id);
+        if (resting == m_resting.end()) return nullptr;
+        auto const& orders = resting->second.first == Side::Bid
+            ? m_bidOrders.find(resting->second.second)->second
+            : m_offerOrders.find(resting->second.second)->second;
+        for (auto const& order : orders)
+            if (order.id == id) return &order;
+        return nullptr;
+    }
+
+    /** The number of orders resting. */
+    size_t resting() const { return m_resting.size(); }
+
+    /**
+     * Applies a batch of the book's changes, at `time`, reporting the fills
+     * it brings to the orders resting.
+     */
+    void apply(int64_t time, batch_t const& batch)
+    {
+        m_time = time;
+        if (batch.type == batch_t::Snapshot)
+        {
+            m_bids.clear();
+            m_offers.clear();
+            for (auto const& change : batch.changes)
+            {
+                if (change.size == 0) continue;
+                if (change.side == Side::Bid)
+                    m_bids[change.price] = change.size;
+                else
+                    m_offers[change.price] = change.size;
+            }
+            requeue(m_bids, m_bidOrders);
+            requeue(m_offers, m_offerOrders);
+            if (!m_offers.empty())
+                fillReached(Side::Bid, m_offers.begin()->first, m_bidOrders);
+            if (!m_bids.empty())
+                fillReached(Side::Offer, m_bids.begin()->first, m_offerOrders);
+        }
+        else if (batch.type == batch_t::Update)
+        {
+            for (auto const& change : batch.changes)
+            {
+                if (change.side == Side::Bid)
+                {
+                    update(Side::Bid, change, m_bids, m_bidOrders);
+                    if (change.size != 0 && !m_offerOrders.empty())
+                        fillReached(Side::Offer, change.price, m_offerOrders);
+                }
+                else
+                {
+                    update(Side::Offer, change, m_offers, m_offerOrders);
+                    if (change.size != 0 && !m_bidOrders.empty())
+                        fillReached(Side::Bid, change.price, m_bidOrders);
+                }
+            }
+        }
+    }
+
+private:
+    using bids_t = std::map<Price, Size, std::greater<Price>>;
+    using offers_t = std::map<Price, Size>;
+    using queue_t = std::vector<Order>;
+    using bid_orders_t = std::map<Price, queue_t, std::greater<Price>>;
+    using offer_orders_t = std::map<Price, queue_t>;
+
+    std::function<void(Fill const&)> m_onFill;
+    QueueModel const m_model;
+
+    bids_t m_bids;      // the book, best first
+    offers_t m_offers;
+    bid_orders_t m_bidOrders; // resting, by price, best first
+    offer_orders_t m_offerOrders;
+    std::unordered_map<uint64_t, std::pair<Side, Price>> m_resting;
+    uint64_t m_lastId = 0;
+    int64_t m_time = 0;
+
+    void fill(uint64_t id, Side side, Price price, Size size,
+              Size remaining, bool taker)
+    {
+        m_onFill({ id, side, price, size, remaining, taker, m_time });
+    }
+
+    // fills a new order against the other side's levels it reaches
+    template<typename Level, typename Reaches>
+    void take(Side side, Order & order, Level level, Level end,
+              Reaches reaches)
+    {
+        for ( ; level != end && order.remaining > 0
+              && reaches(level->first) ; ++level)
+        {
+            Size const size = std::min(order.remaining, level->second);
+            order.remaining -= size;
+            fill(order.id, side, level->first, size, order.remaining, true);
+        }
+    }
+
+    template<typename Book, typename Orders>
+    void rest(Side side, Price price, Order & order, Book const& book,
+              Orders & orders)
+    {
+        if (order.remaining <= 0) return;
+        auto level = book.find(price);
+        order.ahead = level == book.end() ? 0 : level->second;
+        orders[price].push_back(order);
+        m_resting[order.id] = std::make_pair(side, price);
+    }
+
+    template<typename Orders>
+    static void remove(Orders & orders, Price price, uint64_t id)
+    {
+        auto level = orders.find(price);
+        queue_t & queue = level->second;
+        queue.erase(std::find_if(queue.begin(), queue.end(),
+            [id](Order const& order) { return order.id == id; }));
+        if (queue.empty()) orders.erase(level);
+    }
+
+    template<typename Book, typename Orders>
+    void update(Side side, Change<Price, Size> const& change, Book & book,
+                Orders & orders)
+    {
+        Size before = 0;
+        auto level = book.find(change.price);
+        if (level != book.end())
+        {
+            before = level->second;
+            if (change.size == 0) { book.erase(level); }
+            else { level->second = change.size; }
+        }
+        else if (change.size != 0)
+        {
+            book.emplace(change.price, change.size);
+        }
+
+        if (orders.empty() || change.size >= before) return;
+        auto queue = orders.find(change.price);
+        if (queue == orders.end()) return;
+        shrink(side, change.price, queue->second, before, change.size);
+        if (queue->second.empty()) orders.erase(queue);
+    }
+
+    // moves the orders of a level that shrank from `before` to `after` up
+    // its queue, as the model says, filling them as it allows
+    void shrink(Side side, Price price, queue_t & queue, Size before,
+                Size after)
+    {
+        Size const decrease = before - after;
+        for (auto order = queue.begin() ; order != queue.end() ; )
+        {
+            Size fromAhead;
+            switch (m_model)
+            {
+            case QueueModel::RiskAverse:
+                fromAhead = std::max<Size>(order->ahead - after, 0);
+                break;
+            case QueueModel::Proportional:
+                fromAhead = decrease*order->ahead/before;
+                break;
+            default:
+                fromAhead = decrease;
+                break;
+            }
+            Size const beyond = fromAhead - order->ahead;
+            order->ahead = std::min<Size>(
+                std::max<Size>(order->ahead - fromAhead, 0), after);
+            if (beyond > 0)
+            {
+                Size const size = std::min(beyond, order->remaining);
+                order->remaining -= size;
+                fill(order->id, side, price, size, order->remaining, false);
+                if (order->remaining <= 0)
+                {
+                    m_resting.erase(order->id);
+                    order = queue.erase(order);
+                    continue;
+                }
+            }
+            ++order;
+        }
+    }
+
+    // after a snapshot, no order has more ahead of it than its level holds
+    template<typename Book, typename Orders>
+    static void requeue(Book const& book, Orders & orders)
+    {
+        for (auto & queue : orders)
+        {
+            auto level = book.find(queue.first);
+            Size const size = level == book.end() ? 0 : level->second;
+            for (auto & order : queue.second)
+                order.ahead = std::min(order.ahead, size);
+        }
+    }
+
+    // fills in full the resting orders of one side at or through `price`,
+    // quoted by the other; the orders are best first, by their key_comp()
+    template<typename Orders>
+    void fillReached(Side side, Price price, Orders & orders)
+    {
+        while (!orders.empty()
+               && !orders.key_comp()(price, orders.begin()->first))
+        {
+            for (auto const& order : orders.begin()->second)
+            {
+                m_resting.erase(order.id);
+                fill(order.id, side, orders.begin()->first, order.remaining,
+                     0, false);
+            }
+            orders.erase(orders.begin());
+        }
+    }
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_FILL_SIMULATOR_HPP
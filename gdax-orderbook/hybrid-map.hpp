@@ -0,0 +1,452 @@
+#ifndef GDAX_ORDERBOOK_HYBRID_MAP_HPP
+#define GDAX_ORDERBOOK_HYBRID_MAP_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <cds/container/skip_list_map_hp.h>
+#include <cds/gc/hp.h>
+
+namespace gdax {
+
+/**
+ * An ordered price->quantity map for one side of a book, combining a dense,
+ * tick-indexed window of `WindowTicks` price levels starting at (just
+ * better than) the touch, where nearly all updates land and take O(1), with
+ * a cds::container::SkipListMap holding the sparse tail of the book beyond
+ * the window.  As the touch moves, the window is re-anchored and the levels
+ * crossing its far edge migrate between it and the tail.
+ *
+ * It offers the subset of the SkipListMap interface the book uses
+ * (insert(), update(), erase(), contains(), begin() and end()), so it can
+ * stand in for it as `bids`/`offers`; see gdax::HybridStorage.
+ *
+ * Only one thread may modify the map at a time, which the book guarantees,
+ * but any number may read it concurrently: each window slot is a seqlock,
+ * so readers never block the writer and never see a torn level.  As with
+ * SkipListMap, iteration concurrent with modification is not a snapshot,
+ * and, more so than with SkipListMap, may miss the few levels migrating
+ * between window and tail while it runs.
+ *
+ * `Compare` must be std::less (offers) or std::greater (bids), and `Key`
+ * an unsigned integer number of ticks.
+ */
+template<typename Key,
+         typename Value,
+         typename Compare,
+         size_t WindowTicks = 2048>
+class HybridMap
+{
+    static_assert(std::is_unsigned<Key>::value, "Key must be unsigned ticks");
+    static_assert(WindowTicks >= 64 && (WindowTicks & (WindowTicks-1)) == 0,
+                  "WindowTicks must be a power of two, at least 64");
+    static_assert(std::is_same<Compare, std::less<Key>>::value
+                  || std::is_same<Compare, std::greater<Key>>::value,
+                  "Compare must be std::less or std::greater");
+
+    static constexpr bool descending =
+        std::is_same<Compare, std::greater<Key>>::value;
+
+    /**
+     * Positions along the book, increasing away from the touch on both
+     * sides, widened so that arithmetic on them near the ends of the range
+     * of Key cannot overflow.
+     */
+    using Rank = uint64_t;
+    static Rank rank(Key key)
+    {
+        return descending ? Rank(std::numeric_limits<Key>::max()) - key : key;
+    }
+    static Key keyOf(Rank r)
+    {
+        return descending ? Key(std::numeric_limits<Key>::max() - r) : Key(r);
+    }
+
+    using tail_t = cds::container::SkipListMap<
+        cds::gc::HP, Key, Value,
+        typename cds::container::skip_list::make_traits<
+            cds::opt::less<Compare>>::type>;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+
+    HybridMap()
+        : m_anchor(0),
+          m_anchored(false),
+          m_size(0),
+          m_slots(WindowTicks),
+          m_occupied(WindowTicks/64, 0)
+    {}
+
+    HybridMap(HybridMap const&) = delete;
+    HybridMap& operator=(HybridMap const&) = delete;
+
+    /**
+     * Forward iterator over the levels, best first, yielding copies of the
+     * levels as they were when the iterator reached them.
+     */
+    class iterator
+    {
+    public:
+        iterator() : m_map(nullptr), m_position(0), m_inTail(false) {}
+
+        iterator(iterator const& other) { *this = other; }
+        iterator& operator=(iterator const& other)
+        {
+            m_map = other.m_map;
+            m_anchor = other.m_anchor;
+            m_position = other.m_position;
+            m_inTail = other.m_inTail;
+            m_tail = other.m_tail;
+            m_level = other.m_level;
+            if (m_map)
+            {
+                m_current = m_inTail ? &*m_tail
+                    : reinterpret_cast<value_type const*>(&m_level);
+            }
+            return *this;
+        }
+
+        value_type const& operator*() const { return *m_current; }
+        value_type const* operator->() const { return m_current; }
+
+        iterator& operator++() { advance(); return *this; }
+
+        bool operator==(iterator const& other) const
+        {
+            return m_map == other.m_map
+                && (m_map == nullptr
+                    || (m_inTail == other.m_inTail
+                        && m_position == other.m_position
+                        && (!m_inTail || m_tail == other.m_tail)));
+        }
+        bool operator!=(iterator const& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        friend class HybridMap;
+
+        HybridMap* m_map;    // nullptr at end()
+        Rank m_anchor;       // of the window, as it was at begin()
+        size_t m_position;   // in the window, while not yet in the tail
+        bool m_inTail;
+        typename tail_t::iterator m_tail;
+        value_type const* m_current;
+        // storage for the copy of a window level that m_current points to
+        typename std::aligned_storage<sizeof(value_type),
+                                      alignof(value_type)>::type m_level;
+
+        explicit iterator(HybridMap* map)
+            : m_map(map),
+              m_anchor(map->m_anchor.load(std::memory_order_acquire)),
+              m_position(0),
+              m_inTail(false)
+        {
+            if (!map->m_anchored.load(std::memory_order_acquire))
+                m_position = WindowTicks;
+            seek();
+        }
+
+        bool readSlot()
+        {
+            Rank const r = m_anchor + m_position;
+            Value value;
+            if (!m_map->m_slots[r & (WindowTicks-1)].read(r, value))
+                return false;
+            m_current = new (&m_level) value_type(keyOf(r), value);
+            return true;
+        }
+
+        // moves to the first level at or after the current position
+        void seek()
+        {
+            if (!m_inTail)
+            {
+                for ( ; m_position < WindowTicks ; ++m_position)
+                {
+                    if (readSlot()) return;
+                }
+                m_inTail = true;
+                m_tail = m_map->m_tail.begin();
+            }
+            // skip any levels that were within the window when we began
+            Rank const windowEnd = m_anchor + WindowTicks;
+            while (m_tail != m_map->m_tail.end()
+                   && rank(m_tail->first) < windowEnd)
+            {
+                ++m_tail;
+            }
+            if (m_tail == m_map->m_tail.end()) { m_map = nullptr; }
+            else { m_current = &*m_tail; }
+        }
+
+        void advance()
+        {
+            if (m_inTail) { ++m_tail; }
+            else { ++m_position; }
+            seek();
+        }
+    };
+    using const_iterator = iterator;
+
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+    bool empty() const { return size() == 0; }
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+    bool contains(Key const& key)
+    {
+        Rank const r = rank(key);
+        Value value;
+        if (inWindow(r))
+            return m_slots[r & (WindowTicks-1)].read(r, value);
+        return m_tail.contains(key);
+    }
+
+    bool insert(Key const& key, Value const& value)
+    {
+        return update(key,
+            [&value](bool & bNew, value_type & pair)
+            {
+                if (bNew) pair.second = value;
+            }).second;
+    }
+
+    /**
+     * Calls func(bool & bNew, value_type & level) on the level at `key`,
+     * inserting it first, with bNew set, if it is absent and `allowInsert`.
+     * Returns whether the level exists now, and whether it was inserted.
+     */
+    template<typename Func>
+    std::pair<bool, bool> update(Key const& key, Func func,
+                                 bool allowInsert = true)
+    {
+        Rank const r = rank(key);
+        if (!m_anchored.load(std::memory_order_relaxed)
+            || r < m_anchor.load(std::memory_order_relaxed))
+        {
+            if (!allowInsert) return std::make_pair(false, false);
+            // the touch moved (or first appeared) outside the window
+            reanchor(anchorFor(r));
+        }
+        if (!inWindow(r))
+        {
+            auto result = m_tail.update(key, func, allowInsert);
+            if (result.second) m_size.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        size_t const index = r & (WindowTicks-1);
+        bool bNew = !isOccupied(index);
+        if (bNew && !allowInsert) return std::make_pair(false, false);
+        value_type level(key, bNew ? Value() : m_slots[index].value());
+        func(bNew, level);
+        m_slots[index].write(r, level.second);
+        if (bNew)
+        {
+            setOccupied(index, true);
+            m_size.fetch_add(1, std::memory_order_relaxed);
+        }
+        return std::make_pair(true, bNew);
+    }
+
+    bool erase(Key const& key)
+    {
+        Rank const r = rank(key);
+        if (!inWindow(r))
+        {
+            if (!m_tail.erase(key)) return false;
+            m_size.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        size_t const index = r & (WindowTicks-1);
+        if (!isOccupied(index)) return false;
+        m_slots[index].clear();
+        setOccupied(index, false);
+        m_size.fetch_sub(1, std::memory_order_relaxed);
+
+        // once the touch recedes past the middle of the window, move the
+        // window after it, so the near side of the book stays dense
+        Rank const anchor = m_anchor.load(std::memory_order_relaxed);
+        if (r - anchor <= WindowTicks/2)
+        {
+            size_t const first = firstOccupied();
+            if (first < WindowTicks && first > WindowTicks/2)
+                reanchor(anchorFor(anchor + first));
+            else if (first == WindowTicks && m_tail.begin() != m_tail.end())
+                reanchor(anchorFor(rank(m_tail.begin()->first)));
+        }
+        return true;
+    }
+
+private:
+    /**
+     * A level of the window, written by the one writer and read by anyone,
+     * guarded by a sequence number that is odd while a write is underway.
+     */
+    struct Slot
+    {
+        std::atomic<uint32_t> sequence;
+        std::atomic<Rank> rank;
+        std::atomic<Value> value_;
+
+        Slot() : sequence(0), rank(0), value_(Value()) {}
+
+        Value value() const { return value_.load(std::memory_order_relaxed); }
+
+        void write(Rank r, Value v)
+        {
+            uint32_t s = sequence.load(std::memory_order_relaxed);
+            sequence.store(s + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            rank.store(r, std::memory_order_relaxed);
+            value_.store(v, std::memory_order_relaxed);
+            sequence.store(s + 2, std::memory_order_release);
+        }
+
+        // a rank that no key maps to marks an empty slot
+        void clear() { write(std::numeric_limits<Rank>::max(), Value()); }
+
+        bool read(Rank r, Value & v) const
+        {
+            for (;;)
+            {
+                uint32_t s = sequence.load(std::memory_order_acquire);
+                if (s & 1) continue;
+                Rank slotRank = rank.load(std::memory_order_relaxed);
+                v = value_.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence.load(std::memory_order_relaxed) == s)
+                    return slotRank == r;
+            }
+        }
+    };
+
+    std::atomic<Rank> m_anchor;   // of the first level of the window
+    std::atomic<bool> m_anchored; // whether the window has been placed yet
+    std::atomic<size_t> m_size;
+    std::vector<Slot> m_slots;    // by rank modulo WindowTicks
+    std::vector<uint64_t> m_occupied; // writer-only bitmap of m_slots
+    tail_t m_tail;
+
+    bool inWindow(Rank r) const
+    {
+        Rank anchor = m_anchor.load(std::memory_order_relaxed);
+        return m_anchored.load(std::memory_order_relaxed)
+            && r >= anchor && r - anchor < WindowTicks;
+    }
+
+    // leaves room in the window for the touch to improve a little
+    static Rank anchorFor(Rank bestRank)
+    {
+        return bestRank > WindowTicks/8 ? bestRank - WindowTicks/8 : 0;
+    }
+
+    bool isOccupied(size_t index) const
+    {
+        return (m_occupied[index/64] >> (index%64)) & 1;
+    }
+
+    void setOccupied(size_t index, bool occupied)
+    {
+        if (occupied) m_occupied[index/64] |= uint64_t(1) << (index%64);
+        else m_occupied[index/64] &= ~(uint64_t(1) << (index%64));
+    }
+
+    /**
+     * Offset from the anchor of the first occupied slot, i.e. of the touch,
+     * or WindowTicks if the window is empty.
+     */
+    size_t firstOccupied() const
+    {
+        size_t const start = m_anchor.load(std::memory_order_relaxed);
+        for (size_t offset = 0 ; offset < WindowTicks ; )
+        {
+            size_t index = (start + offset) & (WindowTicks-1);
+            uint64_t word = m_occupied[index/64] >> (index%64);
+            if (word) return offset + __builtin_ctzll(word);
+            offset += 64 - index%64;
+        }
+        return WindowTicks;
+    }
+
+    /**
+     * Moves the window to start at rank `anchor`, migrating levels to the
+     * tail before they leave the window, and into the window before they
+     * leave the tail, so that each is always in at least one of the two.
+     */
+    void reanchor(Rank anchor)
+    {
+        if (!m_anchored.load(std::memory_order_relaxed))
+        {
+            m_anchor.store(anchor, std::memory_order_release);
+            m_anchored.store(true, std::memory_order_release);
+            return;
+        }
+        Rank const old = m_anchor.load(std::memory_order_relaxed);
+        if (anchor < old)
+        {
+            // levels at the far end of the window move out to the tail
+            for (Rank r = std::max(old, anchor + WindowTicks) ;
+                 r < old + WindowTicks ; ++r)
+            {
+                size_t index = r & (WindowTicks-1);
+                if (!isOccupied(index)) continue;
+                m_tail.insert(keyOf(r), m_slots[index].value());
+                m_slots[index].clear();
+                setOccupied(index, false);
+            }
+            m_anchor.store(anchor, std::memory_order_release);
+        }
+        else if (anchor > old)
+        {
+            // levels of the tail now within the window move into it; the
+            // near end of the window being vacated is empty already
+            std::vector<Key> moved;
+            Rank const end = anchor + WindowTicks;
+            for (auto level = m_tail.begin() ; level != m_tail.end() ; ++level)
+            {
+                Rank r = rank(level->first);
+                if (r >= end) break;
+                if (r < anchor) continue;
+                size_t index = r & (WindowTicks-1);
+                m_slots[index].write(r, level->second);
+                setOccupied(index, true);
+                moved.push_back(level->first);
+            }
+            m_anchor.store(anchor, std::memory_order_release);
+            for (Key key : moved) m_tail.erase(key);
+        }
+    }
+};
+
+/**
+ * Storage for BasicGDAXOrderBook that uses a HybridMap for each side, with
+ * a dense window of `WindowTicks` ticks (cents) at the touch.
+ */
+template<size_t WindowTicks = 2048>
+struct HybridStorage
+{
+    template<typename Price, typename Size>
+    using bids_map = HybridMap<Price, Size, std::greater<Price>, WindowTicks>;
+    template<typename Price, typename Size>
+    using offers_map = HybridMap<Price, Size, std::less<Price>, WindowTicks>;
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_HYBRID_MAP_HPP
@@ -0,0 +1,398 @@
+#ifndef GDAX_ORDERBOOK_IMPLIED_BOOK_HPP
+#define GDAX_ORDERBOOK_IMPLIED_BOOK_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "gdax-orderbook/change-batch.hpp"
+
+namespace gdax {
+
+/**
+ * One leg of an ImpliedBook: a product that converts one currency of the
+ * implied product's chain into the next, as quoted, e.g. ETH-BTC, from ETH
+ * to BTC, or, if `inverse`, the other way round, from its quote currency to
+ * its base, e.g. ETH-BTC from BTC to ETH.  Its book's prices are in ticks
+ * worth `tick` of its quote currency, 10^-BookOptions::priceDecimals, e.g.
+ * 0.01 for a GDAXOrderBook's default cents, which would truncate ETH-BTC's
+ * prices, and 0.00001 for one of ETH-BTC with 5 decimals.
+ */
+struct ImpliedLeg
+{
+    bool inverse;
+    double tick;
+
+    ImpliedLeg(bool inverse = false, double tick = 0.01)
+        : inverse(inverse), tick(tick)
+    {}
+};
+
+/**
+ * The implied, or synthetic, book of a product A-C from the books of two
+ * legs that chain its currencies, A to B and B to C, e.g. ETH-USD from
+ * ETH-BTC and BTC-USD, or BTC-USD from ETH-BTC, inverse, and ETH-USD.  The
+ * implied book is a `Book` of its own, e.g. GDAXOrderBook, threadless and
+ * with no feed, read exactly as the legs are: its bids and offers maps,
+ * readiness(), addListener(), addTrigger().  Each leg's batches are passed
+ * to apply(), from its listener, e.g. `ethBtc.addListener([&](GDAXOrderBook
+ * ::batch_t const& batch) { implied.apply(0, batch); });`, whether or not
+ * the leg is loaded yet, as a listener's first batch is its book's
+ * snapshot.  The book loads, with a snapshot, once both legs have had one.
+ *
+ * The implied levels are what sweeping both legs at once would get: an
+ * implied bid sells A for B at the first leg's bids (or buys at its offers,
+ * if inverse), then that B for C at the second's, level by level, each step
+ * taking the lesser of the two levels' liquidity left, at the product of
+ * their prices, rounded to ticks worth `tick` of C, down for bids and up
+ * for offers; steps rounding to the same price add up to one level, sized
+ * in A.  Only the best `levels` implied levels of each side are kept, and
+ * so only the legs' levels their steps reach matter.
+ *
+ * Rather than sweeping the legs afresh on every change, the implied book
+ * keeps a copy of each leg, and the steps of each side's sweep, with where
+ * in each leg each began.  A change to a leg can only affect the steps from
+ * the first that reached its level on, so the sweep resumes from there, and
+ * only the implied levels that then differ are applied to the book, as one
+ * update per leg batch.  A change beyond the levels the sweeps reach costs
+ * a lookup in the leg's copy and one among the steps.
+ */
+template<typename Book>
+class ImpliedBook
+{
+public:
+    using Price = typename Book::Price;
+    using Size = typename Book::Size;
+    using batch_t = typename Book::batch_t;
+
+    ImpliedBook(ImpliedLeg const& first, ImpliedLeg const& second,
+                size_t levels = 10, double tick = 0.01)
+        : m_levels(levels), m_tick(tick), m_book(Book::threadless())
+    {
+        m_legs[0].spec = first;
+        m_legs[1].spec = second;
+    }
+
+    /** As above, with options, e.g. gdax::BookOptions, for the book. */
+    template<typename Options>
+    ImpliedBook(ImpliedLeg const& first, ImpliedLeg const& second,
+                size_t levels, double tick, Options const& options)
+        : m_levels(levels), m_tick(tick), m_book(Book::threadless(options))
+    {
+        m_legs[0].spec = first;
+        m_legs[1].spec = second;
+    }
+
+    /** The implied book, to read; only apply() writes to it. */
+    Book & book() { return *m_book; }
+
+    /**
+     * Applies a batch of the first `leg`'s, 0, or the second's, 1, and the
+     * changes it brings to the implied levels.  Safe to call from any
+     * thread, e.g. from each leg's own, one at a time.
+     */
+    void apply(size_t leg, batch_t const& batch)
+    {
+        if (batch.type == batch_t::None) return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Leg & changed = m_legs[leg];
+        bool const snapshot = batch.type == batch_t::Snapshot;
+        if (snapshot)
+        {
+            changed.bids.clear();
+            changed.offers.clear();
+            changed.loaded = true;
+        }
+        // the best price changed on each side of the leg, bids then offers
+        bool moved[2] = { snapshot, snapshot };
+        Price best[2] = { 0, 0 };
+        for (auto const& change : batch.changes)
+        {
+            size_t const side = change.side == Side::Bid ? 0 : 1;
+            side_t & levels = side == 0 ? changed.bids : changed.offers;
+            if (change.size == 0) { levels.erase(change.price); }
+            else { levels[change.price] = change.size; }
+            if (!snapshot && (!moved[side]
+                              || levels.key_comp()(change.price, best[side])))
+            {
+                moved[side] = true;
+                best[side] = change.price;
+            }
+        }
+        if (!m_legs[0].loaded || !m_legs[1].loaded) return;
+
+        m_changes.clear();
+        for (auto & sweep : m_sweeps)
+        {
+            size_t const side = &sideOf(leg, sweep.side) == &changed.bids
+                ? 0 : 1;
+            if (!m_loaded || moved[side])
+                resweep(sweep, leg, snapshot || !m_loaded, best[side]);
+        }
+        if (!m_loaded)
+        {
+            m_loaded = true;
+            typename Book::levels_t bidLevels(m_sweeps[0].levels.begin(),
+                                              m_sweeps[0].levels.end());
+            typename Book::levels_t offerLevels(m_sweeps[1].levels.begin(),
+                                                m_sweeps[1].levels.end());
+            m_book->applySnapshot(std::move(bidLevels),
+                                  std::move(offerLevels));
+        }
+        else if (!m_changes.empty())
+        {
+            m_book->applyChanges(m_changes.data(), m_changes.size());
+        }
+    }
+
+private:
+    // orders the levels of a side, best first
+    struct Order
+    {
+        bool descending;
+        bool operator()(Price a, Price b) const
+        {
+            return descending ? b < a : a < b;
+        }
+    };
+    using side_t = std::map<Price, Size, Order>;
+
+    struct Leg
+    {
+        ImpliedLeg spec;
+        side_t bids{ Order{ true } };
+        side_t offers{ Order{ false } };
+        bool loaded = false;
+    };
+
+    // where in a leg a step began: its level, unless past the last, and
+    // how much of it earlier steps took, in the currency the leg converts
+    struct Position
+    {
+        bool past;
+        Price price;
+        Size taken;
+    };
+
+    struct Step
+    {
+        Position at[2]; // in each leg
+        Price price;
+        Size size;
+        size_t level;   // of the implied side, 0 being the best
+    };
+
+    struct Sweep
+    {
+        Side side;
+        std::vector<Step> steps;
+        Position end[2]; // where the steps stopped
+        side_t levels;   // as applied to the book
+    };
+
+    size_t const m_levels;
+    double const m_tick;
+    std::unique_ptr<Book> m_book;
+
+    std::mutex m_mutex; // guards the rest
+    Leg m_legs[2];
+    Sweep m_sweeps[2] = {
+        { Side::Bid, {}, {}, side_t(Order{ true }) },
+        { Side::Offer, {}, {}, side_t(Order{ false }) } };
+    bool m_loaded = false;
+    std::vector<typename Book::change_t> m_changes;
+
+    // the side of a leg that a side of the implied book sweeps
+    side_t & sideOf(size_t leg, Side side)
+    {
+        Leg & of = m_legs[leg];
+        return (side == Side::Bid) != of.spec.inverse ? of.bids : of.offers;
+    }
+
+    // how much of the next currency a unit of the one the leg converts
+    // gets at `price`
+    double rate(size_t leg, Price price) const
+    {
+        ImpliedLeg const& spec = m_legs[leg].spec;
+        return spec.inverse ? 1/(price*spec.tick) : price*spec.tick;
+    }
+
+    // the liquidity of a leg's level, in the currency the leg converts
+    Size amount(size_t leg, Price price, Size size) const
+    {
+        ImpliedLeg const& spec = m_legs[leg].spec;
+        return spec.inverse ? size*price*spec.tick : size;
+    }
+
+    /**
+     * Resumes a side's sweep from the first step that reached the level at
+     * `best`, the best changed of the side of `leg` it sweeps, or, if
+     * `all`, from its start, and applies the implied levels that differ.
+     */
+    void resweep(Sweep & sweep, size_t leg, bool all, Price best)
+    {
+        side_t const* sides[2] = { &sideOf(0, sweep.side),
+                                   &sideOf(1, sweep.side) };
+        Order const legOrder = sides[leg]->key_comp();
+        std::vector<Step> & steps = sweep.steps;
+        size_t const first = all ? 0 : std::partition_point(
+            steps.begin(), steps.end(), [&](Step const& step)
+            {
+                return legOrder(step.at[leg].price, best);
+            }) - steps.begin();
+
+        Position const* from = first < steps.size()
+            ? steps[first].at : sweep.end;
+        typename side_t::const_iterator level[2];
+        Size taken[2];
+        for (size_t i = 0 ; i < 2 ; ++i)
+        {
+            if (all)
+            {
+                level[i] = sides[i]->begin();
+                taken[i] = 0;
+            }
+            else if (i == leg && (from[i].past
+                                  || !legOrder(from[i].price, best)))
+            {
+                level[i] = sides[i]->lower_bound(best);
+                taken[i] = 0;
+            }
+            else
+            {
+                level[i] = from[i].past ? sides[i]->end()
+                    : sides[i]->find(from[i].price);
+                taken[i] = from[i].taken;
+            }
+        }
+
+        // the implied level of the step before is the first that may change
+        size_t count = 0, unchanged = first;
+        if (first > 0)
+        {
+            count = steps[first - 1].level + 1;
+            while (unchanged > 0
+                   && steps[unchanged - 1].price == steps[first - 1].price)
+            {
+                --unchanged;
+            }
+        }
+        steps.resize(first);
+        sweepFrom(sweep, sides, level, taken, count);
+        publish(sweep, unchanged, first == 0);
+    }
+
+    // appends steps from `level`, with `taken` of each, `count` implied
+    // levels having been reached already
+    void sweepFrom(Sweep & sweep, side_t const* const* sides,
+                   typename side_t::const_iterator * level, Size * taken,
+                   size_t count)
+    {
+        std::vector<Step> & steps = sweep.steps;
+        double const tolerance = 1e-9; // of rounding, relative
+        while (level[0] != sides[0]->end() && level[1] != sides[1]->end())
+        {
+            double const rate0 = rate(0, level[0]->first);
+            double const rate1 = rate(1, level[1]->first);
+            Size const left0 = amount(0, level[0]->first, level[0]->second)
+                - taken[0];
+            Size const left1 = amount(1, level[1]->first, level[1]->second)
+                - taken[1];
+            Size const size = std::min(left0, left1/rate0);
+            double const ticks = sweep.side == Side::Bid
+                ? std::floor(rate0*rate1/m_tick + tolerance)
+                : std::ceil(rate0*rate1/m_tick - tolerance);
+            if (ticks < 1 || ticks > std::numeric_limits<Price>::max())
+                break;
+            Price const price = static_cast<Price>(ticks);
+            if (steps.empty() || steps.back().price != price)
+            {
+                if (count == m_levels) break;
+                ++count;
+            }
+            steps.push_back({ { position(sides[0], level[0], taken[0]),
+                                position(sides[1], level[1], taken[1]) },
+                              price, size, count - 1 });
+
+            if (left0 <= size*(1 + tolerance))
+            {
+                ++level[0];
+                taken[0] = 0;
+            }
+            else
+            {
+                taken[0] += size;
+            }
+            if (left1 <= size*rate0*(1 + tolerance))
+            {
+                ++level[1];
+                taken[1] = 0;
+            }
+            else
+            {
+                taken[1] += size*rate0;
+            }
+        }
+        for (size_t i = 0 ; i < 2 ; ++i)
+            sweep.end[i] = position(sides[i], level[i], taken[i]);
+    }
+
+    static Position position(side_t const* side,
+                             typename side_t::const_iterator level,
+                             Size taken)
+    {
+        return level == side->end() ? Position{ true, 0, 0 }
+            : Position{ false, level->first, taken };
+    }
+
+    // sets the implied levels from that of step `from` on, or all of them,
+    // if `whole`, to the steps', queueing the changes for the book
+    void publish(Sweep & sweep, size_t from, bool whole)
+    {
+        std::vector<Step> const& steps = sweep.steps;
+        side_t & levels = sweep.levels;
+        auto level = whole ? levels.begin()
+            : levels.lower_bound(steps[from].price);
+        for (size_t step = from ; step < steps.size() ; )
+        {
+            Price const price = steps[step].price;
+            Size size = 0;
+            for ( ; step < steps.size() && steps[step].price == price
+                  ; ++step)
+            {
+                size += steps[step].size;
+            }
+            for ( ; level != levels.end()
+                    && levels.key_comp()(level->first, price) ; )
+            {
+                m_changes.push_back({ sweep.side, level->first, 0 });
+                level = levels.erase(level);
+            }
+            if (level != levels.end() && level->first == price)
+            {
+                if (level->second != size)
+                {
+                    level->second = size;
+                    m_changes.push_back({ sweep.side, price, size });
+                }
+                ++level;
+            }
+            else
+            {
+                levels.emplace_hint(level, price, size);
+                m_changes.push_back({ sweep.side, price, size });
+            }
+        }
+        for ( ; level != levels.end() ; level = levels.erase(level))
+            m_changes.push_back({ sweep.side, level->first, 0 });
+    }
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_IMPLIED_BOOK_HPP
@@ -0,0 +1,333 @@
+#ifndef GDAX_ORDERBOOK_KERNELS_HPP
+#define GDAX_ORDERBOOK_KERNELS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GDAX_ORDERBOOK_X86 1
+#include <immintrin.h>
+#endif
+
+namespace gdax {
+
+/**
+ * Hot kernels of the book, each implemented for several instruction sets,
+ * one of which is selected once, at startup, according to what the CPU
+ * supports (via cpuid), so that one binary, built without -march, runs at
+ * its best on every hardware generation it is deployed to.
+ *
+ * The selection can be overridden with the GDAX_ORDERBOOK_ISA environment
+ * variable (scalar, sse42, avx2 or avx512), or with kernels::force(), which
+ * is how every variant is checked against scalar (see bench --check-kernels).
+ */
+namespace kernels {
+
+enum class Isa { scalar, sse42, avx2, avx512 };
+
+inline const char* name(Isa isa)
+{
+    switch (isa)
+    {
+        case Isa::sse42:  return "sse42";
+        case Isa::avx2:   return "avx2";
+        case Isa::avx512: return "avx512";
+        default:          return "scalar";
+    }
+}
+
+/**
+ * The kernels of one instruction set.
+ *
+ * parseFixed converts a NUL-terminated decimal string of the form
+ * `digits[.digits]` to an integer scaled by 10^decimals, truncating any
+ * further fractional digits, as GDAX prices and sizes are fixed-point.  It
+ * returns false, leaving `out` unspecified, for anything else, including
+ * values that would overflow, in which case callers fall back to strtod().
+ *
+ * lowerBound returns the number of the first `n` of the ascending `keys`
+ * that are less than `key`, i.e. the index of the first that is not, for
+ * the in-node search of gdax::BTreeMap.  It may read keys up to index `n`
+ * rounded up to a multiple of 8, which must therefore be readable.
+ */
+struct Table
+{
+    Isa isa;
+    bool (*parseFixed)(const char* s, unsigned decimals, uint64_t & out);
+    unsigned (*lowerBound)(const uint32_t* keys, unsigned n, uint32_t key);
+};
+
+namespace detail {
+
+// one table for the whole program, as the inline kernels using it are
+inline uint64_t powerOf10(unsigned exponent)
+{
+    static const uint64_t powers[20] = {
+        1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull,
+        10000000ull, 100000000ull, 1000000000ull, 10000000000ull,
+        100000000000ull, 1000000000000ull, 10000000000000ull,
+        100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+        100000000000000000ull, 1000000000000000000ull,
+        10000000000000000000ull };
+    return powers[exponent];
+}
+
+inline bool parseFixedScalar(const char* s, unsigned decimals, uint64_t & out)
+{
+    uint64_t value = 0;
+    unsigned digits = 0, fractionDigits = 0;
+    const char* c = s;
+    for ( ; *c >= '0' && *c <= '9' ; ++c, ++digits)
+    {
+        if (digits + decimals >= 19) return false; // may overflow
+        value = value*10 + (*c - '0');
+    }
+    if (*c == '.')
+    {
+        for (++c ; *c >= '0' && *c <= '9' ; ++c, ++digits)
+        {
+            if (fractionDigits < decimals)
+            {
+                value = value*10 + (*c - '0');
+                ++fractionDigits;
+            }
+        }
+    }
+    if (*c != '\0' || digits == 0) return false;
+    out = value*powerOf10(decimals - fractionDigits);
+    return true;
+}
+
+inline unsigned lowerBoundScalar(const uint32_t* keys, unsigned n,
+                                 uint32_t key)
+{
+    unsigned i = 0;
+    while (i < n && keys[i] < key) ++i;
+    return i;
+}
+
+#ifdef GDAX_ORDERBOOK_X86
+
+/**
+ * Value of the `n` (at most 16) decimal digits starting at byte `offset` of
+ * `digits`, which holds characters already converted to their digit values.
+ */
+__attribute__((target("sse4.2")))
+inline uint64_t digitsValueSse42(__m128i digits, int offset, int n)
+{
+    // right-align the n digits, zeroing the lanes to their left
+    const __m128i iota =
+        _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i shuffle = _mm_add_epi8(iota, _mm_set1_epi8(offset + n - 16));
+    shuffle = _mm_or_si128(shuffle,
+        _mm_cmplt_epi8(iota, _mm_set1_epi8(16 - n)));
+    digits = _mm_shuffle_epi8(digits, shuffle);
+
+    // combine adjacent digits into ever wider lanes: 2, 4, then 8 digits
+    __m128i pairs = _mm_maddubs_epi16(digits,
+        _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1,
+                      10, 1, 10, 1, 10, 1, 10, 1));
+    __m128i quads = _mm_madd_epi16(pairs,
+        _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+    __m128i octets = _mm_madd_epi16(_mm_packus_epi32(quads, quads),
+        _mm_setr_epi16(10000, 1, 10000, 1, 0, 0, 0, 0));
+    return uint64_t(uint32_t(_mm_cvtsi128_si32(octets)))*100000000ull
+        + uint32_t(_mm_extract_epi32(octets, 1));
+}
+
+/**
+ * Locates the terminator and decimal point with two string compares, then
+ * converts both parts in parallel lanes.  Strings of 16 or more bytes, or
+ * near enough to the end of a page that loading 16 bytes could fault, are
+ * left to the scalar kernel.
+ */
+__attribute__((target("sse4.2")))
+inline bool parseFixedSse42(const char* s, unsigned decimals, uint64_t & out)
+{
+    if ((reinterpret_cast<uintptr_t>(s) & 4095) > 4096 - 16)
+        return parseFixedScalar(s, decimals, out);
+
+    const __m128i text = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+    const __m128i digitsAndPoint = _mm_setr_epi8(
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '.', 0, 0, 0, 0, 0);
+    // index of the first byte that is neither a digit nor a point
+    int length = _mm_cmpistri(digitsAndPoint, text,
+        _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_NEGATIVE_POLARITY);
+    if (length == 16) return parseFixedScalar(s, decimals, out);
+    if (s[length] != '\0' || length == 0) return false;
+
+    unsigned points = _mm_movemask_epi8(
+        _mm_cmpeq_epi8(text, _mm_set1_epi8('.'))) & ((1u << length) - 1);
+    int point = points ? __builtin_ctz(points) : length;
+    if (points & (points - 1)) return false; // more than one point
+    if (length == 1 && points) return false; // no digits at all
+    if (point + decimals >= 19) return parseFixedScalar(s, decimals, out);
+
+    int fractionDigits = length - point - 1;
+    if (fractionDigits < 0) fractionDigits = 0;
+    if (fractionDigits > int(decimals)) fractionDigits = decimals;
+
+    const __m128i digits = _mm_sub_epi8(text, _mm_set1_epi8('0'));
+    out = digitsValueSse42(digits, 0, point)*powerOf10(decimals)
+        + digitsValueSse42(digits, point + 1, fractionDigits)
+            *powerOf10(decimals - fractionDigits);
+    return true;
+}
+
+/**
+ * Compares `key` with blocks of 4, 8 or 16 keys at once.  As the keys are
+ * sorted, those less than `key` form a prefix of each block's comparison
+ * mask, whose length is the count of trailing ones; the search stops at the
+ * first block that is not all less.  SSE and AVX2 only compare signed
+ * integers, hence the bias, which maps unsigned order onto signed order.
+ */
+__attribute__((target("sse4.2")))
+inline unsigned lowerBoundSse42(const uint32_t* keys, unsigned n, uint32_t key)
+{
+    const __m128i bias = _mm_set1_epi32(INT32_MIN);
+    const __m128i target = _mm_xor_si128(_mm_set1_epi32(key), bias);
+    unsigned i = 0;
+    for ( ; i < n ; i += 4)
+    {
+        __m128i block = _mm_xor_si128(bias,
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)));
+        unsigned less = _mm_movemask_ps(
+            _mm_castsi128_ps(_mm_cmpgt_epi32(target, block)));
+        if (n - i < 4) less &= (1u << (n - i)) - 1;
+        if (less != 0xf) return i + __builtin_ctz(~less);
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+inline unsigned lowerBoundAvx2(const uint32_t* keys, unsigned n, uint32_t key)
+{
+    const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+    const __m256i target = _mm256_xor_si256(_mm256_set1_epi32(key), bias);
+    unsigned i = 0;
+    for ( ; i < n ; i += 8)
+    {
+        __m256i block = _mm256_xor_si256(bias,
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)));
+        unsigned less = _mm256_movemask_ps(
+            _mm256_castsi256_ps(_mm256_cmpgt_epi32(target, block)));
+        if (n - i < 8) less &= (1u << (n - i)) - 1;
+        if (less != 0xff) return i + __builtin_ctz(~less);
+    }
+    return n;
+}
+
+__attribute__((target("avx512f")))
+inline unsigned lowerBoundAvx512(const uint32_t* keys, unsigned n,
+                                 uint32_t key)
+{
+    const __m512i target = _mm512_set1_epi32(key);
+    unsigned i = 0;
+    for ( ; i < n ; i += 16)
+    {
+        __mmask16 valid = n - i < 16 ? (1u << (n - i)) - 1 : 0xffff;
+        unsigned less = _mm512_mask_cmplt_epu32_mask(valid,
+            _mm512_maskz_loadu_epi32(valid, keys + i), target);
+        if (less != 0xffff) return i + __builtin_ctz(~less);
+    }
+    return n;
+}
+
+#endif // GDAX_ORDERBOOK_X86
+
+inline Table makeTable(Isa isa)
+{
+    Table table = { Isa::scalar, &parseFixedScalar, &lowerBoundScalar };
+#ifdef GDAX_ORDERBOOK_X86
+    if (isa != Isa::scalar)
+    {
+        table.isa = isa;
+        // strings are at most 16 bytes, so the 128-bit parse is also the
+        // best one on wider ISAs
+        table.parseFixed = &parseFixedSse42;
+    }
+    switch (isa)
+    {
+        case Isa::sse42:  table.lowerBound = &lowerBoundSse42;  break;
+        case Isa::avx2:   table.lowerBound = &lowerBoundAvx2;   break;
+        case Isa::avx512: table.lowerBound = &lowerBoundAvx512; break;
+        default: break;
+    }
+#endif
+    return table;
+}
+
+inline bool supported(Isa isa)
+{
+#ifdef GDAX_ORDERBOOK_X86
+    __builtin_cpu_init();
+    switch (isa)
+    {
+        case Isa::scalar: return true;
+        case Isa::sse42:  return __builtin_cpu_supports("sse4.2");
+        case Isa::avx2:   return __builtin_cpu_supports("avx2");
+        case Isa::avx512: return __builtin_cpu_supports("avx512f")
+                              && __builtin_cpu_supports("avx512bw");
+    }
+#endif
+    return isa == Isa::scalar;
+}
+
+inline Isa detect()
+{
+    if (const char* forced = std::getenv("GDAX_ORDERBOOK_ISA"))
+    {
+        for (Isa isa : { Isa::scalar, Isa::sse42, Isa::avx2, Isa::avx512 })
+        {
+            if (std::strcmp(forced, name(isa)) == 0 && supported(isa))
+                return isa;
+        }
+    }
+    for (Isa isa : { Isa::avx512, Isa::avx2, Isa::sse42 })
+    {
+        if (supported(isa)) return isa;
+    }
+    return Isa::scalar;
+}
+
+inline const Table* tables()
+{
+    static const Table tables[] = {
+        makeTable(Isa::scalar), makeTable(Isa::sse42),
+        makeTable(Isa::avx2), makeTable(Isa::avx512) };
+    return tables;
+}
+
+inline std::atomic<const Table*> & active()
+{
+    static std::atomic<const Table*> table(&tables()[int(detect())]);
+    return table;
+}
+
+} // namespace detail
+
+/** The kernels selected for this CPU. */
+inline const Table & table()
+{
+    return *detail::active().load(std::memory_order_relaxed);
+}
+
+/**
+ * Selects the kernels of the given instruction set from now on, returning
+ * false, and changing nothing, if the CPU does not support it.
+ */
+inline bool force(Isa isa)
+{
+    if (!detail::supported(isa)) return false;
+    detail::active().store(&detail::tables()[int(isa)],
+                           std::memory_order_relaxed);
+    return true;
+}
+
+} // namespace kernels
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_KERNELS_HPP
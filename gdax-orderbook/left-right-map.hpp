@@ -0,0 +1,301 @@
+#ifndef GDAX_ORDERBOOK_LEFT_RIGHT_MAP_HPP
+#define GDAX_ORDERBOOK_LEFT_RIGHT_MAP_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gdax {
+
+/**
+ * An ordered price->quantity map for one side of a book, kept twice, as
+ * two plain std::maps, by the left-right technique: readers traverse one
+ * instance while the single writer changes the other, then the writer
+ * switches readers over to the changed instance, waits for those still
+ * reading the old one to finish, and repeats the changes on it.
+ *
+ * Readers are wait-free, and traverse a plain std::map without hazard
+ * pointers or validation, at the cost of every change being made twice,
+ * and of the writer waiting for readers.  Changes are made visible in
+ * batches, by publish(), which the book calls once per feed message, so a
+ * reader sees each message applied either entirely or not at all, and the
+ * switch is paid once per message rather than once per level.
+ *
+ * It offers the subset of the SkipListMap interface the book uses
+ * (insert(), update(), erase(), contains(), begin() and end()), so it can
+ * stand in for it as `bids`/`offers`; see gdax::LeftRightStorage.
+ *
+ * A reader is reading from the construction of an iterator other than
+ * end(), or its copy, until its destruction, so long-lived iterators delay
+ * the writer, and with it the book.
+ */
+template<typename Key, typename Value, typename Compare>
+class LeftRightMap
+{
+    using instance_t = std::map<Key, Value, Compare>;
+
+    // readers announce themselves on one of several counters, chosen per
+    // thread, so that concurrent readers seldom share a cache line
+    static constexpr size_t readerSlots = 16;
+    struct Counter
+    {
+        std::atomic<long> readers;
+        char padding[64 - sizeof(std::atomic<long>)];
+    };
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+
+    LeftRightMap() : m_reading(0), m_version(0)
+    {
+        for (auto & version : m_counters)
+            for (auto & counter : version) counter.readers.store(0);
+    }
+
+    LeftRightMap(LeftRightMap const&) = delete;
+    LeftRightMap& operator=(LeftRightMap const&) = delete;
+
+    /**
+     * Forward iterator over the levels, best first, of the instance readers
+     * were directed to when begin() was called.
+     */
+    class iterator
+    {
+    public:
+        iterator() : m_counter(nullptr) {}
+
+        iterator(iterator const& other)
+            : m_counter(other.m_counter),
+              m_level(other.m_level),
+              m_end(other.m_end)
+        {
+            arrive();
+        }
+        iterator& operator=(iterator const& other)
+        {
+            if (this != &other)
+            {
+                depart();
+                m_counter = other.m_counter;
+                m_level = other.m_level;
+                m_end = other.m_end;
+                arrive();
+            }
+            return *this;
+        }
+        ~iterator() { depart(); }
+
+        value_type const& operator*() const { return *m_level; }
+        value_type const* operator->() const { return &*m_level; }
+
+        iterator& operator++()
+        {
+            if (++m_level == m_end)
+            {
+                depart();
+                m_counter = nullptr;
+            }
+            return *this;
+        }
+
+        bool operator==(iterator const& other) const
+        {
+            return m_counter == nullptr
+                ? other.m_counter == nullptr
+                : other.m_counter != nullptr && m_level == other.m_level;
+        }
+        bool operator!=(iterator const& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        friend class LeftRightMap;
+
+        Counter* m_counter; // arrived at, or nullptr at end()
+        typename instance_t::const_iterator m_level, m_end;
+
+        explicit iterator(LeftRightMap const& map)
+            : m_counter(map.arrive())
+        {
+            instance_t const& levels = map.m_instances[
+                map.m_reading.load(std::memory_order_seq_cst)];
+            m_level = levels.begin();
+            m_end = levels.end();
+            if (m_level == m_end)
+            {
+                depart();
+                m_counter = nullptr;
+            }
+        }
+
+        void arrive()
+        {
+            if (m_counter)
+                m_counter->readers.fetch_add(1, std::memory_order_seq_cst);
+        }
+        void depart()
+        {
+            if (m_counter)
+                m_counter->readers.fetch_sub(1, std::memory_order_release);
+        }
+    };
+    using const_iterator = iterator;
+
+    iterator begin() const { return iterator(*this); }
+    iterator end() const { return iterator(); }
+
+    bool empty() const { return size() == 0; }
+    size_t size() const
+    {
+        return read([](instance_t const& levels) { return levels.size(); });
+    }
+
+    bool contains(Key const& key) const
+    {
+        return read([&key](instance_t const& levels)
+            {
+                return levels.count(key) != 0;
+            });
+    }
+
+    // writer side: changes are made to the instance readers are not
+    // directed to, and logged for the other one, until publish()
+
+    bool insert(Key const& key, Value const& value)
+    {
+        return update(key,
+            [&value](bool & bNew, value_type & pair)
+            {
+                if (bNew) pair.second = value;
+            }).second;
+    }
+
+    /**
+     * Calls func(bool & bNew, value_type & level) on the level at `key`,
+     * inserting it first, with bNew set, if it is absent and `allowInsert`.
+     * Returns whether the level exists now, and whether it was inserted.
+     */
+    template<typename Func>
+    std::pair<bool, bool> update(Key const& key, Func func,
+                                 bool allowInsert = true)
+    {
+        instance_t & levels = writing();
+        auto level = levels.lower_bound(key);
+        bool bNew = level == levels.end() || Compare()(key, level->first);
+        if (bNew)
+        {
+            if (!allowInsert) return std::make_pair(false, false);
+            level = levels.emplace_hint(level, key, Value());
+        }
+        func(bNew, *level);
+        m_log.push_back(Change{ key, level->second, false });
+        return std::make_pair(true, bNew);
+    }
+
+    bool erase(Key const& key)
+    {
+        if (writing().erase(key) == 0) return false;
+        m_log.push_back(Change{ key, Value(), true });
+        return true;
+    }
+
+    /**
+     * Directs readers to the instance changed since the last publish(),
+     * waits for readers of the other to leave, and repeats the changes on
+     * it, so that the two are equal again.
+     */
+    void publish()
+    {
+        if (m_log.empty()) return;
+        int const changed = 1 - m_reading.load(std::memory_order_relaxed);
+        m_reading.store(changed, std::memory_order_seq_cst);
+
+        // readers that arrived before the switch may be on either
+        // instance; once both generations of them have left, none can be
+        // on the other one
+        int const version = m_version.load(std::memory_order_relaxed);
+        waitForReaders(1 - version);
+        m_version.store(1 - version, std::memory_order_seq_cst);
+        waitForReaders(version);
+
+        instance_t & levels = m_instances[1 - changed];
+        for (Change const& change : m_log)
+        {
+            if (change.erase) { levels.erase(change.key); }
+            else { levels[change.key] = change.value; }
+        }
+        m_log.clear(); // keeps its capacity for the next message
+    }
+
+private:
+    struct Change { Key key; Value value; bool erase; };
+
+    instance_t m_instances[2];
+    std::atomic<int> m_reading;  // the instance readers are directed to
+    std::atomic<int> m_version;  // which counters new readers arrive at
+    mutable Counter m_counters[2][readerSlots];
+    std::vector<Change> m_log;   // changes not yet made to m_reading
+
+    instance_t & writing()
+    {
+        return m_instances[1 - m_reading.load(std::memory_order_relaxed)];
+    }
+
+    Counter* arrive() const
+    {
+        static thread_local size_t const slot =
+            std::hash<std::thread::id>()(std::this_thread::get_id())
+                % readerSlots;
+        Counter* counter =
+            &m_counters[m_version.load(std::memory_order_seq_cst)][slot];
+        counter->readers.fetch_add(1, std::memory_order_seq_cst);
+        return counter;
+    }
+
+    template<typename Func>
+    auto read(Func func) const -> decltype(func(m_instances[0]))
+    {
+        Counter* counter = arrive();
+        auto result = func(m_instances[
+            m_reading.load(std::memory_order_seq_cst)]);
+        counter->readers.fetch_sub(1, std::memory_order_release);
+        return result;
+    }
+
+    // the writer's stores to m_reading and m_version, then these loads,
+    // mirror a reader's arrival, then its load of those, so both sides
+    // need sequential consistency, lest each miss the other's store
+    void waitForReaders(int version) const
+    {
+        for (auto const& counter : m_counters[version])
+        {
+            while (counter.readers.load(std::memory_order_seq_cst) != 0)
+                std::this_thread::yield();
+        }
+    }
+};
+
+template<typename Key, typename Value, typename Compare>
+constexpr size_t LeftRightMap<Key, Value, Compare>::readerSlots;
+
+/**
+ * Storage for BasicGDAXOrderBook that uses a LeftRightMap for each side.
+ */
+struct LeftRightStorage
+{
+    template<typename Price, typename Size>
+    using bids_map = LeftRightMap<Price, Size, std::greater<Price>>;
+    template<typename Price, typename Size>
+    using offers_map = LeftRightMap<Price, Size, std::less<Price>>;
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_LEFT_RIGHT_MAP_HPP
@@ -0,0 +1,454 @@
+#ifndef GDAX_ORDERBOOK_MULTICAST_HPP
+#define GDAX_ORDERBOOK_MULTICAST_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "gdax-orderbook/change-batch.hpp"
+#include "gdax-orderbook/feed.hpp"
+#include "gdax-orderbook/wire-format.hpp"
+
+namespace gdax {
+
+/**
+ * Where a MulticastPublisher sends a book's changes, and MulticastSubscribers
+ * receive them: a multicast group, with one port for the sequenced stream
+ * of deltas, and another for the periodic snapshots from which subscribers
+ * start, or recover after missing a datagram.  Datagrams carry messages of
+ * the binary wire format (see gdax::wire), split into fragments of at most
+ * `maxDatagram` bytes.  `interface` is the local address of the network
+ * interface to send and receive on, e.g. "127.0.0.1" to keep to this host.
+ */
+struct MulticastChannel
+{
+    std::string group;
+    unsigned short deltaPort;
+    unsigned short snapshotPort;
+    std::string interface;
+    size_t maxDatagram;
+    int hops; // the multicast TTL
+
+    MulticastChannel(std::string const& group = "239.255.67.68",
+                     unsigned short deltaPort = 30067,
+                     unsigned short snapshotPort = 30068,
+                     std::string const& interface = "0.0.0.0",
+                     size_t maxDatagram = 1400,
+                     int hops = 1)
+        : group(group), deltaPort(deltaPort), snapshotPort(snapshotPort),
+          interface(interface), maxDatagram(maxDatagram), hops(hops)
+    {}
+};
+
+/**
+ * Republishes one product's book to any number of subscribers at the cost
+ * of one send per datagram, however many there are, e.g.
+ * `book.addListener([&](GDAXOrderBook::batch_t const& batch)
+ * { publisher.publish(batch); });`, before or after the book is loaded, as
+ * a listener's first batch is the book's snapshot either way.
+ *
+ * Each batch becomes a Delta message with the next sequence number, or, for
+ * a snapshot, which replaces the book, a Snapshot message with it.  The
+ * publisher keeps its own copy of the book's levels, and, once it has been
+ * published a snapshot, every `snapshotInterval` also sends all of them as
+ * a Snapshot message on the snapshot port, numbered with the last sequence
+ * it covers, from a thread of its own, so that subscribers that join a
+ * quiet book, or miss a datagram of it, start from it all the same.
+ */
+template<typename Price, typename Size>
+class MulticastPublisher
+{
+public:
+    using batch_t = ChangeBatch<Price, Size>;
+
+    MulticastPublisher(
+        MulticastChannel const& channel,
+        uint32_t productId,
+        std::chrono::steady_clock::duration snapshotInterval
+            = std::chrono::seconds(1))
+        : m_productId(productId),
+          m_snapshotInterval(snapshotInterval),
+          m_socket(m_io, boost::asio::ip::udp::v4()),
+          m_deltas(boost::asio::ip::address::from_string(channel.group),
+                   channel.deltaPort),
+          m_snapshots(boost::asio::ip::address::from_string(channel.group),
+                      channel.snapshotPort),
+          m_buffer(channel.maxDatagram),
+          m_timer(m_io)
+    {
+        m_socket.set_option(boost::asio::ip::multicast::hops(channel.hops));
+        m_socket.set_option(boost::asio::ip::multicast::outbound_interface(
+            boost::asio::ip::address_v4::from_string(channel.interface)));
+        if (m_snapshotInterval.count() > 0)
+        {
+            scheduleSnapshot();
+            m_thread = std::thread([this] { m_io.run(); });
+        }
+    }
+
+    MulticastPublisher(MulticastPublisher const&) = delete;
+    MulticastPublisher& operator=(MulticastPublisher const&) = delete;
+
+    ~MulticastPublisher()
+    {
+        m_io.stop();
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    /** Publishes a batch, from one thread at a time. */
+    void publish(batch_t const& batch)
+    {
+        if (batch.type == batch_t::None) return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (batch.type == batch_t::Snapshot)
+        {
+            m_bids.clear();
+            m_offers.clear();
+            m_loaded = true;
+        }
+        for (auto const& change : batch.changes)
+        {
+            if (change.side == Side::Bid) { set(m_bids, change); }
+            else { set(m_offers, change); }
+        }
+
+        ++m_sequence;
+        auto const& changes = batch.changes;
+        send(m_deltas, batch.type == batch_t::Snapshot
+            ? wire::SnapshotTemplate : wire::DeltaTemplate,
+            changes.size(), [&changes](size_t i) { return changes[i]; });
+    }
+
+    /**
+     * Sends a snapshot on the snapshot port now, from any thread, if one
+     * has been published.
+     */
+    void sendSnapshot()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        sendLevels();
+    }
+
+    /** The sequence number of the last batch published. */
+    uint64_t sequence() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_sequence;
+    }
+
+private:
+    uint32_t const m_productId;
+    std::chrono::steady_clock::duration const m_snapshotInterval;
+
+    boost::asio::io_service m_io; // the snapshot thread's
+    boost::asio::ip::udp::socket m_socket;
+    boost::asio::ip::udp::endpoint const m_deltas, m_snapshots;
+
+    mutable std::mutex m_mutex; // guards the socket, and all of the below
+    std::vector<char> m_buffer;
+    uint64_t m_sequence = 0;
+    bool m_loaded = false; // whether a snapshot has been published
+    std::map<Price, Size> m_bids, m_offers;
+
+    boost::asio::steady_timer m_timer;
+    std::thread m_thread; // sends the periodic snapshots
+
+    void scheduleSnapshot()
+    {
+        m_timer.expires_from_now(m_snapshotInterval);
+        m_timer.async_wait([this](boost::system::error_code const& error)
+            {
+                if (error == boost::asio::error::operation_aborted) return;
+                sendSnapshot();
+                scheduleSnapshot();
+            });
+    }
+
+    // sends the publisher's copy of the book, with m_mutex held
+    void sendLevels()
+    {
+        if (!m_loaded) return;
+        std::vector<Change<Price, Size>> levels;
+        levels.reserve(m_bids.size() + m_offers.size());
+        for (auto const& level : m_bids)
+            levels.push_back({ Side::Bid, level.first, level.second });
+        for (auto const& level : m_offers)
+            levels.push_back({ Side::Offer, level.first, level.second });
+        send(m_snapshots, wire::SnapshotTemplate, levels.size(),
+             [&levels](size_t i) { return levels[i]; });
+    }
+
+    static void set(std::map<Price, Size> & side,
+                    Change<Price, Size> const& change)
+    {
+        if (change.size == 0) { side.erase(change.price); }
+        else { side[change.price] = change.size; }
+    }
+
+    // sends `count` levels, level(i) being the i-th, as one message of the
+    // current sequence, in as many fragments as the datagram size requires
+    template<typename LevelAt>
+    void send(boost::asio::ip::udp::endpoint const& to,
+              wire::TemplateId templateId, size_t count, LevelAt level)
+    {
+        size_t const perFragment = std::max<size_t>(1,
+            (m_buffer.size() - wire::Encoder::fixedLength)
+                / wire::Level::encodedLength);
+        size_t const fragments = std::max<size_t>(1,
+            (count + perFragment - 1)/perFragment);
+        for (size_t fragment = 0 ; fragment < fragments ; ++fragment)
+        {
+            size_t const first = fragment*perFragment;
+            size_t const levels = std::min(perFragment, count - first);
+            wire::Encoder encoder(m_buffer.data(), templateId);
+            encoder.sequence(m_sequence)
+                   .productId(m_productId)
+                   .fragment(static_cast<uint16_t>(fragment),
+                             static_cast<uint16_t>(fragments))
+                   .levels(static_cast<uint32_t>(levels));
+            for (size_t i = 0 ; i < levels ; ++i)
+            {
+                auto const change = level(first + i);
+                encoder.level(i).price(change.price).side(change.side)
+                                .size(change.size);
+            }
+            boost::system::error_code error; // lost, as if on the network
+            m_socket.send_to(boost::asio::buffer(m_buffer.data(),
+                encoder.encodedLength()), to, 0, error);
+        }
+    }
+};
+
+/**
+ * Receives a MulticastPublisher's book, as a gdax::Feed, so that a
+ * BasicGDAXOrderBook constructed with one is a replica of the publisher's,
+ * e.g. `GDAXOrderBook book(std::make_shared<gdax::MulticastSubscriber<
+ * GDAXOrderBook::Price, GDAXOrderBook::Size>>(channel, productId));`.
+ *
+ * The subscriber starts from the next snapshot on the snapshot port, while
+ * holding on to the deltas that arrive meanwhile, and applies those numbered
+ * after it, then each delta in sequence.  Datagrams are sequenced, so a
+ * missing or reordered one is a gap: the subscriber drops its pending
+ * deltas, counts the gap, and recovers from the next snapshot as it
+ * started, the book standing still, though readable, until then.
+ */
+template<typename Price, typename Size>
+class MulticastSubscriber : public Feed<ChangeBatch<Price, Size>>
+{
+public:
+    using batch_t = ChangeBatch<Price, Size>;
+
+    MulticastSubscriber(MulticastChannel const& channel, uint32_t productId,
+                        size_t maxPending = 100000)
+        : m_productId(productId),
+          m_maxPending(maxPending),
+          m_deltaSocket(m_io),
+          m_snapshotSocket(m_io),
+          m_deltaBuffer(channel.maxDatagram),
+          m_snapshotBuffer(channel.maxDatagram)
+    {
+        join(m_deltaSocket, channel, channel.deltaPort);
+        join(m_snapshotSocket, channel, channel.snapshotPort);
+    }
+
+    void run(std::function<void(batch_t const&)> apply) override
+    {
+        start(std::move(apply));
+        m_io.run();
+    }
+
+    size_t poll(std::function<void(batch_t const&)> apply) override
+    {
+        start(std::move(apply));
+        return m_io.poll();
+    }
+
+    void stop() override { m_io.stop(); }
+
+    /** The number of gaps detected so far; safe to call from any thread. */
+    uint64_t gaps() const { return m_gaps.load(std::memory_order_relaxed); }
+
+private:
+    uint32_t const m_productId;
+    size_t const m_maxPending; // deltas held while recovering, at most
+
+    boost::asio::io_service m_io;
+    boost::asio::ip::udp::socket m_deltaSocket, m_snapshotSocket;
+    std::vector<char> m_deltaBuffer, m_snapshotBuffer;
+    std::function<void(batch_t const&)> m_apply;
+    bool m_receiving = false;
+
+    // a message, as its fragments arrive
+    struct Assembly
+    {
+        uint64_t sequence = 0;
+        uint16_t received = 0; // fragments, in order
+        batch_t batch;
+    };
+    Assembly m_delta, m_snapshot;
+
+    bool m_live = false; // applying deltas as they come, or recovering
+    uint64_t m_applied = 0; // sequence of the last message applied
+    std::deque<Assembly> m_pending; // deltas held while recovering
+    std::atomic<uint64_t> m_gaps{0};
+
+    static void join(boost::asio::ip::udp::socket & socket,
+                     MulticastChannel const& channel, unsigned short port)
+    {
+        using namespace boost::asio::ip;
+        address const group = address::from_string(channel.group);
+        socket.open(udp::v4());
+        socket.set_option(udp::socket::reuse_address(true));
+        socket.bind(udp::endpoint(group, port));
+        socket.set_option(multicast::join_group(group.to_v4(),
+            address_v4::from_string(channel.interface)));
+    }
+
+    void start(std::function<void(batch_t const&)> apply)
+    {
+        m_apply = std::move(apply);
+        if (m_receiving) return;
+        m_receiving = true;
+        receiveDelta();
+        receiveSnapshot();
+    }
+
+    void receiveDelta()
+    {
+        m_deltaSocket.async_receive(boost::asio::buffer(m_deltaBuffer),
+            [this](boost::system::error_code const& error, size_t length)
+            {
+                if (error == boost::asio::error::operation_aborted) return;
+                if (!error) onDelta(length);
+                receiveDelta();
+            });
+    }
+
+    void receiveSnapshot()
+    {
+        m_snapshotSocket.async_receive(boost::asio::buffer(m_snapshotBuffer),
+            [this](boost::system::error_code const& error, size_t length)
+            {
+                if (error == boost::asio::error::operation_aborted) return;
+                if (!error && !m_live) onSnapshot(length);
+                receiveSnapshot();
+            });
+    }
+
+    /**
+     * Adds a fragment to `assembly`, returning true once it completes the
+     * message, or false, after starting `assembly` over, if it is not the
+     * fragment expected; messages carry their sequence, so a new one may
+     * start at any time.  Sets `gap` if fragments of a message went missing.
+     */
+    static bool assemble(wire::Decoder const& decoder, Assembly & assembly,
+                         bool & gap)
+    {
+        gap = false;
+        if (decoder.fragment() == 0)
+        {
+            gap = assembly.received != 0;
+            assembly.sequence = decoder.sequence();
+            assembly.received = 0;
+            assembly.batch.clear();
+        }
+        else if (decoder.sequence() != assembly.sequence
+                 || decoder.fragment() != assembly.received)
+        {
+            gap = true;
+            assembly.received = 0;
+            return false;
+        }
+        wire::decode(decoder, assembly.batch);
+        if (++assembly.received < decoder.fragments()) return false;
+        assembly.received = 0;
+        return true;
+    }
+
+    bool wrap(wire::Decoder & decoder, std::vector<char> const& buffer,
+              size_t length)
+    {
+        return decoder.wrap(buffer.data(), length)
+            && decoder.productId() == m_productId;
+    }
+
+    void onDelta(size_t length)
+    {
+        wire::Decoder decoder;
+        if (!wrap(decoder, m_deltaBuffer, length)) return;
+        if (m_live && decoder.sequence() <= m_applied) return; // duplicate
+        bool gap;
+        bool const complete = assemble(decoder, m_delta, gap);
+        if (m_live)
+        {
+            if (!gap && decoder.sequence() == m_applied + 1)
+            {
+                if (complete) apply(m_delta);
+                return;
+            }
+            lost(); // and hold on to this delta, as when recovering
+        }
+
+        if (gap) m_pending.clear();
+        if (!complete) return;
+        if (!m_pending.empty()
+            && m_delta.sequence != m_pending.back().sequence + 1)
+        {
+            m_pending.clear();
+        }
+        if (m_pending.size() == m_maxPending) m_pending.pop_front();
+        m_pending.push_back(m_delta);
+    }
+
+    void onSnapshot(size_t length)
+    {
+        wire::Decoder decoder;
+        if (!wrap(decoder, m_snapshotBuffer, length)) return;
+        bool gap;
+        if (!assemble(decoder, m_snapshot, gap)) return;
+
+        // the held deltas must continue from the snapshot without a gap
+        while (!m_pending.empty()
+               && m_pending.front().sequence <= m_snapshot.sequence)
+        {
+            m_pending.pop_front();
+        }
+        if (!m_pending.empty()
+            && m_pending.front().sequence != m_snapshot.sequence + 1)
+        {
+            return; // missing deltas; wait for a later snapshot
+        }
+        apply(m_snapshot);
+        for (auto const& delta : m_pending) apply(delta);
+        m_pending.clear();
+        m_live = true;
+    }
+
+    void apply(Assembly const& message)
+    {
+        m_applied = message.sequence;
+        m_apply(message.batch);
+    }
+
+    // a gap in the deltas: recover from the next snapshot
+    void lost()
+    {
+        m_gaps.fetch_add(1, std::memory_order_relaxed);
+        m_live = false;
+        m_pending.clear();
+    }
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_MULTICAST_HPP
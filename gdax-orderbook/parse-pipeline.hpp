@@ -0,0 +1,231 @@
+#ifndef GDAX_ORDERBOOK_PARSE_PIPELINE_HPP
+#define GDAX_ORDERBOOK_PARSE_PIPELINE_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gdax {
+
+/**
+ * Parses feed frames on a pool of worker threads, and applies the results
+ * on a single writer thread, in exactly the order the frames were submitted.
+ *
+ * Each worker owns a copy of the `Parser` given to the constructor, by
+ * default a default-constructed one, whose
+ * `operator()(std::string const& frame, Batch & batch)` fills `batch` from
+ * `frame`, so that it can keep per-thread parse state, such as a
+ * rapidjson::Document, between frames.  The writer calls `apply` on each
+ * batch in turn.  So parsing, usually the most expensive part of processing
+ * a message, proceeds on as many cores as there are workers, while the book
+ * is changed from one thread, message by message, as without the pipeline.
+ *
+ * Frames in flight occupy the slots of a ring, a reorder buffer indexed by
+ * submission number, in which the writer waits for the next frame to be
+ * parsed, however many later ones already are.  The ring's frame strings
+ * and batches are reused, so that once they have grown to the size of the
+ * largest message, the pipeline allocates nothing.  submit() waits while
+ * the ring is full.
+ *
+ * Optionally, when the writer falls behind, it conflates: see conflate().
+ */
+template<typename Batch, typename Parser>
+class ParsePipeline
+{
+public:
+    using apply_t = std::function<void(Batch & batch)>;
+    using conflate_t = std::function<bool(Batch & into, Batch const& next)>;
+
+    ParsePipeline(unsigned workers, apply_t apply, size_t capacity = 1024,
+                  Parser const& parser = Parser())
+        : m_apply(apply),
+          m_parser(parser),
+          m_slots(capacity ? capacity : 1)
+    {
+        for (unsigned i = 0 ; i < (workers ? workers : 1) ; ++i)
+            m_workers.emplace_back(&ParsePipeline::parseFrames, this);
+        m_writer = std::thread(&ParsePipeline::applyBatches, this);
+    }
+
+    ParsePipeline(ParsePipeline const&) = delete;
+    ParsePipeline& operator=(ParsePipeline const&) = delete;
+
+    /** Stops all threads, discarding any frames not yet applied. */
+    ~ParsePipeline()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_frameQueued.notify_all();
+        m_batchParsed.notify_all();
+        m_slotFreed.notify_all();
+        for (auto & worker : m_workers) worker.join();
+        m_writer.join();
+    }
+
+    /**
+     * Queues `frame` to be parsed and applied after every frame submitted
+     * before it.  Frames must be submitted from one thread at a time.
+     */
+    void submit(std::string const& frame)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_slotFreed.wait(lock, [this]
+            {
+                return m_stopping
+                    || m_submitted - m_applied < m_slots.size();
+            });
+        if (m_stopping) return;
+        Slot & slot = m_slots[m_submitted % m_slots.size()];
+        // the slot is free, so no other thread touches it until submitted
+        lock.unlock();
+        slot.frame.assign(frame);
+        lock.lock();
+        slot.parsed = false;
+        ++m_submitted;
+        lock.unlock();
+        m_frameQueued.notify_one();
+    }
+
+    /**
+     * Once more than `backlog` frames wait to be applied, has the writer
+     * merge the batches of those already parsed, in order, with `merge`,
+     * which returns false for any batch that cannot be merged (e.g. see
+     * gdax::Conflator), and apply them all at once, so that it catches up.
+     * To be called before any frame is submitted.
+     */
+    void conflate(size_t backlog, conflate_t merge)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_conflateBacklog = backlog;
+        m_conflate = merge;
+    }
+
+    /** The number of frames merged into others' batches so far. */
+    uint64_t conflated()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_conflated;
+    }
+
+    /** Waits until every frame submitted so far has been applied. */
+    void drain()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_slotFreed.wait(lock, [this]
+            {
+                return m_stopping || m_applied == m_submitted;
+            });
+    }
+
+private:
+    struct Slot
+    {
+        std::string frame;
+        Batch batch;
+        bool parsed = false;
+    };
+
+    apply_t const m_apply;
+    Parser const m_parser; // each worker's is a copy
+    std::vector<Slot> m_slots;
+
+    std::mutex m_mutex; // guards all of the below, but not the slots' data
+    std::condition_variable m_frameQueued, m_batchParsed, m_slotFreed;
+    uint64_t m_submitted = 0; // frames submitted
+    uint64_t m_claimed = 0;   // frames taken by a worker to parse
+    uint64_t m_applied = 0;   // frames applied, and so slots freed
+    bool m_stopping = false;
+
+    conflate_t m_conflate;       // null unless conflating
+    size_t m_conflateBacklog = 0;
+    uint64_t m_conflated = 0;
+    Batch m_merged;              // the writer's
+
+    std::vector<std::thread> m_workers;
+    std::thread m_writer;
+
+    void parseFrames()
+    {
+        Parser parse(m_parser);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;)
+        {
+            m_frameQueued.wait(lock, [this]
+                {
+                    return m_stopping || m_claimed < m_submitted;
+                });
+            if (m_stopping) return;
+            uint64_t const sequence = m_claimed++;
+            Slot & slot = m_slots[sequence % m_slots.size()];
+            lock.unlock();
+            slot.batch.clear();
+            parse(slot.frame, slot.batch);
+            lock.lock();
+            slot.parsed = true;
+            if (sequence == m_applied) m_batchParsed.notify_one();
+        }
+    }
+
+    void applyBatches()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;)
+        {
+            Slot * slot;
+            m_batchParsed.wait(lock, [this, &slot]
+                {
+                    slot = &m_slots[m_applied % m_slots.size()];
+                    return m_stopping
+                        || (m_applied < m_submitted && slot->parsed);
+                });
+            if (m_stopping) return;
+
+            // a backlog's run of parsed frames, which are the writer's
+            // until applied
+            uint64_t run = 1;
+            if (m_conflate && m_submitted - m_applied > m_conflateBacklog)
+            {
+                while (m_applied + run < m_submitted
+                       && m_slots[(m_applied + run) % m_slots.size()].parsed)
+                {
+                    ++run;
+                }
+            }
+            lock.unlock();
+
+            uint64_t applied = 1;
+            Batch * batch = &slot->batch;
+            if (run > 1)
+            {
+                m_merged.clear();
+                if (m_conflate(m_merged, slot->batch))
+                {
+                    while (applied < run && m_conflate(m_merged,
+                        m_slots[(m_applied + applied) % m_slots.size()].batch))
+                    {
+                        ++applied;
+                    }
+                    batch = &m_merged;
+                }
+            }
+            m_apply(*batch);
+
+            lock.lock();
+            for (uint64_t i = 0 ; i < applied ; ++i)
+                m_slots[(m_applied + i) % m_slots.size()].parsed = false;
+            m_applied += applied;
+            m_conflated += applied - 1;
+            m_slotFreed.notify_all();
+        }
+    }
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_PARSE_PIPELINE_HPP
@@ -0,0 +1,303 @@
+#ifndef GDAX_ORDERBOOK_PRICE_TRIGGERS_HPP
+#define GDAX_ORDERBOOK_PRICE_TRIGGERS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "gdax-orderbook/change-batch.hpp"
+
+namespace gdax {
+
+/**
+ * A condition on one side of a book, for stops and alerts, with what to do
+ * once it holds: the side's best price falling below `price`, or rising
+ * above it, or the size of the level at `price` falling below `size`, or
+ * rising above it, a removed level's size being 0, or the total size of
+ * the levels within `ticks` of the side's best price, it included, falling
+ * below `size`, or rising above it, while the side has levels.  A trigger
+ * fires once, and is then forgotten.
+ */
+template<typename Price, typename Size>
+struct PriceTrigger
+{
+    enum Condition
+    {
+        BestBelow, BestAbove, SizeBelow, SizeAbove, DepthBelow, DepthAbove
+    };
+
+    Side side;
+    Condition condition;
+    Price price; // but for DepthBelow and DepthAbove
+    Size size;   // but for BestBelow and BestAbove
+    Price ticks; // for DepthBelow and DepthAbove
+    std::function<void(PriceTrigger const& trigger)> fire;
+};
+
+/**
+ * The triggers of one side of a book, ordered by price, so that applying a
+ * change costs nothing unless triggers are set, and then a lookup of the
+ * change's price among the size triggers, and, should the change move the
+ * side's best price, one among the best price triggers, plus the triggers
+ * fired: a best price moving from `a` to `b` fires exactly those triggers
+ * whose price lies between.  `Better` orders the side's prices best first,
+ * e.g. std::greater for bids.
+ *
+ * The index only follows the best price while it has best price triggers,
+ * and so is told it, by add(), when it has none.  A change removing the
+ * best level leaves the best price stale(), for the caller to reset() once
+ * it can read the next best from the book, e.g. once the message is
+ * applied; as can a snapshot, which the index does not see, by invalidate().
+ * Best price triggers fire as soon as they are added if the best price is
+ * already beyond theirs, size triggers only on a change to their level.
+ *
+ * Depth triggers, kept ordered by their windows' widths, also have the
+ * index follow the best price, and are due for evaluation, depthStale(),
+ * when one is added, when the best price moves, and when a level changes
+ * within the widest window of it; the caller then has fireDepth() sum the
+ * levels within each window from the book, once it is readable.
+ *
+ * Fired triggers are moved to `fired`, for the caller to fire once the
+ * change is complete.
+ */
+template<typename Price, typename Size, typename Better>
+class TriggerIndex
+{
+public:
+    using trigger_t = PriceTrigger<Price, Size>;
+
+    bool empty() const { return m_ids.empty(); }
+
+    /** Whether the index needs to be told the best price to add(). */
+    bool followsBest() const
+    {
+        return !m_below.empty() || !m_above.empty() || hasDepth();
+    }
+
+    /**
+     * Adds trigger `id`, given the side's best price, if `hasBest`, unless
+     * followsBest(), in which case it is known already.
+     */
+    void add(uint64_t id, trigger_t trigger, bool hasBest, Price best,
+             std::vector<trigger_t> & fired)
+    {
+        if (!followsBest())
+        {
+            m_hasBest = hasBest;
+            m_best = best;
+            m_stale = false;
+        }
+        triggers_t & triggers = of(trigger.condition);
+        bool const depth = &triggers == &m_depthBelow
+            || &triggers == &m_depthAbove;
+        Price const key = depth ? trigger.ticks : trigger.price;
+        m_ids[id] = std::make_pair(trigger.condition,
+            triggers.emplace(key, Entry{ id, std::move(trigger) }));
+        if (depth) m_depthStale = true;
+        if (m_hasBest) fireBest(fired);
+    }
+
+    /** Removes trigger `id`, returning false if it has already fired. */
+    bool remove(uint64_t id)
+    {
+        auto entry = m_ids.find(id);
+        if (entry == m_ids.end()) return false;
+        of(entry->second.first).erase(entry->second.second);
+        m_ids.erase(entry);
+        return true;
+    }
+
+    /**
+     * Fires the triggers that the level at `price` being set to `size`, 0
+     * removing it, satisfies.
+     */
+    void change(Price price, Size size, std::vector<trigger_t> & fired)
+    {
+        if (!m_sizeBelow.empty() || !m_sizeAbove.empty())
+        {
+            fireSize(m_sizeBelow, price, fired, [size](Size limit)
+                {
+                    return size < limit;
+                });
+            fireSize(m_sizeAbove, price, fired, [size](Size limit)
+                {
+                    return size > limit;
+                });
+        }
+        if (!followsBest()) return;
+        if (hasDepth() && !m_depthStale
+            && (!m_hasBest || m_stale || !Better()(limit(widest()), price)))
+        {
+            m_depthStale = true;
+        }
+        if (size != 0 && (!m_hasBest || Better()(price, m_best)))
+        {
+            // better than any level left, even with the best stale
+            moveBest(true, price, fired);
+        }
+        else if (size == 0 && m_hasBest && price == m_best)
+        {
+            m_stale = true;
+        }
+    }
+
+    /** Whether the best price needs to be reset(). */
+    bool stale() const { return m_stale; }
+
+    void invalidate() { m_stale = followsBest(); }
+
+    /** Has the index follow the best price from `best`, if it has any. */
+    void reset(bool hasBest, Price best, std::vector<trigger_t> & fired)
+    {
+        moveBest(hasBest, best, fired);
+    }
+
+    /** Whether the depth triggers need to be evaluated by fireDepth(). */
+    bool depthStale() const { return m_depthStale; }
+
+    /**
+     * Fires the depth triggers that hold, given the best price, not
+     * stale(), and `sizeTo(limit)`, the total size of the levels from the
+     * best price to `limit`, it included, e.g. by summing the book's.
+     */
+    template<typename SizeTo>
+    void fireDepth(SizeTo sizeTo, std::vector<trigger_t> & fired)
+    {
+        m_depthStale = false;
+        if (!m_hasBest) return;
+        fireDepth(m_depthBelow, sizeTo, fired, [](Size depth, Size limit)
+            {
+                return depth < limit;
+            });
+        fireDepth(m_depthAbove, sizeTo, fired, [](Size depth, Size limit)
+            {
+                return depth > limit;
+            });
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t id;
+        trigger_t trigger;
+    };
+    using triggers_t = std::multimap<Price, Entry>;
+
+    triggers_t m_below, m_above, m_sizeBelow, m_sizeAbove;
+    triggers_t m_depthBelow, m_depthAbove; // by ticks
+    std::unordered_map<uint64_t, std::pair<typename trigger_t::Condition,
+        typename triggers_t::iterator>> m_ids;
+    bool m_hasBest = false; // while followsBest()
+    Price m_best = 0;
+    bool m_stale = false;
+    bool m_depthStale = false;
+
+    triggers_t & of(typename trigger_t::Condition condition)
+    {
+        switch (condition)
+        {
+        case trigger_t::BestBelow: return m_below;
+        case trigger_t::BestAbove: return m_above;
+        case trigger_t::SizeBelow: return m_sizeBelow;
+        case trigger_t::SizeAbove: return m_sizeAbove;
+        case trigger_t::DepthBelow: return m_depthBelow;
+        default: return m_depthAbove;
+        }
+    }
+
+    bool hasDepth() const
+    {
+        return !m_depthBelow.empty() || !m_depthAbove.empty();
+    }
+
+    // the width of the widest depth window, if hasDepth()
+    Price widest() const
+    {
+        Price ticks = 0;
+        if (!m_depthBelow.empty()) ticks = m_depthBelow.rbegin()->first;
+        if (!m_depthAbove.empty())
+            ticks = std::max(ticks, m_depthAbove.rbegin()->first);
+        return ticks;
+    }
+
+    // the worst price within `ticks` of the best price
+    Price limit(Price ticks) const
+    {
+        if (!Better()(Price(1), Price(0))) return m_best + ticks;
+        return m_best > ticks ? m_best - ticks : Price(0);
+    }
+
+    void take(triggers_t & triggers, typename triggers_t::iterator first,
+              typename triggers_t::iterator last,
+              std::vector<trigger_t> & fired)
+    {
+        for (auto entry = first ; entry != last ; ++entry)
+        {
+            m_ids.erase(entry->second.id);
+            fired.push_back(std::move(entry->second.trigger));
+        }
+        triggers.erase(first, last);
+    }
+
+    template<typename Holds>
+    void fireSize(triggers_t & triggers, Price price,
+                  std::vector<trigger_t> & fired, Holds holds)
+    {
+        auto range = triggers.equal_range(price);
+        for (auto entry = range.first ; entry != range.second ; )
+        {
+            if (!holds(entry->second.trigger.size)) { ++entry; continue; }
+            m_ids.erase(entry->second.id);
+            fired.push_back(std::move(entry->second.trigger));
+            entry = triggers.erase(entry);
+        }
+    }
+
+    // sums each window once, for all the triggers of its width
+    template<typename SizeTo, typename Holds>
+    void fireDepth(triggers_t & triggers, SizeTo & sizeTo,
+                   std::vector<trigger_t> & fired, Holds holds)
+    {
+        for (auto entry = triggers.begin() ; entry != triggers.end() ; )
+        {
+            Price const ticks = entry->first;
+            Size const depth = sizeTo(limit(ticks));
+            while (entry != triggers.end() && entry->first == ticks)
+            {
+                if (!holds(depth, entry->second.trigger.size))
+                {
+                    ++entry;
+                    continue;
+                }
+                m_ids.erase(entry->second.id);
+                fired.push_back(std::move(entry->second.trigger));
+                entry = triggers.erase(entry);
+            }
+        }
+    }
+
+    void moveBest(bool hasBest, Price best, std::vector<trigger_t> & fired)
+    {
+        if (hasDepth()) m_depthStale = true;
+        m_hasBest = hasBest;
+        m_best = best;
+        m_stale = false;
+        if (hasBest) fireBest(fired);
+    }
+
+    // fires the best price triggers the best price is beyond; as none was
+    // before it moved, those are the ones whose prices it moved across
+    void fireBest(std::vector<trigger_t> & fired)
+    {
+        take(m_below, m_below.upper_bound(m_best), m_below.end(), fired);
+        take(m_above, m_above.begin(), m_above.lower_bound(m_best), fired);
+    }
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_PRICE_TRIGGERS_HPP
@@ -0,0 +1,192 @@
+#ifndef GDAX_ORDERBOOK_REPLAY_RUNNER_HPP
+#define GDAX_ORDERBOOK_REPLAY_RUNNER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gdax-orderbook/tick-store.hpp"
+
+namespace gdax {
+
+/**
+ * One product's history for one day, recorded in a tick store (see
+ * gdax::store::Writer), to be replayed by a gdax::ReplayRunner.
+ */
+struct ReplayJob
+{
+    std::string product;
+    std::string day;
+    std::string path;
+};
+
+/**
+ * Replays many (product, day) tick stores at once for research, each
+ * through a book of its own, on a pool of threads that steal jobs from
+ * each other, so that a run over a month of fifty products takes about
+ * that of one, divided by the number of cores.
+ *
+ * Each job's `Book`, e.g. GDAXOrderBook, is threadless, with no feed: the
+ * worker thread running the job apply()s the job's tick store to it
+ * message by message, and after each calls `step`, with the book as it
+ * then stands, the message, and the job's own `Result`, value-initialized,
+ * which it accumulates into.  Jobs share nothing, so `step` needs no
+ * synchronization unless it reaches beyond its arguments.  run() returns
+ * the jobs' results in the order of the jobs, whichever thread ran them,
+ * or folds them, in that order, with `merge`.
+ *
+ * Jobs are dealt to the workers, largest file first, round-robin; a
+ * worker takes its own from the front of its queue, and, once that is
+ * empty, steals from the back of another's, so that a few long days do
+ * not leave the other workers idle.
+ */
+template<typename Book, typename Result>
+class ReplayRunner
+{
+public:
+    using batch_t = typename Book::batch_t;
+    using step_t = std::function<void(ReplayJob const& job, Book & book,
+        int64_t time, uint64_t sequence, batch_t const& batch,
+        Result & result)>;
+    using merge_t = std::function<void(Result & into, Result const& from)>;
+
+    /** With `threads` 0, runs as many as the hardware does at once. */
+    template<typename Options>
+    explicit ReplayRunner(Options const& options, unsigned threads = 0)
+        : m_threads(threads ? threads
+              : std::max(1u, std::thread::hardware_concurrency())),
+          m_makeBook([options] { return Book::threadless(options); }),
+          m_idle(Book::threadless(options))
+    {}
+
+    /**
+     * Runs every job, and returns their results, in order.  Rethrows the
+     * first exception a job threw, e.g. std::runtime_error for a file that
+     * is not a tick store, once the other workers are done.
+     */
+    std::vector<Result> run(std::vector<ReplayJob> const& jobs, step_t step)
+    {
+        std::vector<Result> results(jobs.size());
+        std::vector<Queue> queues(std::min<size_t>(m_threads,
+            std::max<size_t>(jobs.size(), 1)));
+        deal(jobs, queues);
+
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        auto work = [&](size_t self)
+        {
+            size_t job;
+            while (take(queues, self, job))
+            {
+                try
+                {
+                    replay(jobs[job], step, results[job]);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) error = std::current_exception();
+                }
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t worker = 1 ; worker < queues.size() ; ++worker)
+            workers.emplace_back(work, worker);
+        work(0);
+        for (auto & worker : workers) worker.join();
+
+        if (error) std::rethrow_exception(error);
+        return results;
+    }
+
+    /** As above, but folds the results, in the order of the jobs. */
+    Result run(std::vector<ReplayJob> const& jobs, step_t step,
+               merge_t merge)
+    {
+        Result merged = Result();
+        for (auto const& result : run(jobs, std::move(step)))
+            merge(merged, result);
+        return merged;
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex; // guards jobs
+        std::deque<size_t> jobs;
+    };
+
+    unsigned const m_threads;
+    std::function<std::unique_ptr<Book>()> m_makeBook;
+    // keeps the runtimes books share, so that books made and destroyed in
+    // turn do not each start them afresh
+    std::unique_ptr<Book> m_idle;
+
+    static void deal(std::vector<ReplayJob> const& jobs,
+                     std::vector<Queue> & queues)
+    {
+        std::vector<std::pair<std::streamoff, size_t>> bySize;
+        for (size_t job = 0 ; job < jobs.size() ; ++job)
+        {
+            std::ifstream file(jobs[job].path,
+                               std::ios::binary | std::ios::ate);
+            bySize.emplace_back(file ? std::streamoff(file.tellg()) : 0, job);
+        }
+        std::sort(bySize.begin(), bySize.end(),
+            [](std::pair<std::streamoff, size_t> const& a,
+               std::pair<std::streamoff, size_t> const& b)
+            {
+                return a.first > b.first;
+            });
+        for (size_t i = 0 ; i < bySize.size() ; ++i)
+            queues[i % queues.size()].jobs.push_back(bySize[i].second);
+    }
+
+    // takes the next of worker `self`'s own jobs, or else steals another's
+    static bool take(std::vector<Queue> & queues, size_t self, size_t & job)
+    {
+        for (size_t i = 0 ; i < queues.size() ; ++i)
+        {
+            Queue & queue = queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.jobs.empty()) continue;
+            if (i == 0)
+            {
+                job = queue.jobs.front();
+                queue.jobs.pop_front();
+            }
+            else
+            {
+                job = queue.jobs.back();
+                queue.jobs.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void replay(ReplayJob const& job, step_t const& step, Result & result)
+    {
+        std::unique_ptr<Book> book = m_makeBook();
+        store::Reader reader(job.path);
+        reader.replay<typename Book::Price, typename Book::Size>(0,
+            [&](int64_t time, uint64_t sequence, batch_t const& batch)
+            {
+                book->apply(batch);
+                step(job, *book, time, sequence, batch, result);
+            });
+    }
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_REPLAY_RUNNER_HPP
@@ -0,0 +1,432 @@
+#ifndef GDAX_ORDERBOOK_SINGLE_WRITER_SKIP_LIST_HPP
+#define GDAX_ORDERBOOK_SINGLE_WRITER_SKIP_LIST_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace gdax {
+
+/**
+ * An ordered price->quantity map for one side of a book, as a skip list
+ * specialized for the book's single writer: where cds::container::
+ * SkipListMap links, updates and unlinks nodes with compare-and-swap loops
+ * and marked pointers so that any number of threads can write, this one's
+ * writer only ever loads and stores, publishing each change with a release
+ * store (a plain store on x86).
+ *
+ * Readers are lock-free, by the same optimistic scheme as gdax::BTreeMap:
+ * every node has a version, odd while the writer changes the node, that
+ * readers note before reading it and check after, stepping from node to
+ * node only once the version of the one they leave is confirmed, and
+ * otherwise searching again from the last key they were sure of.  Nodes
+ * are never freed while the map exists, only recycled as nodes of the same
+ * height, so a stale pointer always leads to a node whose changed version
+ * sends the reader back.
+ *
+ * It offers the subset of the SkipListMap interface the book uses
+ * (insert(), update(), erase(), contains(), begin() and end()), so it can
+ * stand in for it as `bids`/`offers`; see gdax::SingleWriterStorage.  As
+ * with SkipListMap, iteration concurrent with modification is not a
+ * snapshot.  `Key` and `Value` must be trivially copyable.
+ */
+template<typename Key, typename Value, typename Compare>
+class SingleWriterSkipListMap
+{
+    static_assert(std::is_trivially_copyable<Key>::value
+                  && std::is_trivially_copyable<Value>::value,
+                  "Key and Value must be trivially copyable");
+
+    static constexpr unsigned maxHeight = 16; // ample for 4^16 levels
+
+    struct Node
+    {
+        std::atomic<uint64_t> version; // odd while being changed
+        Key key;
+        Value value;
+        unsigned const height;
+        std::atomic<Node*> next[1];    // in fact `height` of them
+
+        explicit Node(unsigned height) : version(0), height(height)
+        {
+            for (unsigned level = 0 ; level < height ; ++level)
+                new (&next[level]) std::atomic<Node*>(nullptr);
+        }
+    };
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+
+    SingleWriterSkipListMap()
+        : m_height(1),
+          m_size(0),
+          m_random(0x9E3779B97F4A7C15ull)
+    {
+        m_head = newNode(maxHeight);
+        unlock(m_head);
+    }
+
+    SingleWriterSkipListMap(SingleWriterSkipListMap const&) = delete;
+    SingleWriterSkipListMap& operator=(SingleWriterSkipListMap const&) =
+        delete;
+
+    ~SingleWriterSkipListMap()
+    {
+        for (Node* node : m_nodes)
+        {
+            node->~Node();
+            ::operator delete(node);
+        }
+    }
+
+    /**
+     * Forward iterator over the levels, best first, yielding copies of the
+     * levels as they were when the iterator reached them.
+     */
+    class iterator
+    {
+    public:
+        iterator() : m_map(nullptr), m_node(nullptr), m_version(0) {}
+
+        iterator(iterator const& other) { *this = other; }
+        iterator& operator=(iterator const& other)
+        {
+            m_map = other.m_map;
+            m_node = other.m_node;
+            m_version = other.m_version;
+            if (m_map) new (&m_level) value_type(*other);
+            return *this;
+        }
+
+        value_type const& operator*() const
+        {
+            return *reinterpret_cast<value_type const*>(&m_level);
+        }
+        value_type const* operator->() const { return &**this; }
+
+        iterator& operator++()
+        {
+            if (!settle(m_node, m_version)) seek(false);
+            return *this;
+        }
+
+        bool operator==(iterator const& other) const
+        {
+            return m_map == other.m_map
+                && (m_map == nullptr || m_node == other.m_node);
+        }
+        bool operator!=(iterator const& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        friend class SingleWriterSkipListMap;
+
+        SingleWriterSkipListMap const* m_map; // nullptr at end()
+        Node* m_node;
+        uint64_t m_version; // of m_node, when the level was read from it
+        typename std::aligned_storage<sizeof(value_type),
+                                      alignof(value_type)>::type m_level;
+
+        explicit iterator(SingleWriterSkipListMap const* map)
+            : m_map(map)
+        {
+            if (!settle(map->m_head, stable(map->m_head))) seek(true);
+        }
+
+        // moves to the first level, or the first after the current one
+        void seek(bool first)
+        {
+            for (;;)
+            {
+                std::pair<Node*, uint64_t> from = first
+                    ? std::make_pair(m_map->m_head, stable(m_map->m_head))
+                    : m_map->seekAfter((**this).first);
+                if (settle(from.first, from.second)) return;
+            }
+        }
+
+        /**
+         * Moves to the node after `node`, as of `version`, returning false
+         * if `node` no longer is at that version.
+         */
+        bool settle(Node* node, uint64_t version)
+        {
+            Node* next = node->next[0].load(std::memory_order_acquire);
+            if (next == nullptr)
+            {
+                if (!valid(node, version)) return false;
+                m_map = nullptr;
+                return true;
+            }
+            uint64_t nextVersion = stable(next);
+            if (!valid(node, version)) return false;
+            Key key = next->key;
+            Value value = next->value;
+            if (!valid(next, nextVersion)) return false;
+            m_node = next;
+            m_version = nextVersion;
+            new (&m_level) value_type(key, value);
+            return true;
+        }
+    };
+    using const_iterator = iterator;
+
+    iterator begin() const { return iterator(this); }
+    iterator end() const { return iterator(); }
+
+    bool empty() const { return size() == 0; }
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+    bool contains(Key const& key) const
+    {
+        for (;;)
+        {
+            std::pair<Node*, uint64_t> before = seekBefore(key);
+            Node* next = before.first->next[0].load(std::memory_order_acquire);
+            if (next == nullptr)
+            {
+                if (valid(before.first, before.second)) return false;
+                continue;
+            }
+            uint64_t nextVersion = stable(next);
+            if (!valid(before.first, before.second)) continue;
+            bool found = !Compare()(key, next->key);
+            if (valid(next, nextVersion)) return found;
+        }
+    }
+
+    bool insert(Key const& key, Value const& value)
+    {
+        return update(key,
+            [&value](bool & bNew, value_type & pair)
+            {
+                if (bNew) pair.second = value;
+            }).second;
+    }
+
+    /**
+     * Calls func(bool & bNew, value_type & level) on the level at `key`,
+     * inserting it first, with bNew set, if it is absent and `allowInsert`.
+     * Returns whether the level exists now, and whether it was inserted.
+     */
+    template<typename Func>
+    std::pair<bool, bool> update(Key const& key, Func func,
+                                 bool allowInsert = true)
+    {
+        Node* preds[maxHeight];
+        Node* node = find(key, preds);
+        bool bNew = node == nullptr;
+        if (bNew && !allowInsert) return std::make_pair(false, false);
+
+        value_type level(key, bNew ? Value() : node->value);
+        func(bNew, level);
+        if (!bNew)
+        {
+            lock(node);
+            node->value = level.second;
+            unlock(node);
+            return std::make_pair(true, false);
+        }
+
+        unsigned const height = randomHeight();
+        for (unsigned l = m_height ; l < height ; ++l) preds[l] = m_head;
+        if (height > m_height) m_height = height;
+
+        // the new node is complete before anything links to it
+        node = newNode(height);
+        node->key = key;
+        node->value = level.second;
+        for (unsigned l = 0 ; l < height ; ++l)
+        {
+            node->next[l].store(preds[l]->next[l].load(
+                std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        unlock(node);
+        for (unsigned l = 0 ; l < height ; ++l)
+        {
+            if (l == 0 || preds[l] != preds[l-1]) lock(preds[l]);
+            preds[l]->next[l].store(node, std::memory_order_release);
+        }
+        for (unsigned l = 0 ; l < height ; ++l)
+        {
+            if (l + 1 == height || preds[l] != preds[l+1]) unlock(preds[l]);
+        }
+        m_size.fetch_add(1, std::memory_order_relaxed);
+        return std::make_pair(true, true);
+    }
+
+    bool erase(Key const& key)
+    {
+        Node* preds[maxHeight];
+        Node* node = find(key, preds);
+        if (node == nullptr) return false;
+
+        // readers on the node, or about to step onto it, go back
+        lock(node);
+        for (unsigned l = node->height ; l-- > 0 ; )
+        {
+            if (l + 1 == node->height || preds[l] != preds[l+1])
+                lock(preds[l]);
+            preds[l]->next[l].store(node->next[l].load(
+                std::memory_order_relaxed), std::memory_order_release);
+        }
+        for (unsigned l = node->height ; l-- > 0 ; )
+        {
+            if (l == 0 || preds[l] != preds[l-1]) unlock(preds[l]);
+        }
+        unlock(node);
+        m_free[node->height - 1].push_back(node);
+        m_size.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    std::vector<Node*> m_nodes; // all of them, for destruction
+    std::vector<Node*> m_free[maxHeight]; // recyclable, by height
+    Node* m_head;
+    unsigned m_height;  // of the tallest node, the writer's only
+    std::atomic<size_t> m_size;
+    uint64_t m_random;  // xorshift state, the writer's only
+
+    // writer side: a node is "locked" while its version is odd
+    static void lock(Node* node)
+    {
+        node->version.store(node->version.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    static void unlock(Node* node)
+    {
+        node->version.store(node->version.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_release);
+    }
+
+    // reader side, as in gdax::BTreeMap
+    static uint64_t stable(Node const* node)
+    {
+        for (;;)
+        {
+            uint64_t version = node->version.load(std::memory_order_acquire);
+            if (!(version & 1)) return version;
+        }
+    }
+    static bool valid(Node const* node, uint64_t version)
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return node->version.load(std::memory_order_relaxed) == version;
+    }
+
+    // new nodes start locked, as a recycled one may still be being read
+    Node* newNode(unsigned height)
+    {
+        Node* node;
+        if (m_free[height - 1].empty())
+        {
+            node = new (::operator new(sizeof(Node)
+                + (height - 1)*sizeof(std::atomic<Node*>))) Node(height);
+            m_nodes.push_back(node);
+        }
+        else
+        {
+            node = m_free[height - 1].back();
+            m_free[height - 1].pop_back();
+        }
+        lock(node);
+        return node;
+    }
+
+    // heights 1, 2, 3... with probabilities 3/4, 3/16, 3/64...
+    unsigned randomHeight()
+    {
+        m_random ^= m_random << 13;
+        m_random ^= m_random >> 7;
+        m_random ^= m_random << 17;
+        unsigned height = 1 + __builtin_ctzll(m_random | (1ull << 62))/2;
+        return height < maxHeight ? height : maxHeight;
+    }
+
+    // the writer's search: the node at `key`, if any, and its predecessors
+    Node* find(Key const& key, Node** preds) const
+    {
+        Node* node = m_head;
+        for (unsigned l = m_height ; l-- > 0 ; )
+        {
+            for (Node* next ; (next = node->next[l].load(
+                     std::memory_order_relaxed)) != nullptr
+                 && Compare()(next->key, key) ; )
+            {
+                node = next;
+            }
+            preds[l] = node;
+        }
+        Node* next = node->next[0].load(std::memory_order_relaxed);
+        return next && !Compare()(key, next->key) ? next : nullptr;
+    }
+
+    /**
+     * Readers' search: the last node, possibly the head, whose key orders
+     * before `key` (or, with `inclusive`, not after it), with its version,
+     * noting each node's version before reading it and confirming it
+     * before leaving it.
+     */
+    std::pair<Node*, uint64_t> search(Key const& key, bool inclusive) const
+    {
+        for (;;)
+        {
+            Node* node = m_head;
+            uint64_t version = stable(node);
+            bool restart = false;
+            for (unsigned l = maxHeight ; l-- > 0 && !restart ; )
+            {
+                for (;;)
+                {
+                    Node* next = node->next[l].load(std::memory_order_acquire);
+                    if (next == nullptr) break;
+                    uint64_t nextVersion = stable(next);
+                    if (!valid(node, version)) { restart = true; break; }
+                    bool before = inclusive ? !Compare()(key, next->key)
+                                            : Compare()(next->key, key);
+                    if (!valid(next, nextVersion)) { restart = true; break; }
+                    if (!before) break;
+                    node = next;
+                    version = nextVersion;
+                }
+            }
+            if (!restart) return std::make_pair(node, version);
+        }
+    }
+    std::pair<Node*, uint64_t> seekBefore(Key const& key) const
+    {
+        return search(key, false);
+    }
+    std::pair<Node*, uint64_t> seekAfter(Key const& key) const
+    {
+        return search(key, true);
+    }
+};
+
+/**
+ * Storage for BasicGDAXOrderBook that uses a SingleWriterSkipListMap for
+ * each side.
+ */
+struct SingleWriterStorage
+{
+    template<typename Price, typename Size>
+    using bids_map =
+        SingleWriterSkipListMap<Price, Size, std::greater<Price>>;
+    template<typename Price, typename Size>
+    using offers_map = SingleWriterSkipListMap<Price, Size, std::less<Price>>;
+};
+
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_SINGLE_WRITER_SKIP_LIST_HPP
@@ -0,0 +1,697 @@
+#ifndef GDAX_ORDERBOOK_TICK_STORE_HPP
+#define GDAX_ORDERBOOK_TICK_STORE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gdax-orderbook/change-batch.hpp"
+#include "gdax-orderbook/wire-format.hpp"
+
+namespace gdax {
+
+/**
+ * A file format for months of a book's history: every level change, each a
+ * row of (time, sequence, flags, price, size), stored in blocks of rows, and
+ * within a block by column, each column encoded by its own means:
+ *
+ *     time      nanoseconds, as the zigzag varint difference from the row
+ *               before (from the block's first time, for its first row)
+ *     sequence  the varint difference from the row before (likewise)
+ *     flags     a byte, bit 0 set for an offer, bit 1 for a snapshot's row,
+ *               bit 2 for a keyframe's
+ *     price     ticks, as the zigzag varint difference from the row before
+ *     size      zigzag varint, in wire::sizeScale units per lot
+ *
+ * so that the common case, a change near the last, moments after it, takes
+ * a handful of bytes rather than the hundred or so of its JSON, and decoding
+ * a column is one tight loop over bytes, mostly of one byte per value.
+ *
+ *     File      "GDAXTCK" + version u8, blocks, index, trailer
+ *     Block     rows u32, payload bytes u32, first and last time i64,
+ *               first and last sequence u64, column bytes u32 x5,
+ *               flags u32; then the five columns
+ *     Index     per block: offset u64, first and last time i64, first and
+ *               last sequence u64, rows u32, flags u32
+ *     Trailer   index offset u64, blocks u32, "GDXI"
+ *
+ * Every block decodes on its own, and the index, read first, tells which
+ * blocks span a time or sequence range, so a reader seeks straight to them.
+ * The rows of a message are never split across blocks, so a replay may
+ * start at any block; a replay that rebuilds a book should start at a block
+ * beginning with a snapshot, such as the writer's first, or restore one
+ * some other way.  All fields are little-endian.
+ *
+ * So that a book can be rebuilt as of any time without replaying the day
+ * up to it, the writer starts a block with every snapshot, and, at the
+ * start of a block after every so many rows, writes a keyframe: the whole
+ * book as it stands, as the rows of a snapshot, flagged as a keyframe, with
+ * the time and sequence of the message that left it so.  A block that
+ * starts with either has bit 0 of its flags set.  A replay applies the
+ * keyframe it starts from, and skips any others, which repeat what it has.
+ */
+namespace store {
+
+char const magic[8] = { 'G', 'D', 'A', 'X', 'T', 'C', 'K', 1 };
+char const trailerMagic[4] = { 'G', 'D', 'X', 'I' };
+
+enum Flags : uint8_t { OfferFlag = 1, SnapshotFlag = 2, KeyframeFlag = 4 };
+enum BlockFlags : uint32_t { KeyframeBlock = 1 };
+
+size_t const blockHeaderLength = 64;
+size_t const indexEntryLength = 48;
+size_t const trailerLength = 16;
+
+namespace detail {
+
+using wire::detail::load;
+using wire::detail::store;
+
+inline uint64_t zigzag(int64_t value)
+{
+    return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+inline int64_t unzigzag(uint64_t value)
+{
+    return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+inline void putVarint(std::vector<char> & out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+// packs the 7-bit groups of the bytes of `word`, a varint's, into a value
+inline uint64_t packVarint(uint64_t word)
+{
+    word = ((word & 0x7f007f007f007f00ull) >> 1)
+         | (word & 0x007f007f007f007full);
+    word = ((word & 0x3fff00003fff0000ull) >> 2)
+         | (word & 0x00003fff00003fffull);
+    return ((word & 0x0fffffff00000000ull) >> 4)
+         | (word & 0x000000000fffffffull);
+}
+
+/**
+ * Decodes `count` varints from [p, end), passing each in turn to `sink`, and
+ * returns the end of the last, or null if the column is short or malformed.
+ * While a word remains, it reads a word at a time, and decodes every varint
+ * that ends within it, finding each from the word's top bits, and packing
+ * its 7-bit groups with masked shifts, so that no load waits on the length
+ * of the varint before, and only a varint longer than a word on a loop.
+ */
+template<typename Sink>
+inline char const* getVarints(char const* p, char const* end, size_t count,
+                              Sink sink)
+{
+    size_t i = 0;
+    while (i < count && end - p >= 8)
+    {
+        uint64_t const word = load<uint64_t>(p);
+        uint64_t stops = ~word & 0x8080808080808080ull;
+        if (stops == 0x8080808080808080ull && count - i >= 8)
+        {
+            // eight single bytes
+            for (unsigned b = 0 ; b < 64 ; b += 8) sink((word >> b) & 0x7f);
+            i += 8;
+            p += 8;
+            continue;
+        }
+        if (!stops) break; // longer than a word
+        unsigned consumed = 0; // bits
+        do
+        {
+            unsigned const last = __builtin_ctzll(stops) + 1;
+            uint64_t value = word >> consumed;
+            if (last - consumed < 64)
+                value &= (uint64_t(1) << (last - consumed)) - 1;
+            sink(packVarint(value));
+            consumed = last;
+            stops &= stops - 1;
+        } while (stops && ++i < count);
+        if (!stops) ++i;
+        p += consumed/8;
+    }
+    for ( ; i < count ; ++i)
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0 ; ; shift += 7)
+        {
+            if (p == end || shift > 63) return nullptr;
+            uint8_t const byte = uint8_t(*p++);
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        sink(value);
+    }
+    return p;
+}
+
+} // namespace detail
+
+/** The rows of a block, decoded, column by column. */
+struct Columns
+{
+    std::vector<int64_t> times;
+    std::vector<uint64_t> sequences;
+    std::vector<uint8_t> flags;
+    std::vector<uint32_t> prices;
+    std::vector<int64_t> sizes; // wire::sizeScale units
+
+    size_t rows() const { return times.size(); }
+    Side side(size_t row) const
+    {
+        return flags[row] & OfferFlag ? Side::Offer : Side::Bid;
+    }
+    double size(size_t row) const { return double(sizes[row])/wire::sizeScale; }
+
+    void clear()
+    {
+        times.clear();
+        sequences.clear();
+        flags.clear();
+        prices.clear();
+        sizes.clear();
+    }
+};
+
+/** What the index says of a block. */
+struct BlockIndex
+{
+    uint64_t offset;
+    int64_t firstTime, lastTime;
+    uint64_t firstSequence, lastSequence;
+    uint32_t rows;
+    uint32_t flags;
+
+    /** Whether the block starts with a snapshot or a keyframe. */
+    bool keyframe() const { return flags & KeyframeBlock; }
+};
+
+/**
+ * Writes a store, message by message, e.g. from a book's listener (see
+ * BasicGDAXOrderBook::addListener()), numbering messages as it sees fit,
+ * but in increasing order, and writing a keyframe after every
+ * `keyframeRows` rows or so, unless 0; each costs a row per level of the
+ * book, and bounds the rows a time-travel query (see Reader::bookAt())
+ * decodes.  Throws std::runtime_error if it cannot write.
+ */
+class Writer
+{
+public:
+    explicit Writer(std::string const& path, size_t rowsPerBlock = 1 << 16,
+                    size_t keyframeRows = 1 << 18)
+        : m_file(path, std::ios::binary | std::ios::trunc),
+          m_rowsPerBlock(rowsPerBlock ? rowsPerBlock : 1),
+          m_keyframeRows(keyframeRows)
+    {
+        if (!m_file) throw std::runtime_error("cannot create " + path);
+        write(magic, sizeof magic);
+    }
+
+    Writer(Writer const&) = delete;
+    Writer& operator=(Writer const&) = delete;
+
+    /** Finishes the file, unless close() has; errors are lost. */
+    ~Writer()
+    {
+        try { close(); } catch (std::exception const&) {}
+    }
+
+    /**
+     * Appends the changes of a message at `time`, in nanoseconds of any
+     * epoch, numbered `sequence`, greater than that of the message before.
+     */
+    template<typename Price, typename Size>
+    void append(int64_t time, uint64_t sequence,
+                ChangeBatch<Price, Size> const& batch)
+    {
+        if (batch.type == ChangeBatch<Price, Size>::None) return;
+        if (m_appended && sequence <= m_lastSequence)
+        {
+            throw std::runtime_error("tick store sequence "
+                + std::to_string(sequence) + " out of order");
+        }
+        bool const snapshot =
+            batch.type == ChangeBatch<Price, Size>::Snapshot;
+        if (snapshot || m_rows.rows() >= m_rowsPerBlock) writeBlock();
+        if (snapshot)
+        {
+            m_bids.clear();
+            m_offers.clear();
+            m_keyframe = true;
+            m_sinceKeyframe = 0;
+        }
+        else if (m_rows.rows() == 0 && m_keyframeRows
+                 && m_sinceKeyframe >= m_keyframeRows)
+        {
+            writeKeyframe();
+        }
+        m_appended = true;
+        m_lastTime = time;
+        m_lastSequence = sequence;
+
+        for (auto const& change : batch.changes)
+        {
+            uint8_t const flags = (snapshot ? SnapshotFlag : 0)
+                | (change.side == Side::Offer ? OfferFlag : 0);
+            int64_t const size = std::llround(change.size*wire::sizeScale);
+            addRow(time, sequence, flags,
+                   static_cast<uint32_t>(change.price), size);
+            if (m_keyframeRows)
+            {
+                auto & side = change.side == Side::Offer ? m_offers : m_bids;
+                if (size == 0) { side.erase(change.price); }
+                else { side[change.price] = size; }
+            }
+        }
+        m_sinceKeyframe += batch.changes.size();
+    }
+
+    /** Writes the rows still pending, and the index. */
+    void close()
+    {
+        if (!m_file.is_open()) return;
+        writeBlock();
+        uint64_t const indexOffset = m_offset;
+        std::vector<char> index(m_index.size()*indexEntryLength
+                                + trailerLength);
+        char* p = index.data();
+        for (auto const& block : m_index)
+        {
+            detail::store<uint64_t>(p, block.offset);
+            detail::store<int64_t>(p + 8, block.firstTime);
+            detail::store<int64_t>(p + 16, block.lastTime);
+            detail::store<uint64_t>(p + 24, block.firstSequence);
+            detail::store<uint64_t>(p + 32, block.lastSequence);
+            detail::store<uint32_t>(p + 40, block.rows);
+            detail::store<uint32_t>(p + 44, block.flags);
+            p += indexEntryLength;
+        }
+        detail::store<uint64_t>(p, indexOffset);
+        detail::store<uint32_t>(p + 8, static_cast<uint32_t>(m_index.size()));
+        std::memcpy(p + 12, trailerMagic, sizeof trailerMagic);
+        write(index.data(), index.size());
+        m_file.close();
+        if (!m_file) throw std::runtime_error("cannot finish tick store");
+    }
+
+private:
+    std::ofstream m_file;
+    size_t const m_rowsPerBlock;
+    size_t const m_keyframeRows;
+    uint64_t m_offset = 0;
+    bool m_appended = false;
+    int64_t m_lastTime = 0;
+    uint64_t m_lastSequence = 0;
+    Columns m_rows; // not yet written
+    bool m_keyframe = false; // whether m_rows starts with one
+    size_t m_sinceKeyframe = 0; // rows appended since the last
+
+    // the book as it stands, in keyframe rows, if there are keyframes
+    std::map<uint32_t, int64_t> m_bids, m_offers;
+    std::vector<BlockIndex> m_index;
+    std::vector<char> m_columns[5];
+    std::vector<char> m_block;
+
+    void write(char const* data, size_t length)
+    {
+        m_file.write(data, length);
+        if (!m_file) throw std::runtime_error("cannot write tick store");
+        m_offset += length;
+    }
+
+    void addRow(int64_t time, uint64_t sequence, uint8_t flags,
+                uint32_t price, int64_t size)
+    {
+        m_rows.times.push_back(time);
+        m_rows.sequences.push_back(sequence);
+        m_rows.flags.push_back(flags);
+        m_rows.prices.push_back(price);
+        m_rows.sizes.push_back(size);
+    }
+
+    // starts the block with the book as the last message left it
+    void writeKeyframe()
+    {
+        uint8_t const flags = SnapshotFlag | KeyframeFlag;
+        for (auto const& level : m_bids)
+        {
+            addRow(m_lastTime, m_lastSequence, flags, level.first,
+                   level.second);
+        }
+        for (auto const& level : m_offers)
+        {
+            addRow(m_lastTime, m_lastSequence, flags | OfferFlag,
+                   level.first, level.second);
+        }
+        m_keyframe = true;
+        m_sinceKeyframe = 0;
+    }
+
+    void writeBlock()
+    {
+        size_t const rows = m_rows.rows();
+        if (rows == 0) return;
+        for (auto & column : m_columns) column.clear();
+
+        int64_t time = m_rows.times.front();
+        uint64_t sequence = m_rows.sequences.front();
+        int64_t price = 0;
+        for (size_t i = 0 ; i < rows ; ++i)
+        {
+            detail::putVarint(m_columns[0],
+                              detail::zigzag(m_rows.times[i] - time));
+            detail::putVarint(m_columns[1], m_rows.sequences[i] - sequence);
+            m_columns[2].push_back(char(m_rows.flags[i]));
+            detail::putVarint(m_columns[3], detail::zigzag(
+                int64_t(m_rows.prices[i]) - price));
+            detail::putVarint(m_columns[4], detail::zigzag(m_rows.sizes[i]));
+            time = m_rows.times[i];
+            sequence = m_rows.sequences[i];
+            price = m_rows.prices[i];
+        }
+
+        BlockIndex block = { m_offset,
+            m_rows.times.front(), m_rows.times.back(),
+            m_rows.sequences.front(), m_rows.sequences.back(),
+            static_cast<uint32_t>(rows),
+            m_keyframe ? uint32_t(KeyframeBlock) : 0 };
+        for (size_t i = 0 ; i < rows ; ++i)
+        {
+            block.firstTime = std::min(block.firstTime, m_rows.times[i]);
+            block.lastTime = std::max(block.lastTime, m_rows.times[i]);
+        }
+
+        size_t payload = 0;
+        for (auto const& column : m_columns) payload += column.size();
+        m_block.resize(blockHeaderLength);
+        char* p = m_block.data();
+        detail::store<uint32_t>(p, static_cast<uint32_t>(rows));
+        detail::store<uint32_t>(p + 4, static_cast<uint32_t>(payload));
+        // the first row's time, from which the column counts
+        detail::store<int64_t>(p + 8, m_rows.times.front());
+        detail::store<int64_t>(p + 16, block.lastTime);
+        detail::store<uint64_t>(p + 24, block.firstSequence);
+        detail::store<uint64_t>(p + 32, block.lastSequence);
+        for (size_t c = 0 ; c < 5 ; ++c)
+        {
+            detail::store<uint32_t>(p + 40 + 4*c,
+                static_cast<uint32_t>(m_columns[c].size()));
+        }
+        detail::store<uint32_t>(p + 60, block.flags);
+        for (auto const& column : m_columns)
+            m_block.insert(m_block.end(), column.begin(), column.end());
+        write(m_block.data(), m_block.size());
+
+        m_index.push_back(block);
+        m_rows.clear();
+        m_keyframe = false;
+    }
+};
+
+/**
+ * Reads a store: its index on opening, and then whichever blocks are asked
+ * for.  Throws std::runtime_error for a file that is not a complete store.
+ */
+class Reader
+{
+public:
+    explicit Reader(std::string const& path)
+        : m_file(path, std::ios::binary)
+    {
+        char header[sizeof magic];
+        char trailer[trailerLength];
+        if (!m_file.read(header, sizeof header)
+            || std::memcmp(header, magic, sizeof magic) != 0
+            || !m_file.seekg(-int(trailerLength), std::ios::end)
+            || !m_file.read(trailer, sizeof trailer)
+            || std::memcmp(trailer + 12, trailerMagic, sizeof trailerMagic))
+        {
+            throw std::runtime_error(path + " is not a tick store");
+        }
+        uint64_t const indexOffset = detail::load<uint64_t>(trailer);
+        uint32_t const blocks = detail::load<uint32_t>(trailer + 8);
+        std::vector<char> index(size_t(blocks)*indexEntryLength);
+        if (!m_file.seekg(indexOffset)
+            || !m_file.read(index.data(), index.size()))
+        {
+            throw std::runtime_error(path + " has no tick store index");
+        }
+        for (char const* p = index.data() ; p != index.data() + index.size() ;
+             p += indexEntryLength)
+        {
+            m_index.push_back({ detail::load<uint64_t>(p),
+                detail::load<int64_t>(p + 8), detail::load<int64_t>(p + 16),
+                detail::load<uint64_t>(p + 24), detail::load<uint64_t>(p + 32),
+                detail::load<uint32_t>(p + 40),
+                detail::load<uint32_t>(p + 44) });
+        }
+    }
+
+    std::vector<BlockIndex> const& blocks() const { return m_index; }
+
+    /**
+     * The first block that may hold rows at or after `time`, or blocks().
+     * size() if none does; blocks are in sequence order, and so in time
+     * order, as long as the times appended only increase.
+     */
+    size_t findTime(int64_t time) const
+    {
+        return std::lower_bound(m_index.begin(), m_index.end(), time,
+            [](BlockIndex const& block, int64_t time)
+            {
+                return block.lastTime < time;
+            }) - m_index.begin();
+    }
+
+    /** The first block holding rows at or after `sequence`, as above. */
+    size_t findSequence(uint64_t sequence) const
+    {
+        return std::lower_bound(m_index.begin(), m_index.end(), sequence,
+            [](BlockIndex const& block, uint64_t sequence)
+            {
+                return block.lastSequence < sequence;
+            }) - m_index.begin();
+    }
+
+    /** Decodes block number `block` into `columns`. */
+    void read(size_t block, Columns & columns)
+    {
+        BlockIndex const& entry = m_index.at(block);
+        m_block.resize(blockHeaderLength);
+        if (!m_file.seekg(entry.offset)
+            || !m_file.read(m_block.data(), blockHeaderLength))
+        {
+            throw std::runtime_error("cannot read tick store block");
+        }
+        uint32_t const rows = detail::load<uint32_t>(m_block.data());
+        uint32_t const payload = detail::load<uint32_t>(m_block.data() + 4);
+        int64_t const firstTime = detail::load<int64_t>(m_block.data() + 8);
+        uint64_t const firstSequence =
+            detail::load<uint64_t>(m_block.data() + 24);
+        uint32_t lengths[5];
+        for (size_t c = 0 ; c < 5 ; ++c)
+            lengths[c] = detail::load<uint32_t>(m_block.data() + 40 + 4*c);
+        uint64_t columnBytes = 0;
+        for (uint32_t length : lengths) columnBytes += length;
+        m_block.resize(payload);
+        if (columnBytes != payload || !m_file.read(m_block.data(), payload))
+            throw std::runtime_error("cannot read tick store block");
+
+        decode(m_block.data(), lengths, rows, firstTime, firstSequence,
+               columns);
+    }
+
+    /**
+     * Calls `apply` with each message of the blocks from `first` on, in
+     * order, rebuilt as the batch it was appended as, its time and sequence,
+     * and with the keyframe that starts block `first`, if one does, as a
+     * snapshot, but with no later keyframe.
+     */
+    template<typename Price, typename Size>
+    void replay(size_t first, std::function<void(int64_t time,
+        uint64_t sequence, ChangeBatch<Price, Size> const& batch)> apply)
+    {
+        replayRange(first, std::numeric_limits<int64_t>::max(), apply);
+    }
+
+    /**
+     * The last block starting with a keyframe, or a snapshot, from no later
+     * than `time`, or blocks().size() if there is none.
+     */
+    size_t keyframeAt(int64_t time) const
+    {
+        for (size_t block = std::min(findTime(time) + 1, m_index.size())
+             ; block-- > 0 ; )
+        {
+            if (m_index[block].keyframe() && m_index[block].firstTime <= time)
+                return block;
+        }
+        return m_index.size();
+    }
+
+    /**
+     * As replay(), but from the keyframe at `time` (see keyframeAt()), or the
+     * first block if there is none, and only up to the last message from no
+     * later than `time`, so that `apply` rebuilds the book as of `time`.
+     */
+    template<typename Price, typename Size>
+    void replayUntil(int64_t time, std::function<void(int64_t time,
+        uint64_t sequence, ChangeBatch<Price, Size> const& batch)> apply)
+    {
+        size_t const keyframe = keyframeAt(time);
+        replayRange(keyframe == m_index.size() ? 0 : keyframe, time, apply);
+    }
+
+    /**
+     * Rebuilds the book as of `time` into `bids` and `offers`, by way of
+     * replayUntil(), returning the sequence of the last message applied, or
+     * 0 if there is none.
+     */
+    template<typename Price, typename Size>
+    uint64_t bookAt(int64_t time,
+                    std::map<Price, Size, std::greater<Price>> & bids,
+                    std::map<Price, Size> & offers)
+    {
+        using batch_t = ChangeBatch<Price, Size>;
+        bids.clear();
+        offers.clear();
+        uint64_t last = 0;
+        replayUntil<Price, Size>(time,
+            [&bids, &offers, &last](int64_t, uint64_t sequence,
+                                    batch_t const& batch)
+            {
+                if (batch.type == batch_t::Snapshot)
+                {
+                    bids.clear();
+                    offers.clear();
+                }
+                for (auto const& change : batch.changes)
+                {
+                    if (change.side == Side::Bid) { set(bids, change); }
+                    else { set(offers, change); }
+                }
+                last = sequence;
+            });
+        return last;
+    }
+
+private:
+    std::ifstream m_file;
+    std::vector<BlockIndex> m_index;
+    std::vector<char> m_block;
+
+    template<typename Map, typename Change>
+    static void set(Map & side, Change const& change)
+    {
+        if (change.size == 0) { side.erase(change.price); }
+        else { side[change.price] = change.size; }
+    }
+
+    // replays from block `first` up to `until`; see replay()
+    template<typename Price, typename Size>
+    void replayRange(size_t first, int64_t until, std::function<void(
+        int64_t time, uint64_t sequence, ChangeBatch<Price, Size> const& batch)>
+            apply)
+    {
+        using batch_t = ChangeBatch<Price, Size>;
+        Columns columns;
+        batch_t batch;
+        for (size_t block = first ; block < m_index.size() ; ++block)
+        {
+            read(block, columns);
+            for (size_t row = 0 ; row < columns.rows() ; )
+            {
+                if (columns.times[row] > until) return;
+                if (block != first && columns.flags[row] & KeyframeFlag)
+                {
+                    while (row < columns.rows()
+                           && columns.flags[row] & KeyframeFlag)
+                    {
+                        ++row;
+                    }
+                    continue;
+                }
+                batch.clear();
+                batch.type = columns.flags[row] & SnapshotFlag
+                    ? batch_t::Snapshot : batch_t::Update;
+                size_t const start = row;
+                for ( ; row < columns.rows()
+                        && columns.sequences[row] == columns.sequences[start]
+                      ; ++row)
+                {
+                    batch.changes.push_back({ columns.side(row),
+                        static_cast<Price>(columns.prices[row]),
+                        static_cast<Size>(columns.size(row)) });
+                }
+                apply(columns.times[start], columns.sequences[start], batch);
+            }
+        }
+    }
+
+    void decode(char const* p, uint32_t const* lengths, uint32_t rows,
+                int64_t time, uint64_t sequence, Columns & columns)
+    {
+        columns.times.resize(rows);
+        columns.sequences.resize(rows);
+        columns.flags.resize(rows);
+        columns.prices.resize(rows);
+        columns.sizes.resize(rows);
+        int64_t* times = columns.times.data();
+        uint64_t* sequences = columns.sequences.data();
+        uint32_t* prices = columns.prices.data();
+        int64_t* sizes = columns.sizes.data();
+        int64_t price = 0;
+
+        char const* ends[5];
+        for (size_t c = 0 ; c < 5 ; ++c)
+            ends[c] = (c ? ends[c-1] : p) + lengths[c];
+
+        // each column's varints are summed, or not, as they are decoded, by
+        // a sink of its own, whose copies of the running sums and the
+        // output pointer stay in registers
+        bool const valid = lengths[2] == rows
+            && detail::getVarints(p, ends[0], rows,
+                [times, time](uint64_t value) mutable
+                {
+                    *times++ = time += detail::unzigzag(value);
+                }) == ends[0]
+            && detail::getVarints(ends[0], ends[1], rows,
+                [sequences, sequence](uint64_t value) mutable
+                {
+                    *sequences++ = sequence += value;
+                }) == ends[1]
+            && detail::getVarints(ends[2], ends[3], rows,
+                [prices, price](uint64_t value) mutable
+                {
+                    *prices++ = static_cast<uint32_t>(
+                        price += detail::unzigzag(value));
+                }) == ends[3]
+            && detail::getVarints(ends[3], ends[4], rows,
+                [sizes](uint64_t value) mutable
+                {
+                    *sizes++ = detail::unzigzag(value);
+                }) == ends[4];
+        if (!valid) throw std::runtime_error("corrupt tick store block");
+        std::memcpy(columns.flags.data(), ends[1], rows);
+    }
+};
+
+} // namespace store
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_TICK_STORE_HPP
@@ -0,0 +1,328 @@
+#ifndef GDAX_ORDERBOOK_WIRE_FORMAT_HPP
+#define GDAX_ORDERBOOK_WIRE_FORMAT_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "gdax-orderbook/change-batch.hpp"
+
+namespace gdax {
+
+/**
+ * A compact binary format for redistributing a book's normalized changes
+ * (see gdax::ChangeBatch), modelled on Simple Binary Encoding: every message
+ * is a fixed-layout header, a fixed-layout block, and a repeating group of
+ * fixed-layout level entries, all little-endian, so that encoding and
+ * decoding are stores and loads at constant offsets into the caller's
+ * buffer, with no parsing, allocation or copying of the message as a whole.
+ *
+ *     MessageHeader  blockLength u16, templateId u16, schemaId u16,
+ *                    version u16
+ *     Block          sequence u64, productId u32, fragment u16,
+ *                    fragments u16
+ *     Group header   blockLength u16, reserved u16, numInGroup u32
+ *     Level (each)   price u32 (ticks), side u8, reserved 3 bytes,
+ *                    size i64 (fixed point, sizeScale units per lot)
+ *
+ * The templateId tells a Snapshot, which lists every level of the book,
+ * from a Delta, which lists levels set to a new size, 0 to remove them.
+ * Sequence numbers and product ids are the publisher's to assign, e.g. one
+ * sequence per product, and an id per product agreed with subscribers.  A
+ * message too long for its transport may be split into `fragments`
+ * messages of the same sequence, numbered by `fragment` from 0, each with
+ * some of the levels; otherwise it is fragment 0 of 1.
+ *
+ * The flyweights below wrap a pointer into a buffer, like SBE's generated
+ * codecs; they check lengths when wrapping, not on each access.  Decoders
+ * honour the blockLengths a message declares, so that later versions of
+ * the schema can append fields without breaking older decoders.
+ */
+namespace wire {
+
+uint16_t const schemaId = 0x6744;      // "Dg"
+uint16_t const schemaVersion = 1;
+int64_t const sizeScale = 100000000;   // sizes have at most 8 decimals
+
+enum TemplateId : uint16_t { SnapshotTemplate = 1, DeltaTemplate = 2 };
+
+namespace detail {
+
+// the format is little-endian, as are the hosts it is meant for
+template<typename T>
+inline T load(char const* p)
+{
+    T value;
+    std::memcpy(&value, p, sizeof value);
+    return value;
+}
+template<typename T>
+inline void store(char* p, T value)
+{
+    std::memcpy(p, &value, sizeof value);
+}
+
+} // namespace detail
+
+class MessageHeader
+{
+public:
+    static constexpr size_t encodedLength = 8;
+
+    MessageHeader() : m_buffer(nullptr) {}
+    explicit MessageHeader(char* buffer) : m_buffer(buffer) {}
+
+    uint16_t blockLength() const { return detail::load<uint16_t>(m_buffer); }
+    uint16_t templateId() const { return detail::load<uint16_t>(m_buffer + 2); }
+    uint16_t schemaId() const { return detail::load<uint16_t>(m_buffer + 4); }
+    uint16_t version() const { return detail::load<uint16_t>(m_buffer + 6); }
+
+    void encode(uint16_t blockLength, uint16_t templateId)
+    {
+        detail::store<uint16_t>(m_buffer, blockLength);
+        detail::store<uint16_t>(m_buffer + 2, templateId);
+        detail::store<uint16_t>(m_buffer + 4, wire::schemaId);
+        detail::store<uint16_t>(m_buffer + 6, schemaVersion);
+    }
+
+private:
+    char* m_buffer;
+};
+
+/** One level entry of a message's group, read or written in place. */
+class Level
+{
+public:
+    static constexpr size_t encodedLength = 16;
+
+    explicit Level(char* buffer) : m_buffer(buffer) {}
+
+    uint32_t price() const { return detail::load<uint32_t>(m_buffer); }
+    Side side() const
+    {
+        return detail::load<uint8_t>(m_buffer + 4) ? Side::Offer : Side::Bid;
+    }
+    int64_t sizeUnits() const { return detail::load<int64_t>(m_buffer + 8); }
+    double size() const { return double(sizeUnits())/sizeScale; }
+
+    Level& price(uint32_t price)
+    {
+        detail::store<uint32_t>(m_buffer, price);
+        return *this;
+    }
+    Level& side(Side side)
+    {
+        detail::store<uint8_t>(m_buffer + 4, side == Side::Offer ? 1 : 0);
+        std::memset(m_buffer + 5, 0, 3);
+        return *this;
+    }
+    Level& size(double size)
+    {
+        detail::store<int64_t>(m_buffer + 8, std::llround(size*sizeScale));
+        return *this;
+    }
+
+private:
+    char* m_buffer;
+};
+
+/**
+ * Writes a Snapshot or Delta message into a caller's buffer: construct it
+ * on the buffer, set the block's fields, then levels(n), and fill in each
+ * level(i) of the n.
+ */
+class Encoder
+{
+public:
+    static constexpr size_t blockLength = 16;
+    static constexpr size_t groupHeaderLength = 8;
+    static constexpr size_t fixedLength =
+        MessageHeader::encodedLength + blockLength + groupHeaderLength;
+
+    /** The buffer size a message with `levels` levels needs. */
+    static size_t encodedLength(size_t levels)
+    {
+        return fixedLength + levels*Level::encodedLength;
+    }
+
+    Encoder(char* buffer, TemplateId templateId)
+        : m_buffer(buffer)
+    {
+        MessageHeader(m_buffer).encode(blockLength, templateId);
+        fragment(0, 1);
+        detail::store<uint16_t>(group(), Level::encodedLength);
+        detail::store<uint16_t>(group() + 2, 0);
+        detail::store<uint32_t>(group() + 4, 0);
+    }
+
+    Encoder& sequence(uint64_t sequence)
+    {
+        detail::store<uint64_t>(block(), sequence);
+        return *this;
+    }
+    Encoder& productId(uint32_t productId)
+    {
+        detail::store<uint32_t>(block() + 8, productId);
+        return *this;
+    }
+    Encoder& fragment(uint16_t fragment, uint16_t fragments)
+    {
+        detail::store<uint16_t>(block() + 12, fragment);
+        detail::store<uint16_t>(block() + 14, fragments);
+        return *this;
+    }
+    Encoder& levels(uint32_t count)
+    {
+        detail::store<uint32_t>(group() + 4, count);
+        return *this;
+    }
+
+    Level level(size_t i)
+    {
+        return Level(m_buffer + fixedLength + i*Level::encodedLength);
+    }
+
+    size_t encodedLength() const
+    {
+        return encodedLength(detail::load<uint32_t>(group() + 4));
+    }
+
+private:
+    char* m_buffer;
+
+    char* block() const { return m_buffer + MessageHeader::encodedLength; }
+    char* group() const
+    {
+        return m_buffer + MessageHeader::encodedLength + blockLength;
+    }
+};
+
+/**
+ * Reads a message in place, once wrap() has checked that `length` bytes
+ * hold all of it, as encoded by this or a compatible later version.
+ */
+class Decoder
+{
+public:
+    Decoder()
+        : m_buffer(nullptr), m_levels(nullptr), m_levelLength(0),
+          m_levelCount(0)
+    {}
+
+    bool wrap(char const* buffer, size_t length)
+    {
+        if (length < MessageHeader::encodedLength) return false;
+        MessageHeader header(const_cast<char*>(buffer));
+        if (header.schemaId() != schemaId
+            || header.blockLength() < Encoder::blockLength
+            || (header.templateId() != SnapshotTemplate
+                && header.templateId() != DeltaTemplate))
+        {
+            return false;
+        }
+        size_t groupOffset =
+            MessageHeader::encodedLength + header.blockLength();
+        if (length < groupOffset + Encoder::groupHeaderLength) return false;
+        m_levelLength = detail::load<uint16_t>(buffer + groupOffset);
+        uint32_t count = detail::load<uint32_t>(buffer + groupOffset + 4);
+        if (m_levelLength < Level::encodedLength
+            || (length - groupOffset - Encoder::groupHeaderLength)
+                / m_levelLength < count)
+        {
+            return false;
+        }
+        m_buffer = buffer;
+        m_levels = buffer + groupOffset + Encoder::groupHeaderLength;
+        m_levelCount = count;
+        return true;
+    }
+
+    TemplateId templateId() const
+    {
+        return TemplateId(MessageHeader(const_cast<char*>(m_buffer))
+                          .templateId());
+    }
+    uint64_t sequence() const
+    {
+        return detail::load<uint64_t>(m_buffer + MessageHeader::encodedLength);
+    }
+    uint32_t productId() const
+    {
+        return detail::load<uint32_t>(
+            m_buffer + MessageHeader::encodedLength + 8);
+    }
+    uint16_t fragment() const
+    {
+        return detail::load<uint16_t>(
+            m_buffer + MessageHeader::encodedLength + 12);
+    }
+    uint16_t fragments() const
+    {
+        return detail::load<uint16_t>(
+            m_buffer + MessageHeader::encodedLength + 14);
+    }
+    uint32_t levels() const { return m_levelCount; }
+    Level const level(size_t i) const
+    {
+        return Level(const_cast<char*>(m_levels + i*m_levelLength));
+    }
+
+    /** The length of the message, which may be less than wrapped. */
+    size_t encodedLength() const
+    {
+        return size_t(m_levels - m_buffer) + m_levelCount*m_levelLength;
+    }
+
+private:
+    char const* m_buffer;
+    char const* m_levels;
+    size_t m_levelLength;
+    uint32_t m_levelCount;
+};
+
+/**
+ * Encodes `batch` into `buffer`, which must have room for
+ * Encoder::encodedLength(batch.changes.size()) bytes, returning the length
+ * of the message, or 0 for a batch of type None, which has no message.
+ */
+template<typename Price, typename Size>
+size_t encode(ChangeBatch<Price, Size> const& batch, uint64_t sequence,
+              uint32_t productId, char* buffer)
+{
+    if (batch.type == ChangeBatch<Price, Size>::None) return 0;
+    Encoder encoder(buffer, batch.type == ChangeBatch<Price, Size>::Snapshot
+        ? SnapshotTemplate : DeltaTemplate);
+    encoder.sequence(sequence)
+           .productId(productId)
+           .levels(static_cast<uint32_t>(batch.changes.size()));
+    for (size_t i = 0 ; i < batch.changes.size() ; ++i)
+    {
+        auto const& change = batch.changes[i];
+        encoder.level(i).price(change.price).side(change.side)
+                        .size(change.size);
+    }
+    return encoder.encodedLength();
+}
+
+/** Appends the levels of a wrapped message to `batch`, of its type. */
+template<typename Price, typename Size>
+void decode(Decoder const& decoder, ChangeBatch<Price, Size> & batch)
+{
+    batch.type = decoder.templateId() == SnapshotTemplate
+        ? ChangeBatch<Price, Size>::Snapshot
+        : ChangeBatch<Price, Size>::Update;
+    batch.changes.reserve(batch.changes.size() + decoder.levels());
+    for (size_t i = 0 ; i < decoder.levels() ; ++i)
+    {
+        Level const level = decoder.level(i);
+        batch.changes.push_back({ level.side(),
+            static_cast<Price>(level.price()),
+            static_cast<Size>(level.size()) });
+    }
+}
+
+} // namespace wire
+} // namespace gdax
+
+#endif // GDAX_ORDERBOOK_WIRE_FORMAT_HPP